@@ -1,459 +1,1163 @@
 #include "include/address_book.h"
+#include "include/name_normalization.h"
+#include <algorithm>
+#include <charconv>
+#include <functional>
 #include <stdexcept>
-#include <iostream>
-#include <regex>
+#include <unordered_map>
 
-void AddressBook::add(std::string first_name,std::string last_name,std::string phone_number) {
-    // Regex is used to remove all spaces in the first and last names.
-    // This ensures neatly formatted keys as well as catching any blank spaces for first names
-    first_name = std::regex_replace(first_name, std::regex("\\s+"), "");
-    last_name = std::regex_replace(last_name, std::regex("\\s+"), "");
-    while (first_name.empty()) {
-        // The user must provide a name that is not blank
-        std::cout << "Please enter a valid first name" << std::endl;
-        // getline is used throughout the program as it takes spaces as part of the input,
-        // as opposed to cin which separates an input by spaces and treats them as separate inputs
-        std::getline(std::cin,first_name);
-        first_name = std::regex_replace(first_name, std::regex("\\s+"), "");
-    }
-    std::string full_name;
-    // Ensures that a key consisting of just a first name does not have a space on the end
-    if (last_name.empty()) {
-        full_name = first_name;
-    } else {
-        full_name = first_name + " " + last_name;
+namespace {
+
+using Row = EntryTable::Row;
+
+// Whether a collation key starts with the folded prefix
+bool startsWith(std::string_view folded_name, const std::string& folded_prefix)
+{
+    return folded_name.compare(0, folded_prefix.size(), folded_prefix) == 0;
+}
+
+// A resume token for pageByFirstName or pageByLastName: the collation keys of the name sorted by and the name after it,
+// then the address book key, which are what first_name_order and last_name_order sort by.
+// The separator sorts before every character of a name, so "smith" comes before "smithson"
+template <typename SortFields>
+std::string makeSortKey(const SortFields& fields)
+{
+    std::string sort_key;
+    sort_key.reserve(fields.name.size() + fields.second_name.size() + fields.key.first_name.size()
+                     + fields.key.last_name.size() + 3);
+    sort_key += fields.name;
+    sort_key += '\1';
+    sort_key += fields.second_name;
+    sort_key += '\1';
+    sort_key += fields.key.first_name;
+    if (!fields.key.last_name.empty()){
+        sort_key += ' ';
+        sort_key += fields.key.last_name;
     }
-    try{
-        // .at() can be used to instantly check the entry associated with a certain key. 
-        // This avoids having to search through the list sequentially for the name, 
-        // which would not be efficient for a large list.
-        this->address_book_list.at(full_name);
-        std::cout << "This entry already exists" << std::endl;
-    } catch(std::exception& ex){
-        // Catches the exception thrown by .at() if the name is not present in the address book
-        Entry new_entry;
-        new_entry.first_name = first_name;
-        new_entry.last_name = last_name;
-        new_entry.phone_number = phone_number;
-        this->address_book_list.insert(std::pair<std::string, Entry>(full_name, new_entry));
-        std::cout << full_name << " successfully added" << std::endl;
-    }
-}
-
-void AddressBook::remove(const std::string& entry_to_remove)
-{
-    // Checks to see if the user entered a blank space or if the address book is empty.
-    // If either is true, the proceeding code is ignored as it won't yield any results
-    if(std::regex_replace(entry_to_remove, std::regex("\\s+"), "").empty()
-    || this->address_book_list.empty()){
-        std::cout << "No matching entries for that name" << std::endl;
-    } else{
-        try{
-            // The entry can be removed immediately if the user enters the exact key for that entry,
-            // speeding up the removal process.
-            // However, if the second name is blank, then an exception is thrown.
-            // This is done because an entry that only has a first name and no second name may share
-            // that first name with other entries. If this check was not done, then only that entry would
-            // be found here. For example, if an entry had just "Daniel" as a first name and no second name,
-            // only that entry would be returned, while ignoring all the other "Daniel"s with second names
-            std::exception ex;
-            if (this->address_book_list.at(entry_to_remove).last_name.empty()){
-                throw ex;
-            }
-            this->address_book_list.erase(entry_to_remove);
-            std::cout << "Entry successfully removed" << std::endl;
-        } catch(std::exception& ex){
-            bool is_empty;
-            is_empty = false;
-            // The user is presented with a series of options to remove based on their search
-            // if it didn't match a singular entry, making it easier to remove entries
-            this->printSearchResults(entry_to_remove,&is_empty);
-            // Proceeding code is ignored (is_empty is changed to true) if there are no search results.
-            // The user is informed of this in printSearchResults
-            if (!is_empty){
-                std::cout << "Please select an entry to be removed by typing \"*first name* *last name*\" " <<
-                          "(or \"*first name*\" if there's no last name) " <<
-                          "or type \"Q\" to quit and return to the menu" <<
-                          std::endl;
-                bool quit = false;
-                std::string entry_choice;
-                std::getline(std::cin,entry_choice);
-                // Gives the user a chance to go back to the menu so they aren't forced to remove an entry
-                if (entry_choice == "Q"){
-                    quit = true;
-                }
-                while (!quit){
-                    try{
-                        this->address_book_list.at(entry_choice);
-                        this->address_book_list.erase(entry_choice);
-                        std::cout << "Entry successfully removed" << std::endl;
-                        quit = true;
-                    } catch (std::exception& ex){
-                        std::cout << "Please select an entry to be removed by typing \"*first name* *last name*\" " <<
-                                  "(or \"*first name*\" if there's no last name) " <<
-                                  "or type \"Q\" to quit and return to the menu" <<
-                                  std::endl;
-                        std::getline(std::cin,entry_choice);
-                        if (entry_choice == "Q"){
-                            quit = true;
-                        }
-                    }
-                }
-            }
-        }
+    return sort_key;
+}
+
+// Splits a resume token made by makeSortKey back into the fields it was made from.
+// Anything else is read as far as it goes, with the fields it is missing left empty
+template <typename SortFields>
+SortFields parseSortKey(std::string_view sort_key)
+{
+    SortFields fields;
+    std::size_t name_end = std::min(sort_key.find('\1'), sort_key.size());
+    fields.name = sort_key.substr(0, name_end);
+    sort_key.remove_prefix(std::min(name_end + 1, sort_key.size()));
+    std::size_t second_name_end = std::min(sort_key.find('\1'), sort_key.size());
+    fields.second_name = sort_key.substr(0, second_name_end);
+    sort_key.remove_prefix(std::min(second_name_end + 1, sort_key.size()));
+    fields.key = EntryTable::Key{sort_key, std::string_view()};
+    return fields;
+}
+
+// Sorts rows into an index's order and adds them to it, each one placed straight after the one before it where that is its place
+template <typename Index>
+void insertSorted(Index& index, std::vector<Row>& rows)
+{
+    std::sort(rows.begin(), rows.end(), index.key_comp());
+    auto next = index.begin();
+    for (Row row : rows){
+        next = std::next(index.emplace_hint(next, row));
     }
 }
 
-void AddressBook::alter(std::string entry_to_alter) {
-    if(std::regex_replace(entry_to_alter, std::regex("\\s+"), "").empty()
-    || this->address_book_list.empty()) {
-        std::cout << "No matching entries for that name" << std::endl;
-    } else{
-        bool verified_entry = false;
-        try {
-            std::exception ex;
-            if (this->address_book_list.at(entry_to_alter).last_name.empty()){
-                throw ex;
-            }
-            verified_entry = true;
-        } catch(std::exception& ex){
-            bool is_empty;
-            is_empty = false;
-            this->printSearchResults(entry_to_alter,&is_empty);
-            if (!is_empty){
-                std::cout << "Please select an entry to be altered by typing \"*first name* *last name*\" " <<
-                             "(or \"*first name*\" if there's no last name) " <<
-                             "or type \"Q\" to quit and return to the menu" <<
-                             std::endl;
-                bool quit = false;
-                std::string user_choice;
-                std::getline(std::cin,user_choice);
-                if (user_choice == "Q"){
-                    quit = true;
-                }
-                while (!quit){
-                    try{
-                        this->address_book_list.at(user_choice);
-                        verified_entry = true;
-                        // entry_to_alter changed to user_choice as the previous value did not match an entry
-                        entry_to_alter = user_choice;
-                        quit = true;
-                    } catch (std::exception& ex){
-                        std::cout << "Please select an entry to be altered by typing \"*first name* *last name*\" " <<
-                                  "(or \"*first name*\" if there's no last name) " <<
-                                  "or type \"Q\" to quit and return to the menu" <<
-                                  std::endl;
-                        std::getline(std::cin,user_choice);
-                        if (user_choice == "Q"){
-                            quit = true;
-                        }
-                    }
-                }
-            }
+// Sorts rows into an index's order and removes them from it
+template <typename Index>
+void eraseSorted(Index& index, std::vector<Row>& rows)
+{
+    std::sort(rows.begin(), rows.end(), index.key_comp());
+    for (Row row : rows){
+        index.erase(row);
+    }
+}
+
+using PostingMap = std::map<std::string,std::vector<Row>,std::less<>>;
+
+// Adds an entry to the posting list of a name, keeping the list in row order.
+// Returns whether the name is new, having had no list before
+bool addPosting(PostingMap& postings, std::string_view folded_name, Row row)
+{
+    auto term = postings.find(folded_name);
+    if (term == postings.end()){
+        postings.emplace(std::string(folded_name), std::vector<Row>{row});
+        return true;
+    }
+    auto& list = term->second;
+    list.insert(std::upper_bound(list.begin(), list.end(), row), row);
+    return false;
+}
+
+// Returns whether the name is gone, its list having been left empty
+bool removePosting(PostingMap& postings, std::string_view folded_name, Row row)
+{
+    auto term = postings.find(folded_name);
+    if (term == postings.end()){
+        return false;
+    }
+    auto& list = term->second;
+    auto position = std::lower_bound(list.begin(), list.end(), row);
+    if (position != list.end() && *position == row){
+        list.erase(position);
+    }
+    if (!list.empty()){
+        return false;
+    }
+    postings.erase(term);
+    return true;
+}
+
+// Adds many (name, row) pairs to the posting lists, going through each name's list once.
+// Each list's new rows are put on its end, and then sorted and merged with the rows it already had,
+// so a list is sorted once rather than once per entry. The names that had no list before are added to new_names
+void addPostings(PostingMap& postings, std::vector<std::pair<std::string_view,Row>>& names,
+                 std::vector<std::string>& new_names)
+{
+    std::sort(names.begin(), names.end());
+    for (std::size_t start = 0, end ; start<names.size() ; start = end){
+        auto term = postings.find(names[start].first);
+        if (term == postings.end()){
+            term = postings.emplace(std::string(names[start].first), std::vector<Row>()).first;
+            new_names.push_back(term->first);
         }
-        if (verified_entry){
-            verified_entry = false;
-            std::string user_choice;
-            // Default values for all the altered information
-            std::string new_first_name = address_book_list.at(entry_to_alter).first_name;
-            std::string new_last_name = address_book_list.at(entry_to_alter).last_name;
-            std::string new_phone_number = address_book_list.at(entry_to_alter).phone_number;
-            std::string new_full_name = entry_to_alter;
-            while(!verified_entry){
-                std::cout << "What would you like to do? (1,2,3,4) \n "
-                             "1.) Alter the first name (currently not working, details in code) \n " <<
-                             "2.) Alter the last name (currently not working, details in code) \n " <<
-                             "3.) Alter the phone number \n " <<
-                             "4.) Quit and save the new edits "<< std::endl;
-                std::getline(std::cin,user_choice);
-                while (user_choice != "1" && user_choice != "2" && user_choice != "3" && user_choice != "4"){
-                    std::cout << "Please choose one of the options (1,2,3,4)" << std::endl;
-                    std::getline(std::cin,user_choice);
-                }
-                // Converts user's choice to an integer
-                switch(std::stoi(user_choice)){
-                    case 1:
-                        std::cout << "Please enter the new first name" << std::endl;
-                        std::getline(std::cin,new_first_name);
-                        while (std::regex_replace(new_first_name, std::regex("\\s+"), "").empty()){
-                            std::cout << "This is not valid, please enter the new first name" << std::endl;
-                            std::getline(std::cin,new_first_name);
-                        }
-                        new_first_name = std::regex_replace(new_first_name, std::regex("\\s+"), "");
-                        std::cout << "New details stored" << std::endl;
-                        break;
-                    case 2:
-                        std::cout << "Please enter the new last name (optional)" << std::endl;
-                        std::getline(std::cin,new_last_name);
-                        std::cout << "New details stored" << std::endl;
-                        new_last_name = std::regex_replace(new_last_name, std::regex("\\s+"), "");
-                        break;
+        auto& list = term->second;
+        std::size_t old_size = list.size();
+        for (end = start ; end<names.size() && names[end].first == names[start].first ; end++){
+            list.push_back(names[end].second);
+        }
+        auto old_end = list.begin() + static_cast<std::ptrdiff_t>(old_size);
+        std::inplace_merge(list.begin(), old_end, list.end());
+    }
+}
 
-                    case 3:
-                        std::cout << "Please enter the new phone number (optional)" << std::endl;
-                        std::getline(std::cin,new_phone_number);
-                        std::cout << "New details stored" << std::endl;
-                        break;
+// Removes many (name, row) pairs from the posting lists, going through each name's list once.
+// The names whose lists are left empty are added to gone_names
+void removePostings(PostingMap& postings, std::vector<std::pair<std::string_view,Row>>& names,
+                    std::vector<std::string>& gone_names)
+{
+    std::sort(names.begin(), names.end());
+    std::vector<Row> removed;
+    for (std::size_t start = 0, end ; start<names.size() ; start = end){
+        removed.clear();
+        for (end = start ; end<names.size() && names[end].first == names[start].first ; end++){
+            removed.push_back(names[end].second);
+        }
+        auto term = postings.find(names[start].first);
+        if (term == postings.end()){
+            continue;
+        }
+        auto& list = term->second;
+        list.erase(std::remove_if(list.begin(), list.end(), [&removed](Row row){
+                       return std::binary_search(removed.begin(), removed.end(), row);
+                   }), list.end());
+        if (list.empty()){
+            gone_names.push_back(term->first);
+            postings.erase(term);
+        }
+    }
+}
 
-                    case 4:
-                        // If the new first and last names are the same as the original ones
-                        if (new_first_name == this->address_book_list.at(entry_to_alter).first_name
-                        && new_last_name == this->address_book_list.at(entry_to_alter).last_name){
-                            this->address_book_list.at(entry_to_alter).phone_number = new_phone_number;
-                            std::cout << "Details successfully changed" << std::endl;
-                            verified_entry = true;
-                        } else{
-                            if (new_last_name.empty()){
-                                new_full_name = new_first_name;
-                            } else{
-                                new_full_name = new_first_name + " " + new_last_name;
-                            }
-                            try{
-                                this->address_book_list.at(new_full_name);
-                                std::cout << "This entry already exists, please change the first or last name"
-                                << std::endl;
-                            } catch (std::exception& ex){
-                                // If I was able to use later versions of C++ here, I would use the map's
-                                // extract member function to change the key of the entry to the new full name.
-                                // If the key is not changed, there is no point to changing the first and last names
-                                address_book_list.at(entry_to_alter).phone_number = new_phone_number;
-                                //address_book_list.at(entry_to_alter).first_name = new_first_name;
-                                //address_book_list.at(entry_to_alter).last_name = new_last_name;
-                                //address_book_list.extract(entry_to_alter).key() = new_full_name;
-                                std::cout << "Details successfully changed " <<
-                                             "(first and last names not changed)" <<
-                                             std::endl;
-                                verified_entry=true;
-                            }
-                        }
-                }
-            }
+}
 
+AddressBook::AddressBook(const std::string& path) : storage_path(path)
+{
+    // Only address_book_list is kept while the book is loaded and the journal replayed.
+    // The other indexes are built once at the end, rather than kept up to date one change at a time
+    this->indexed = false;
+    SnapshotFile snapshot;
+    if (snapshot.open(path)){
+        // The snapshot's records are already in key order, so each entry is placed at the end of address_book_list
+        // without searching the tree for its position
+        for (std::size_t i = 0 ; i<snapshot.size() ; i++){
+            Row row = this->entry_table.insert(snapshot.firstName(i), snapshot.lastName(i), snapshot.phoneNumber(i));
+            this->address_book_list.emplace_hint(this->address_book_list.end(), row);
         }
+        this->journal.setLastSequence(snapshot.sequence());
+    }
+    // The journal is replayed before it is opened for appending, so replaying it does not write it again.
+    // Changes the snapshot already holds are skipped, which happens if compact was interrupted before it started a new journal
+    std::string journal_path = path + ".journal";
+    bool unnumbered = Journal::hasUnnumberedRecords(journal_path);
+    std::size_t valid_length = Journal::replay(journal_path, this->journal.lastSequence(),
+        [this](const Journal::Change& change){
+            this->applyChange(change);
+        });
+    if (unnumbered){
+        // A journal from before changes were numbered can't be appended to,
+        // so its changes are folded into a new snapshot straight away and the journal is started again
+        snapshot.close();
+        this->compact();
+        valid_length = 0;
+    }
+    this->journal.open(journal_path, valid_length, this->journal.lastSequence());
+    // Building the indexes takes most of the time it takes to open a large book, so it is done on another thread.
+    // lookup, contains, entriesByKey and the other functions that only need address_book_list answer straight away,
+    // and the rest wait for the indexes in waitForIndexes
+    std::vector<Row> rows(this->address_book_list.begin(), this->address_book_list.end());
+    this->indexed = true;
+    this->indexes_built = std::async(std::launch::async, [this, rows = std::move(rows)](){
+        this->indexEntries(rows);
+    }).share();
+}
+
+void AddressBook::compact()
+{
+    if (this->storage_path.empty()){
+        return;
+    }
+    ADDRESS_BOOK_TIME(Compact);
+    // The phone numbers are unpacked into strings that stay put until the snapshot is written,
+    // while the names can be read from the table as they are
+    std::vector<std::string> phone_numbers;
+    phone_numbers.reserve(this->address_book_list.size());
+    std::vector<SnapshotFile::EntryFields> entries;
+    entries.reserve(this->address_book_list.size());
+    for (Row row : this->address_book_list){
+        phone_numbers.push_back(this->entry_table.phoneNumber(row));
+        entries.push_back({this->entry_table.firstName(row), this->entry_table.lastName(row), phone_numbers.back()});
+    }
+    SnapshotFile::write(this->storage_path, entries, this->journal.lastSequence());
+    // The new snapshot already holds every change in the journal
+    this->journal.rotate();
+    Journal::keepNewestSegments(this->storage_path + ".journal", this->retained_segments);
+}
+
+void AddressBook::setRetainedSegments(std::size_t count)
+{
+    this->retained_segments = count;
+}
+
+AddressBook::AddStatus AddressBook::add(std::string first_name,std::string last_name,std::string phone_number) {
+    ADDRESS_BOOK_TIME(Add);
+    this->waitForIndexes();
+    // All whitespace is removed from the first and last names.
+    // This ensures neatly formatted keys as well as catching any blank spaces for first names
+    removeWhitespaceInPlace(first_name);
+    removeWhitespaceInPlace(last_name);
+    if (first_name.empty()) {
+        // An entry must have a first name that is not blank
+        return AddStatus::InvalidName;
+    }
+    Entry new_entry;
+    new_entry.first_name = std::move(first_name);
+    new_entry.last_name = std::move(last_name);
+    new_entry.phone_number = std::move(phone_number);
+    // insertEntry instantly checks for the key and only inserts the entry if it isn't already present.
+    // This avoids having to search through the list sequentially for the name,
+    // which would not be efficient for a large list.
+    if (this->insertEntry(new_entry)){
+        return AddStatus::Inserted;
+    }
+    return AddStatus::Duplicate;
+}
+
+AddressBook::RemoveResult AddressBook::remove(const std::string& entry_to_remove)
+{
+    ADDRESS_BOOK_TIME(Remove);
+    this->waitForIndexes();
+    RemoveResult result;
+    // If the name is blank or the address book is empty, there's nothing to look for
+    if(isBlank(entry_to_remove) || this->address_book_list.empty()){
+        result.status = RemoveResult::Status::NotFound;
+        return result;
+    }
+    // The entry can be removed immediately if the caller gives the exact key for that entry,
+    // speeding up the removal process.
+    // However, if the second name is blank, the search results are returned instead.
+    // This is done because an entry that only has a first name and no second name may share
+    // that first name with other entries. If this check was not done, then only that entry would
+    // be found here. For example, if an entry had just "Daniel" as a first name and no second name,
+    // only that entry would be returned, while ignoring all the other "Daniel"s with second names
+    auto exact_match = this->findKey(entry_to_remove);
+    if (exact_match != this->address_book_list.end() && !this->entry_table.lastName(*exact_match).empty()){
+        this->eraseEntry(*exact_match);
+        result.status = RemoveResult::Status::Removed;
+        return result;
+    }
+    // The caller is given the matching entries to choose from, and can remove one with removeExact
+    result.candidates = this->find(entry_to_remove);
+    result.status = result.candidates.empty() ? RemoveResult::Status::NotFound : RemoveResult::Status::Candidates;
+    return result;
+}
+
+bool AddressBook::removeExact(const std::string& key)
+{
+    ADDRESS_BOOK_TIME(Remove);
+    this->waitForIndexes();
+    auto entry = this->findKey(key);
+    if (entry == this->address_book_list.end()){
+        return false;
+    }
+    this->eraseEntry(*entry);
+    return true;
+}
+
+AddressBook::AlterStatus AddressBook::alter(const std::string& key, const EntryPatch& patch) {
+    ADDRESS_BOOK_TIME(Alter);
+    this->waitForIndexes();
+    auto entry = this->findKey(key);
+    if (entry == this->address_book_list.end()){
+        return AlterStatus::NotFound;
+    }
+    Row row = *entry;
+    Entry old_entry = this->entryAt(row);
+    // Fields missing from the patch keep their current values
+    std::string new_first_name = patch.first_name ? removeWhitespace(*patch.first_name) : old_entry.first_name;
+    std::string new_last_name = patch.last_name ? removeWhitespace(*patch.last_name) : old_entry.last_name;
+    const std::string& new_phone_number = patch.phone_number ? *patch.phone_number : old_entry.phone_number;
+    if (new_first_name.empty()){
+        return AlterStatus::InvalidName;
     }
+    // If the new first and last names are the same as the original ones
+    if (new_first_name == old_entry.first_name && new_last_name == old_entry.last_name){
+        this->setPhoneNumber(row, new_phone_number);
+        return AlterStatus::Altered;
+    }
+    // Everything is checked before anything is changed, so a clash leaves the entry exactly as it was
+    if (this->contains(makeKey(new_first_name, new_last_name))){
+        return AlterStatus::Duplicate;
+    }
+    // Both changes reach the journal in one write. If that write fails, the entry is given back its old names and
+    // number, as apply does with its undo log, and the journal records this produces are thrown away
+    this->journal.beginBatch();
+    this->setPhoneNumber(row, new_phone_number);
+    this->renameEntry(row, new_first_name, new_last_name);
+    try{
+        this->journal.commitBatch();
+    } catch(std::exception& ex){
+        this->journal.beginBatch();
+        this->renameEntry(row, old_entry.first_name, old_entry.last_name);
+        this->setPhoneNumber(row, old_entry.phone_number);
+        this->journal.abortBatch();
+        throw;
+    }
+    return AlterStatus::Altered;
 }
 
-std::map<std::string,AddressBook::Entry> AddressBook::sortedByFirstName()
+std::map<std::string,AddressBook::Entry> AddressBook::sortedByFirstName() const
 {
-    // Maps are automatically sorted alphabetically, so there is no need for adjustment
-    return this->address_book_list;
+    ADDRESS_BOOK_TIME(SortedByFirstName);
+    // address_book_list is already sorted alphabetically by key, so each entry goes on the end of the map
+    std::map<std::string,Entry> sorted_map;
+    for (Row row : this->address_book_list){
+        sorted_map.emplace_hint(sorted_map.end(), this->keyOf(row), this->entryAt(row));
+    }
+    return sorted_map;
 }
 
-std::map<std::string,AddressBook::Entry> AddressBook::sortedByLastName()
+std::map<std::string,AddressBook::Entry> AddressBook::sortedByLastName() const
 {
-    // Because of this automatic sorting however, a separate map must be created for sorting by last name.
-    // This would not be ideal for a large number of entries
+    ADDRESS_BOOK_TIME(SortedByLastName);
+    // Because of this automatic sorting however, a separate map must be created for sorting by last name
     std::map<std::string,Entry> reversed_map;
-    for (std::pair<std::string,Entry> i : this->address_book_list){
-        if (i.second.last_name.empty()){
+    for (Row row : this->address_book_list){
+        Entry entry = this->entryAt(row);
+        if (entry.last_name.empty()){
             // Entries with a blank last name are sorted by just their first name
-            reversed_map.insert(std::pair<std::string,Entry>(i.second.first_name,i.second));
+            std::string key = entry.first_name;
+            reversed_map.emplace(std::move(key), std::move(entry));
         } else{
-            reversed_map.insert(std::pair<std::string,Entry>(i.second.last_name + " " + i.second.first_name,i.second));
+            std::string key = entry.last_name + " " + entry.first_name;
+            reversed_map.emplace(std::move(key), std::move(entry));
         }
     }
     return reversed_map;
 }
 
-std::map<std::string,AddressBook::Entry> AddressBook::find(std::string name)
+std::vector<AddressBook::Entry> AddressBook::listByFirstName() const
+{
+    ADDRESS_BOOK_TIME(ListByFirstName);
+    this->waitForIndexes();
+    // address_book_list is sorted by the bytes of its keys, which puts "Émile" after "Zoe",
+    // so the copies are made in the order of first_name_order instead
+    std::vector<Entry> entries;
+    entries.reserve(this->first_name_order.size());
+    for (Row row : this->first_name_order){
+        entries.push_back(this->entryAt(row));
+    }
+    return entries;
+}
+
+std::vector<AddressBook::Entry> AddressBook::listByLastName() const
 {
+    ADDRESS_BOOK_TIME(ListByLastName);
+    this->waitForIndexes();
+    std::vector<Entry> entries;
+    entries.reserve(this->last_name_order.size());
+    for (Row row : this->last_name_order){
+        entries.push_back(this->entryAt(row));
+    }
+    return entries;
+}
+
+AddressBook::FirstNameView AddressBook::entriesByFirstName() const
+{
+    this->waitForIndexes();
+    return FirstNameView(this, this->first_name_order.cbegin(), this->first_name_order.cend());
+}
+
+AddressBook::LastNameView AddressBook::entriesByLastName() const
+{
+    this->waitForIndexes();
+    return LastNameView(this, this->last_name_order.cbegin(), this->last_name_order.cend());
+}
+
+AddressBook::KeyOrderView AddressBook::entriesByKey() const
+{
+    return KeyOrderView(this, this->address_book_list.cbegin(), this->address_book_list.cend());
+}
+
+std::map<std::string,AddressBook::Entry> AddressBook::find(std::string name) const
+{
+    ADDRESS_BOOK_TIME(Find);
+    this->waitForIndexes();
     std::map<std::string,Entry> matches_map;
-    if(std::regex_replace(name, std::regex("\\s+"), "").empty()
-           || this->address_book_list.empty()) {
+    if(isBlank(name) || this->address_book_list.empty()) {
         // Returns an empty map. The user is informed its empty in printSearchResults
         return matches_map;
     }
-    try{
-        // The desired entry can be returned immediately if the user enters the exact key for that entry
-        // (except if the last name is blank).
-        // This process could be improved with the previously mentioned extract member function,
-        // as it could be used to find the key quicker
-        std::exception ex;
-        if (this->address_book_list.at(name).last_name.empty()){
-            throw ex;
+    // The desired entry can be returned immediately if the user enters the exact key for that entry
+    // (except if the last name is blank)
+    std::optional<Entry> exact_match = this->lookup(name);
+    if (exact_match && !exact_match->last_name.empty()){
+        matches_map.emplace(name, std::move(*exact_match));
+        ADDRESS_BOOK_COUNT(FindExactKey);
+        ADDRESS_BOOK_COUNT(FindResults);
+        return matches_map;
+    }
+    // Removing spaces from the user's search.
+    // The search ignores case and accents, so it is done on the collation key of the user's search
+    std::string folded_name = collationKey(removeWhitespace(name));
+    // Rather than checking every entry, the prefix indexes jump straight to the names
+    // that start with the user's search. An entry that matches on both its first and last name
+    // is only stored once, as the map ignores the second insertion of the same key
+    this->collectPrefixMatches(this->first_name_index, folded_name, matches_map);
+    this->collectPrefixMatches(this->last_name_index, folded_name, matches_map);
+    ADDRESS_BOOK_COUNT(FindPrefixSearch);
+    ADDRESS_BOOK_COUNT(FindResults, matches_map.size());
+    return matches_map;
+}
+
+AddressBook::Page AddressBook::findPage(const std::string& name, std::size_t limit, const std::string& resume_token) const
+{
+    ADDRESS_BOOK_TIME(FindPage);
+    this->waitForIndexes();
+    Page page;
+    if (isBlank(name) || limit == 0){
+        return page;
+    }
+    // As in find, the exact key of an entry with a last name picks out just that entry
+    if (resume_token.empty()){
+        std::optional<Entry> exact_match = this->lookup(name);
+        if (exact_match && !exact_match->last_name.empty()){
+            page.entries.push_back(std::move(*exact_match));
+            return page;
         }
-        std::string first_name = this->address_book_list.at(name).first_name;
-        std::string last_name = this->address_book_list.at(name).last_name;
-        matches_map.insert(std::pair<std::string,Entry>(first_name + " " + last_name,this->address_book_list.at(name)));
-    } catch(std::exception& ex){
-        // Removing spaces from the user's search
-        name = std::regex_replace(name, std::regex("\\s+"), "");
-        std::string lower_case_name = name;
-        // Creating a copy of the user's search but in lower case
-        for (int i = 0 ; i<name.length() ; i++){
-            lower_case_name[i] = std::tolower(name[i]);
+    }
+    std::string folded_name = collationKey(removeWhitespace(name));
+    // A resume token is the index being walked ('F' or 'L'), then the length of the next match's folded name,
+    // a ':', the name and the match's key. The walk picks up again at that (name, key) pair
+    char walking = 'F';
+    std::string from_name = folded_name;
+    std::string from_key;
+    if (!resume_token.empty()){
+        std::size_t separator = resume_token.find(':');
+        std::size_t name_length = 0;
+        if ((resume_token[0] != 'F' && resume_token[0] != 'L') || separator == std::string::npos
+        || std::from_chars(resume_token.data() + 1, resume_token.data() + separator, name_length).ptr != resume_token.data() + separator
+        || resume_token.size() - separator - 1 < name_length){
+            throw std::invalid_argument("Not a resume token from findPage");
         }
-        // This pattern will produce a match if the start of the name is equal to what the user searched.
-        // It is the name followed by any number of characters
-        std::regex pattern = std::regex(lower_case_name + ".*");
-        std::string lower_case_first_name;
-        for (std::pair<std::string,Entry> i : this->address_book_list){
-            lower_case_first_name = i.second.first_name;
-            // Creating a copy of an entry's first name in lower case
-            for (int k = 0 ; k<i.second.first_name.length() ; k++){
-                lower_case_first_name[k] = std::tolower(i.second.first_name[k]);
+        walking = resume_token[0];
+        from_name = resume_token.substr(separator + 1, name_length);
+        from_key = resume_token.substr(separator + 1 + name_length);
+    }
+    // Every entry the walk reaches counts against the limit, including those passed over below,
+    // so a page never takes more than limit steps however many of the entries it reaches were already returned
+    std::size_t steps = 0;
+    for ( ; walking != '\0' ; walking = walking == 'F' ? 'L' : '\0'){
+        const RowIndex& index = walking == 'F' ? this->first_name_index : this->last_name_index;
+        for (auto it = index.lower_bound(SortFields{from_name, std::string_view(), EntryTable::Key{from_key, std::string_view()}});
+             it != index.end() ; ++it){
+            std::string_view indexed_name = index.key_comp().fieldsOf(*it).name;
+            if (!startsWith(indexed_name, folded_name)){
+                break;
             }
-            // Compares the lower case first name against the pattern.
-            // This is quicker and neater than sequentially searching through the string for a match in a for loop
-            if (std::regex_match(lower_case_first_name,pattern)){
-                matches_map.insert(i);
-            // The proceeding code is ignored if the second name is a blank string,
-            // as there's no point in checking it
-            } else if (!i.second.last_name.empty()){
-                std::string lower_case_last_name;
-                lower_case_last_name = i.second.last_name;
-                for (int k = 0 ; k<i.second.last_name.length() ; k++){
-                    lower_case_last_name[k] = std::tolower(i.second.last_name[k]);
-                }
-                if (std::regex_match(lower_case_last_name,pattern)){
-                    matches_map.insert(i);
-                }
+            if (steps == limit){
+                page.resume_token = walking + std::to_string(indexed_name.size()) + ':' + std::string(indexed_name)
+                                  + this->keyOf(*it);
+                return page;
             }
+            steps++;
+            // An entry whose first name also matches was already returned from the first name index.
+            // The table holds the collation key of the first name, so it is compared rather than worked out again
+            if (walking == 'L' && startsWith(this->entry_table.foldedFirstName(*it), folded_name)){
+                continue;
+            }
+            page.entries.push_back(this->entryAt(*it));
         }
+        from_name = folded_name;
+        from_key.clear();
     }
-    return matches_map;
+    return page;
 }
 
-void AddressBook::printSearchResults(const std::string& name, bool* is_empty) {
-    std::map<std::string, Entry> search_results;
-    search_results = this->find(name);
-    if (search_results.empty()) {
-        std::cout << "No matching entries for that name" << std::endl;
-        // If this value is made true, then most member functions will ignore
-        // their proceeding code
-        *is_empty = true;
-    } else {
-        std::cout << "Here are the matching entries: " << std::endl;
-        for (std::pair<std::string, AddressBook::Entry> i: search_results) {
-            std::cout << "First name: " << i.second.first_name <<
-                      " / Last name: " << i.second.last_name <<
-                      " / Phone number: " << i.second.phone_number << std::endl;
-        }
+AddressBook::Page AddressBook::pageByFirstName(std::size_t limit, const std::string& resume_token) const
+{
+    ADDRESS_BOOK_TIME(PageByFirstName);
+    this->waitForIndexes();
+    // An empty page would hand back the token it was given, and a caller paging until the token is empty would never stop
+    if (limit == 0){
+        throw std::invalid_argument("The page limit must be at least 1");
+    }
+    // The resume token is the first_name_order sort key of the next entry
+    Page page;
+    auto it = resume_token.empty() ? this->first_name_order.begin()
+                                   : this->first_name_order.lower_bound(parseSortKey<SortFields>(resume_token));
+    for ( ; it != this->first_name_order.end() && page.entries.size() < limit ; ++it){
+        page.entries.push_back(this->entryAt(*it));
     }
+    if (it != this->first_name_order.end()){
+        page.resume_token = makeSortKey(this->first_name_order.key_comp().fieldsOf(*it));
+    }
+    return page;
 }
 
-// A menu that provides a user-friendly way to interact with the address book.
-// This menu is on a loop and the program will only stop once the user makes it stop.
-// This is a temporary way to retain the information stored in the address book, as it is not permanently saved.
-// If given more time, it would be ideal to serialise the map that stores the address book.
-// This would make any changes permanent.
-// Instead of making a new map, the AddressBook constructor would deserialize the existing map.
-
-int main(){
-    bool quit = false;
-    AddressBook addressBook;
-    std::string menu_choice;
-    while (!quit){
-        std::cout << "\nWhat would you like to do? (1,2,3,4,5,6,7) \n " <<
-                  "1.) Add an entry to the address book \n " <<
-                  "2.) Remove an entry from the address book \n " <<
-                  "3.) Alter an entry in the address book \n " <<
-                  "4.) Get the list in alphabetical order (by first name) \n " <<
-                  "5.) Get the list in alphabetical order (by last name) \n " <<
-                  "6.) Find an entry in the address book \n " <<
-                  "7.) Quit" << std::endl;
-        std::getline(std::cin,menu_choice);
-        while(menu_choice != "1" && menu_choice != "2" && menu_choice != "3" && menu_choice != "4"
-        && menu_choice != "5" && menu_choice != "6" && menu_choice != "7"){
-            std::cout << "Please choose one of the options (1,2,3,4,5,6,7)" << std::endl;
-            std::getline(std::cin,menu_choice);
-        }
-        switch (std::stoi(menu_choice)) {
-            case 1:
-            {
-                std::string first_name;
-                std::cout << "Please enter the first name" << std::endl;
-                std::getline(std::cin,first_name);
-                std::string last_name;
-                std::cout << "Please enter the last name (optional)" << std::endl;
-                std::getline(std::cin,last_name);
-                std::string phone_number;
-                std::cout << "Please enter the phone number (optional)" << std::endl;
-                std::getline(std::cin,phone_number);
-                addressBook.add(first_name,last_name,phone_number);
-            }
-                break;
-
-            case 2:
-            {
-                std::string entry_to_remove;
-                std::cout << "Please enter a name" << std::endl;
-                std::getline(std::cin,entry_to_remove);
-                addressBook.remove(entry_to_remove);
-            }
-                break;
+AddressBook::Page AddressBook::pageByLastName(std::size_t limit, const std::string& resume_token) const
+{
+    ADDRESS_BOOK_TIME(PageByLastName);
+    this->waitForIndexes();
+    // An empty page would hand back the token it was given, and a caller paging until the token is empty would never stop
+    if (limit == 0){
+        throw std::invalid_argument("The page limit must be at least 1");
+    }
+    // The resume token is the last_name_order sort key of the next entry
+    Page page;
+    auto it = resume_token.empty() ? this->last_name_order.begin()
+                                   : this->last_name_order.lower_bound(parseSortKey<SortFields>(resume_token));
+    for ( ; it != this->last_name_order.end() && page.entries.size() < limit ; ++it){
+        page.entries.push_back(this->entryAt(*it));
+    }
+    if (it != this->last_name_order.end()){
+        page.resume_token = makeSortKey(this->last_name_order.key_comp().fieldsOf(*it));
+    }
+    return page;
+}
 
-            case 3:
-            {
-                std::string entry_to_alter;
-                std::cout << "Please enter a name" << std::endl;
-                std::getline(std::cin,entry_to_alter);
-                addressBook.alter(entry_to_alter);
-            }
-                break;
+std::map<std::string,AddressBook::Entry> AddressBook::findByPhone(const std::string& number_prefix) const
+{
+    ADDRESS_BOOK_TIME(FindByPhone);
+    this->waitForIndexes();
+    std::map<std::string,Entry> matches_map;
+    std::string digits = phoneNumberDigits(number_prefix);
+    if (digits.empty()){
+        return matches_map;
+    }
+    // Numbers are indexed by their digits in order, so the numbers starting with the prefix sit together
+    // and are found with one lower_bound, however many entries there are
+    for (auto it = this->phone_number_index.lower_bound(std::string_view(digits));
+         it != this->phone_number_index.end() && this->entry_table.phoneDigitsStartWith(*it, digits);
+         ++it){
+        matches_map.emplace(this->keyOf(*it), this->entryAt(*it));
+    }
+    return matches_map;
+}
 
-            case 4:
-            {
-                std::map<std::string,AddressBook::Entry> first_name_order;
-                first_name_order = addressBook.sortedByFirstName();
-                if (first_name_order.empty()){
-                    std::cout << "The address book is currently empty" << std::endl;
-                } else{
-                    std::cout << "The address book organised by first name: " << std::endl;
-                    for (std::pair<std::string,AddressBook::Entry> i : first_name_order){
-                        if (i.second.last_name.empty()){
-                            std::cout << "Name: " << i.second.first_name <<
-                                      " / Phone number: " << i.second.phone_number << std::endl;
-                        } else{
-                            std::cout << "First name: " << i.second.first_name <<
-                                      " / Last name: " << i.second.last_name <<
-                                      " / Phone number: " << i.second.phone_number << std::endl;
-                        }
+std::vector<AddressBook::FuzzyMatch> AddressBook::findFuzzy(std::string name, unsigned max_distance,
+                                                             std::size_t limit) const
+{
+    ADDRESS_BOOK_TIME(FindFuzzy);
+    this->waitForIndexes();
+    std::vector<FuzzyMatch> matches;
+    std::string folded_name = collationKey(removeWhitespace(name));
+    if (folded_name.empty() || limit == 0){
+        return matches;
+    }
+    // The best limit entries so far, ranked by distance and then key, and the distance each of them is ranked under
+    std::map<std::pair<unsigned,std::string>,Row> ranked;
+    std::map<std::string,unsigned> ranked_distances;
+    for (const RowIndex* index : {&this->first_name_index, &this->last_name_index}){
+        std::vector<std::pair<unsigned,std::string>> close_names;
+        this->collectFuzzyNames(index == &this->first_name_index ? this->first_name_trie : this->last_name_trie,
+                                folded_name, max_distance, close_names);
+        for (const auto& close_name : close_names){
+            unsigned distance = close_name.first;
+            // The entries using a name come in key order, so once one of them ranks too low to be kept,
+            // so do the rest. A common first name can have thousands of entries, and this skips nearly all of them
+            for (auto it = index->lower_bound(SortFields{close_name.second, std::string_view(), EntryTable::Key()});
+                 it != index->end() && index->key_comp().fieldsOf(*it).name == close_name.second ; ++it){
+                if (ranked.size() == limit){
+                    const auto& worst = std::prev(ranked.end())->first;
+                    if (distance > worst.first || (distance == worst.first
+                    && this->entry_table.key(*it).compare(EntryTable::Key{worst.second, std::string_view()}) >= 0)){
+                        break;
                     }
                 }
-            }
-                break;
-
-            case 5:
-            {
-                std::map<std::string,AddressBook::Entry> last_name_order;
-                last_name_order = addressBook.sortedByLastName();
-                if (last_name_order.empty()){
-                    std::cout << "The address book is currently empty" << std::endl;
-                } else{
-                    std::cout << "The address book organised by last name: " << std::endl;
-                    for (std::pair<std::string,AddressBook::Entry> i : last_name_order){
-                        if (i.second.last_name.empty()){
-                            std::cout << "Name: " << i.second.first_name <<
-                                      " / Phone number: " << i.second.phone_number << std::endl;
-                        } else{
-                            std::cout << "Last name: " << i.second.last_name <<
-                                      " / First name: " << i.second.first_name <<
-                                      " / Phone number: " << i.second.phone_number << std::endl;
-                        }
+                std::string key = this->keyOf(*it);
+                // An entry can match on both its first and last names, in which case it is ranked by the closer one
+                auto earlier = ranked_distances.find(key);
+                if (earlier != ranked_distances.end()){
+                    if (earlier->second <= distance){
+                        continue;
                     }
+                    ranked.erase(std::make_pair(earlier->second, key));
+                    ranked_distances.erase(earlier);
+                }
+                ranked.emplace(std::make_pair(distance, key), *it);
+                ranked_distances.emplace(std::move(key), distance);
+                if (ranked.size() > limit){
+                    auto worst = std::prev(ranked.end());
+                    ranked_distances.erase(worst->first.second);
+                    ranked.erase(worst);
                 }
             }
-                break;
+        }
+    }
+    matches.reserve(ranked.size());
+    for (const auto& i : ranked){
+        matches.push_back(FuzzyMatch{i.first.first, i.first.second, this->entryAt(i.second)});
+    }
+    return matches;
+}
+
+std::optional<AddressBook::Entry> AddressBook::lookup(const std::string& key) const
+{
+    auto entry = this->findKey(key);
+    if (entry == this->address_book_list.end()){
+        return std::nullopt;
+    }
+    return this->entryAt(*entry);
+}
+
+bool AddressBook::contains(const std::string& key) const
+{
+    return this->findKey(key) != this->address_book_list.end();
+}
+
+MetricsReport AddressBook::metrics() const
+{
+    this->waitForIndexes();
+    MetricsReport report;
+    report.entries = this->address_book_list.size();
+    // Each node of a map or set holds its value plus a colour and three pointers,
+    // and a string only uses the heap once it outgrows the buffer inside it
+    const std::size_t node_overhead = 4 * sizeof(void*);
+    auto heapBytes = [](const std::string& text){
+        return text.capacity() > std::string().capacity() ? text.capacity() + 1 : 0;
+    };
+    std::size_t bytes = this->entry_table.bytesUsed();
+    for (const RowIndex* index : {&this->address_book_list, &this->first_name_index, &this->last_name_index,
+                                  &this->first_name_order, &this->last_name_order}){
+        bytes += index->size() * (node_overhead + sizeof(Row));
+    }
+    bytes += this->phone_number_index.size() * (node_overhead + sizeof(Row));
+    for (const auto* postings : {&this->first_name_postings, &this->last_name_postings}){
+        for (const auto& i : *postings){
+            bytes += node_overhead + sizeof(i) + heapBytes(i.first) + i.second.capacity() * sizeof(Row);
+        }
+    }
+    // Each trie node is on the heap on its own, with its children's letters and pointers in a vector
+    std::vector<const NameTrieNode*> nodes = {&this->first_name_trie, &this->last_name_trie};
+    while (!nodes.empty()){
+        const NameTrieNode* node = nodes.back();
+        nodes.pop_back();
+        bytes += sizeof(NameTrieNode) + node->children.capacity() * sizeof(node->children[0]);
+        for (const auto& child : node->children){
+            nodes.push_back(child.second.get());
+        }
+    }
+    // The same for the suggestion trie, whose nodes keep their children in a map and hold two lists of suggestions
+    std::vector<const SuggestionNode*> suggestion_nodes = {&this->suggestion_root};
+    while (!suggestion_nodes.empty()){
+        const SuggestionNode* node = suggestion_nodes.back();
+        suggestion_nodes.pop_back();
+        bytes += sizeof(SuggestionNode) + node->children.size() * (node_overhead + sizeof(*node->children.begin()))
+               + (node->suggestions.capacity() + node->best.capacity()) * sizeof(Suggestion);
+        for (const auto& child : node->children){
+            suggestion_nodes.push_back(child.second.get());
+        }
+    }
+    // An unordered_map holds an array of buckets, and each element on the heap on its own with a pointer to the next
+    bytes += this->uses.bucket_count() * sizeof(void*) + this->uses.size() * (sizeof(void*) + sizeof(*this->uses.begin()));
+    {
+        // suggest changes the cache while holding the mutex, even under ConcurrentAddressBook's read lock
+        std::lock_guard<std::mutex> lock(this->suggestion_cache_mutex);
+        for (const CachedSuggestions& cached : this->suggestion_cache){
+            bytes += 2 * sizeof(void*) + sizeof(cached) + heapBytes(cached.prefix) + cached.rows.capacity() * sizeof(Row);
+        }
+        bytes += this->cached_prefixes.bucket_count() * sizeof(void*)
+               + this->cached_prefixes.size() * (sizeof(void*) + sizeof(*this->cached_prefixes.begin()));
+    }
+    report.approximate_bytes = bytes;
+
+#if defined(ADDRESS_BOOK_METRICS)
+    report.enabled = true;
+    for (std::size_t i = 0 ; i<static_cast<std::size_t>(AddressBookMetrics::Operation::Count) ; i++){
+        const AddressBookMetrics::Histogram& latency = this->usage.latencies[i];
+        MetricsReport::OperationStats stats;
+        stats.name = AddressBookMetrics::name(static_cast<AddressBookMetrics::Operation>(i));
+        stats.calls = latency.count();
+        if (stats.calls != 0){
+            stats.mean_ns = static_cast<double>(latency.totalNanoseconds()) / static_cast<double>(stats.calls);
+        }
+        stats.p50_ns = latency.percentile(0.5);
+        stats.p90_ns = latency.percentile(0.9);
+        stats.p99_ns = latency.percentile(0.99);
+        stats.max_ns = latency.maxNanoseconds();
+        report.operations.push_back(std::move(stats));
+    }
+    for (std::size_t i = 0 ; i<static_cast<std::size_t>(AddressBookMetrics::Counter::Count) ; i++){
+        report.counters.emplace_back(AddressBookMetrics::name(static_cast<AddressBookMetrics::Counter>(i)),
+                                     this->usage.counters[i].load(std::memory_order_relaxed));
+    }
+#endif
+    return report;
+}
+
+std::string AddressBook::makeKey(const std::string& first_name, const std::string& last_name)
+{
+    // Ensures that a key consisting of just a first name does not have a space on the end
+    if (last_name.empty()) {
+        return first_name;
+    }
+    return first_name + " " + last_name;
+}
+
+void AddressBook::waitForIndexes() const
+{
+    // get can be called any number of times, and from several readers at once
+    if (this->indexes_built.valid()){
+        this->indexes_built.get();
+    }
+}
+
+bool AddressBook::insertEntry(const Entry& entry)
+{
+    std::string key = makeKey(entry.first_name, entry.last_name);
+    auto position = this->address_book_list.lower_bound(keyFields(key));
+    if (position != this->address_book_list.end()
+    && this->entry_table.key(*position).compare(EntryTable::Key{key, std::string_view()}) == 0){
+        return false;
+    }
+    // The change is journaled before it is made, so if the journal can't be written the book is left as it was
+    this->journal.append(Journal::Operation::Add, entry.first_name, entry.last_name, entry.phone_number);
+    Row row = this->entry_table.insert(entry.first_name, entry.last_name, entry.phone_number);
+    this->address_book_list.emplace_hint(position, row);
+    if (this->indexed){
+        this->indexEntry(row);
+    }
+    return true;
+}
+
+void AddressBook::eraseEntry(Row row)
+{
+    this->journal.append(Journal::Operation::Remove, this->entry_table.firstName(row), this->entry_table.lastName(row));
+    // The indexes find the row by what it is sorted by, so it leaves them before it leaves the table
+    if (this->indexed){
+        this->unindexEntry(row);
+    }
+    this->address_book_list.erase(row);
+    this->entry_table.erase(row);
+}
 
-            case 6:
-            {
-                std::string name;
-                std::map<std::string, AddressBook::Entry> search_results;
-                std::cout << "Please enter a name" << std::endl;
-                std::getline(std::cin,name);
-                bool is_empty = false;
-                addressBook.printSearchResults(name,&is_empty);
+void AddressBook::applyChange(const Journal::Change& change)
+{
+    // The change is made under the number it was given, so the journal records it makes carry the same number
+    this->journal.setLastSequence(change.sequence - 1);
+    Entry entry;
+    entry.first_name = std::string(change.first_name);
+    entry.last_name = std::string(change.last_name);
+    entry.phone_number = std::string(change.phone_number);
+    auto existing = this->findKey(makeKey(entry.first_name, entry.last_name));
+    switch (change.operation){
+        case Journal::Operation::Add:
+            this->insertEntry(entry);
+            break;
+        case Journal::Operation::Remove:
+            if (existing != this->address_book_list.end()){
+                this->eraseEntry(*existing);
             }
-                break;
+            break;
+        case Journal::Operation::Alter:
+            if (existing != this->address_book_list.end()){
+                this->setPhoneNumber(*existing, entry.phone_number);
+            }
+            break;
+        case Journal::Operation::Rename:
+        {
+            // A rename record holds the old key and then the new names
+            auto renamed = this->findKey(change.first_name);
+            std::string new_first_name(change.last_name);
+            std::string new_last_name(change.phone_number);
+            if (renamed != this->address_book_list.end() && !this->contains(makeKey(new_first_name, new_last_name))){
+                this->renameEntry(*renamed, new_first_name, new_last_name);
+            }
+        }
+            break;
+    }
+    // A change that finds nothing to do still uses up its number
+    this->journal.setLastSequence(change.sequence);
+}
 
-            case 7:
-            {
-                quit = true;
+void AddressBook::setPhoneNumber(Row row, const std::string& phone_number)
+{
+    this->journal.append(Journal::Operation::Alter, this->entry_table.firstName(row), this->entry_table.lastName(row),
+                         phone_number);
+    std::string new_digits = phoneNumberDigits(phone_number);
+    if (!this->indexed || this->entry_table.comparePhoneDigits(row, new_digits) == 0){
+        this->entry_table.setPhoneNumber(row, phone_number);
+        return;
+    }
+    // phone_number_index finds the row by its digits, so it is taken out before they change
+    if (this->entry_table.hasPhoneDigits(row)){
+        this->phone_number_index.erase(row);
+    }
+    this->entry_table.setPhoneNumber(row, phone_number);
+    if (!new_digits.empty()){
+        this->phone_number_index.insert(row);
+    }
+}
+
+void AddressBook::renameEntry(Row row, const std::string& first_name, const std::string& last_name)
+{
+    this->journal.append(Journal::Operation::Rename, this->keyOf(row), first_name, last_name);
+    if (this->indexed){
+        this->unindexNames(row);
+    }
+    // The entry keeps its row, so its phone number stays indexed and its uses stay with it
+    this->address_book_list.erase(row);
+    this->entry_table.rename(row, first_name, last_name);
+    this->address_book_list.insert(row);
+    if (this->indexed){
+        this->indexNames(row);
+    }
+}
+
+AddressBook::SortFields AddressBook::RowOrder::fieldsOf(Row row) const
+{
+    EntryTable::Key key = this->entries->key(row);
+    switch (this->by){
+        case By::Key:
+            break;
+        case By::FirstName:
+            return SortFields{this->entries->foldedFirstName(row), std::string_view(), key};
+        case By::LastName:
+            return SortFields{this->entries->foldedLastName(row), std::string_view(), key};
+        case By::FirstNameOrder:
+            return SortFields{this->entries->foldedFirstName(row), this->entries->foldedLastName(row), key};
+        case By::LastNameOrder:
+        {
+            // Entries with a blank last name are sorted by just their first name
+            std::string_view folded_last_name = this->entries->foldedLastName(row);
+            if (folded_last_name.empty()){
+                return SortFields{this->entries->foldedFirstName(row), std::string_view(), key};
             }
-                break;
+            return SortFields{folded_last_name, this->entries->foldedFirstName(row), key};
+        }
+    }
+    return SortFields{std::string_view(), std::string_view(), key};
+}
+
+int AddressBook::RowOrder::compare(const SortFields& a, const SortFields& b)
+{
+    int comparison = a.name.compare(b.name);
+    if (comparison == 0){
+        comparison = a.second_name.compare(b.second_name);
+    }
+    if (comparison == 0){
+        comparison = a.key.compare(b.key);
+    }
+    return comparison;
+}
 
+AddressBook::SortFields AddressBook::keyFields(std::string_view key)
+{
+    return SortFields{std::string_view(), std::string_view(), EntryTable::Key{key, std::string_view()}};
+}
+
+AddressBook::RowIndex::const_iterator AddressBook::findKey(std::string_view key) const
+{
+    return this->address_book_list.find(keyFields(key));
+}
+
+void AddressBook::readEntry(Row row, Entry& entry) const
+{
+    entry.first_name.assign(this->entry_table.firstName(row));
+    entry.last_name.assign(this->entry_table.lastName(row));
+    this->entry_table.readPhoneNumber(row, entry.phone_number);
+}
+
+AddressBook::Entry AddressBook::entryAt(Row row) const
+{
+    Entry entry;
+    this->readEntry(row, entry);
+    return entry;
+}
+
+std::string AddressBook::keyOf(Row row) const
+{
+    std::string_view first_name = this->entry_table.firstName(row);
+    std::string_view last_name = this->entry_table.lastName(row);
+    std::string key;
+    key.reserve(first_name.size() + 1 + last_name.size());
+    key += first_name;
+    if (!last_name.empty()){
+        key += ' ';
+        key += last_name;
+    }
+    return key;
+}
+
+void AddressBook::indexEntry(Row row)
+{
+    this->indexNames(row);
+    if (this->entry_table.hasPhoneDigits(row)){
+        this->phone_number_index.insert(row);
+    }
+}
+
+void AddressBook::indexEntries(const std::vector<Row>& rows)
+{
+    // Entries usually arrive in key order, which leaves their last names and phone numbers in no order at all.
+    // Each index's new rows are sorted first, so that each one goes in next to the one before
+    // rather than at a random place in the tree
+    std::vector<Row> first_names(rows);
+    std::vector<Row> first_name_keys(rows);
+    std::vector<Row> last_name_keys(rows);
+    std::vector<Row> last_names;
+    std::vector<Row> phone_numbers;
+    std::vector<std::pair<std::string_view,Row>> first_name_postings;
+    std::vector<std::pair<std::string_view,Row>> last_name_postings;
+    last_names.reserve(rows.size());
+    phone_numbers.reserve(rows.size());
+    first_name_postings.reserve(rows.size());
+    last_name_postings.reserve(rows.size());
+    for (Row row : rows){
+        this->indexUses(row);
+        first_name_postings.emplace_back(this->entry_table.foldedFirstName(row), row);
+        last_name_postings.emplace_back(this->entry_table.foldedLastName(row), row);
+        if (!this->entry_table.lastName(row).empty()){
+            last_names.push_back(row);
+        }
+        if (this->entry_table.hasPhoneDigits(row)){
+            phone_numbers.push_back(row);
+        }
+    }
+    insertSorted(this->first_name_index, first_names);
+    insertSorted(this->last_name_index, last_names);
+    insertSorted(this->first_name_order, first_name_keys);
+    insertSorted(this->last_name_order, last_name_keys);
+    insertSorted(this->phone_number_index, phone_numbers);
+    std::vector<std::string> new_first_names;
+    std::vector<std::string> new_last_names;
+    addPostings(this->first_name_postings, first_name_postings, new_first_names);
+    addPostings(this->last_name_postings, last_name_postings, new_last_names);
+    for (const auto& name : new_first_names){
+        addTrieName(this->first_name_trie, name);
+    }
+    for (const auto& name : new_last_names){
+        addTrieName(this->last_name_trie, name);
+    }
+}
+
+void AddressBook::indexNames(Row row)
+{
+    this->indexUses(row);
+    this->first_name_order.insert(row);
+    this->last_name_order.insert(row);
+    std::string_view folded_first_name = this->entry_table.foldedFirstName(row);
+    std::string_view folded_last_name = this->entry_table.foldedLastName(row);
+    if (addPosting(this->first_name_postings, folded_first_name, row)){
+        addTrieName(this->first_name_trie, folded_first_name);
+    }
+    if (addPosting(this->last_name_postings, folded_last_name, row)){
+        addTrieName(this->last_name_trie, folded_last_name);
+    }
+    this->first_name_index.insert(row);
+    if (!this->entry_table.lastName(row).empty()){
+        this->last_name_index.insert(row);
+    }
+}
+
+void AddressBook::unindexEntry(Row row)
+{
+    this->unindexNames(row);
+    // The entry is leaving the book, and a new entry may later be given the same row
+    this->uses.erase(row);
+    if (this->entry_table.hasPhoneDigits(row)){
+        this->phone_number_index.erase(row);
+    }
+}
+
+void AddressBook::unindexEntries(const std::vector<Row>& rows)
+{
+    // As in indexEntries, each index's rows are sorted first, so that the index is worked through in order
+    std::vector<Row> first_names(rows);
+    std::vector<Row> first_name_keys(rows);
+    std::vector<Row> last_name_keys(rows);
+    std::vector<Row> last_names;
+    std::vector<Row> phone_numbers;
+    std::vector<std::pair<std::string_view,Row>> first_name_postings;
+    std::vector<std::pair<std::string_view,Row>> last_name_postings;
+    for (Row row : rows){
+        this->unindexUses(row, true);
+        first_name_postings.emplace_back(this->entry_table.foldedFirstName(row), row);
+        last_name_postings.emplace_back(this->entry_table.foldedLastName(row), row);
+        if (!this->entry_table.lastName(row).empty()){
+            last_names.push_back(row);
+        }
+        if (this->entry_table.hasPhoneDigits(row)){
+            phone_numbers.push_back(row);
+        }
+    }
+    eraseSorted(this->first_name_index, first_names);
+    eraseSorted(this->last_name_index, last_names);
+    eraseSorted(this->first_name_order, first_name_keys);
+    eraseSorted(this->last_name_order, last_name_keys);
+    eraseSorted(this->phone_number_index, phone_numbers);
+    std::vector<std::string> gone_first_names;
+    std::vector<std::string> gone_last_names;
+    removePostings(this->first_name_postings, first_name_postings, gone_first_names);
+    removePostings(this->last_name_postings, last_name_postings, gone_last_names);
+    for (const auto& name : gone_first_names){
+        removeTrieName(this->first_name_trie, name);
+    }
+    for (const auto& name : gone_last_names){
+        removeTrieName(this->last_name_trie, name);
+    }
+}
+
+void AddressBook::unindexNames(Row row)
+{
+    // A rename unindexes the old names and indexes the new ones, and the entry's uses go with it
+    this->unindexUses(row, false);
+    this->first_name_order.erase(row);
+    this->last_name_order.erase(row);
+    std::string_view folded_first_name = this->entry_table.foldedFirstName(row);
+    std::string_view folded_last_name = this->entry_table.foldedLastName(row);
+    if (removePosting(this->first_name_postings, folded_first_name, row)){
+        removeTrieName(this->first_name_trie, folded_first_name);
+    }
+    if (removePosting(this->last_name_postings, folded_last_name, row)){
+        removeTrieName(this->last_name_trie, folded_last_name);
+    }
+    this->first_name_index.erase(row);
+    if (!this->entry_table.lastName(row).empty()){
+        this->last_name_index.erase(row);
+    }
+}
+
+void AddressBook::collectPrefixMatches(const RowIndex& index, const std::string& folded_prefix,
+                                       std::map<std::string,Entry>& matches) const
+{
+    // Every name that starts with the prefix sorts at or after the prefix itself,
+    // and all of them sit next to each other in the set. The walk stops at the first name
+    // that no longer starts with the prefix
+    for (auto it = index.lower_bound(SortFields{folded_prefix, std::string_view(), EntryTable::Key()});
+         it != index.end() && index.key_comp().fieldsOf(*it).name.compare(0, folded_prefix.length(), folded_prefix) == 0;
+         ++it){
+        auto match = matches.try_emplace(this->keyOf(*it));
+        if (match.second){
+            this->readEntry(*it, match.first->second);
+        }
+    }
+}
+
+void AddressBook::addTrieName(NameTrieNode& root, std::string_view folded_name)
+
+{
+    // Entries without a last name are listed under "", which isn't a name to match
+    if (folded_name.empty()){
+        return;
+    }
+    NameTrieNode* node = &root;
+    for (char letter : folded_name){
+        auto child = std::lower_bound(node->children.begin(), node->children.end(), letter,
+                                      [](const auto& child, char letter){ return child.first < letter; });
+        if (child == node->children.end() || child->first != letter){
+            child = node->children.emplace(child, letter, std::make_unique<NameTrieNode>());
+        }
+        node = child->second.get();
+    }
+    node->ends_name = true;
+}
+
+void AddressBook::removeTrieName(NameTrieNode& root, std::string_view folded_name)
+{
+    if (folded_name.empty()){
+        return;
+    }
+    std::vector<NameTrieNode*> path = {&root};
+    for (char letter : folded_name){
+        auto& children = path.back()->children;
+        auto child = std::lower_bound(children.begin(), children.end(), letter,
+                                      [](const auto& child, char letter){ return child.first < letter; });
+        if (child == children.end() || child->first != letter){
+            return;
+        }
+        path.push_back(child->second.get());
+    }
+    path.back()->ends_name = false;
+    // On the way back up, nodes left with no names at or below them are removed
+    for (std::size_t depth = path.size() - 1 ; depth > 0 ; depth--){
+        if (path[depth]->ends_name || !path[depth]->children.empty()){
+            break;
+        }
+        auto& children = path[depth - 1]->children;
+        children.erase(std::lower_bound(children.begin(), children.end(), folded_name[depth - 1],
+                                        [](const auto& child, char letter){ return child.first < letter; }));
+    }
+}
+
+void AddressBook::collectFuzzyNames(const NameTrieNode& root,
+                                    const std::string& folded_word, unsigned max_distance,
+                                    std::vector<std::pair<unsigned,std::string>>& names) const
+{
+    // This is the usual edit distance table, worked out one trie node at a time on the way down.
+    // Row d of rows holds the distances between the d letters on the way to the current node and each prefix of the word.
+    // Once every value in a node's row is over max_distance, no name below it can match, so the walk doesn't go down it.
+    // The walk visits the nodes within max_distance of some prefix of the word, which for a short word and a small
+    // max_distance is a few thousand at most, however many names there are
+    const std::size_t width = folded_word.size() + 1;
+    std::vector<unsigned> rows(width);
+    for (std::size_t j = 0 ; j<width ; j++){
+        rows[j] = static_cast<unsigned>(j);
+    }
+    // The nodes on the way down from the root, with how many of their children have been gone through,
+    // and the letters on the way to the last of them
+    std::vector<std::pair<const NameTrieNode*,std::size_t>> path = {{&root, 0}};
+    std::string name;
+    while (!path.empty()){
+        const NameTrieNode* node = path.back().first;
+        std::size_t next_child = path.back().second++;
+        if (next_child == node->children.size()){
+            path.pop_back();
+            if (!path.empty()){
+                name.pop_back();
+            }
+            continue;
+        }
+        const auto& child = node->children[next_child];
+        const std::size_t depth = path.size();
+        rows.resize((depth + 1) * width);
+        const unsigned* above = &rows[(depth - 1) * width];
+        unsigned* row = &rows[depth * width];
+        row[0] = static_cast<unsigned>(depth);
+        unsigned row_minimum = row[0];
+        for (std::size_t j = 1 ; j<width ; j++){
+            unsigned substitution = above[j - 1] + (child.first == folded_word[j - 1] ? 0 : 1);
+            row[j] = std::min({above[j] + 1, row[j - 1] + 1, substitution});
+            row_minimum = std::min(row_minimum, row[j]);
+        }
+        if (row_minimum > max_distance){
+            continue;
+        }
+        name.push_back(child.first);
+        if (child.second->ends_name && row[width - 1] <= max_distance){
+            names.emplace_back(row[width - 1], name);
         }
+        path.emplace_back(child.second.get(), 0);
     }
-    return 0;
 }
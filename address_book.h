@@ -1,10 +1,26 @@
 #pragma once
 
+#include "address_book_metrics.h"
+#include "address_book_storage.h"
+#include "entry_table.h"
 #include <string>
 #include <vector>
 #include <map>
+#include <optional>
+#include <set>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 
 /// The main Address Book implementation. Extend as required.
+/// None of its member functions read from or write to the console, that is done by the menu in address_book_console.cpp.
 
 /// The basic structure of this class was not made by me. I was given the outline for it and defined the member functions in address_book.cpp. 
 /// I created the alter and printSearchResults member functions, as well as the address_book_list map
@@ -20,30 +36,536 @@ public:
         std::string phone_number;
     };
 
+private:
+    using Row = EntryTable::Row;
+
+    // What an index sorts a row by, compared in turn: the collation key of the name it is sorted by, that of the name
+    // after it, and then the entry's key, which keeps entries whose names fold to the same thing apart.
+    // An index is searched by passing the fields being looked for in place of a row
+    struct SortFields
+    {
+        std::string_view name;
+        std::string_view second_name;
+        EntryTable::Key key;
+    };
+
+    // Orders the rows in an index by reading what they are sorted by from entry_table, so the index holds 4 byte rows
+    // rather than copies of its sort keys. The collation keys of the names are stored in the table,
+    // so a comparison is a few byte comparisons, as it was when the indexes held the keys themselves
+    class RowOrder
+    {
+    public:
+        enum class By
+        {
+            // The entry's key
+            Key,
+            // The collation key of the first name, then the key
+            FirstName,
+            // The collation key of the last name, then the key
+            LastName,
+            // The collation keys of the first and last names, then the key
+            FirstNameOrder,
+            // The collation keys of the last and first names, or just the first name if there's no last name, then the key
+            LastNameOrder
+        };
+
+        using is_transparent = void;
+
+        RowOrder(const EntryTable& entries, By by) : entries(&entries), by(by) {}
+
+        SortFields fieldsOf(Row) const;
+        static int compare(const SortFields&, const SortFields&);
+
+        bool operator()(Row a, Row b) const { return compare(this->fieldsOf(a), this->fieldsOf(b)) < 0; }
+        bool operator()(Row a, const SortFields& b) const { return compare(this->fieldsOf(a), b) < 0; }
+        bool operator()(const SortFields& a, Row b) const { return compare(a, this->fieldsOf(b)) < 0; }
+
+    private:
+        const EntryTable* entries;
+        By by;
+    };
+
+    using RowIndex = std::set<Row,RowOrder>;
+
+    // Orders rows by the digits of their phone numbers, and rows with the same digits by row.
+    // Searching for some digits finds the first row with those digits
+    class PhoneOrder
+    {
+    public:
+        using is_transparent = void;
+
+        explicit PhoneOrder(const EntryTable& entries) : entries(&entries) {}
+
+        bool operator()(Row a, Row b) const
+        {
+            int comparison = this->entries->comparePhoneDigits(a, b);
+            return comparison < 0 || (comparison == 0 && a < b);
+        }
+        bool operator()(Row a, std::string_view digits) const { return this->entries->comparePhoneDigits(a, digits) < 0; }
+        bool operator()(std::string_view digits, Row b) const { return this->entries->comparePhoneDigits(b, digits) >= 0; }
+
+    private:
+        const EntryTable* entries;
+    };
+
+public:
+    /// A read-only view over the entries in the order of one of the address book's indexes.
+    /// It does not hold any entries itself, so it is only valid until the address book is next changed.
+    /// Entries are stored packed (see entry_table.h), so an iterator unpacks the entry it is on into an Entry of its own
+    /// when it is read, and what it refers to is only valid until it is moved.
+    class EntryRange
+    {
+    public:
+        class iterator
+        {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = Entry;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Entry*;
+            using reference = const Entry&;
+
+            iterator() = default;
+            iterator(const AddressBook* book, RowIndex::const_iterator position) : book(book), position(position) {}
+
+            reference operator*() const { return this->unpack(); }
+            pointer operator->() const { return &this->unpack(); }
+            iterator& operator++() { ++this->position; this->unpacked = false; return *this; }
+            iterator operator++(int) { iterator previous = *this; ++*this; return previous; }
+            iterator& operator--() { --this->position; this->unpacked = false; return *this; }
+            iterator operator--(int) { iterator previous = *this; --*this; return previous; }
+            bool operator==(const iterator& other) const { return this->position == other.position; }
+            bool operator!=(const iterator& other) const { return this->position != other.position; }
+
+        private:
+            const Entry& unpack() const
+            {
+                if (!this->unpacked){
+                    this->book->readEntry(*this->position, this->entry);
+                    this->unpacked = true;
+                }
+                return this->entry;
+            }
+
+            const AddressBook* book = nullptr;
+            RowIndex::const_iterator position;
+            mutable Entry entry;
+            mutable bool unpacked = false;
+        };
+
+        EntryRange(const AddressBook* book, RowIndex::const_iterator first, RowIndex::const_iterator last)
+            : book(book), first(first), last(last) {}
+
+        iterator begin() const { return iterator(this->book, this->first); }
+        iterator end() const { return iterator(this->book, this->last); }
+        bool empty() const { return this->first == this->last; }
+
+    private:
+        const AddressBook* book;
+        RowIndex::const_iterator first;
+        RowIndex::const_iterator last;
+    };
+
+    using KeyOrderView = EntryRange;
+    using FirstNameView = EntryRange;
+    using LastNameView = EntryRange;
+
+    /// Create an empty address book that only lives in memory
+    AddressBook() = default;
+
+    /// Open the address book stored at path, creating it if it does not exist yet.
+    /// The snapshot at path is mapped and loaded, then the journal at path + ".journal" is replayed on top of it.
+    /// Every change made afterwards is appended to the journal.
+    /// Mapping the snapshot saves parsing it, but every entry is still packed into the book's table (see entry_table.h)
+    /// and placed in key order, which takes about 1.2 seconds for a million entries on one core.
+    /// The book can be used as soon as it is open. The other indexes are built on another thread, which takes several
+    /// seconds more for a million entries: lookup, contains, entriesByKey, sortedByFirstName, sortedByLastName, diff,
+    /// sequence and compact answer straight away, and everything else waits until the indexes are built.
+    explicit AddressBook(const std::string& path);
+
+    /// Fold the journal into a new snapshot and start a new journal.
+    /// The old journal is kept beside the new one as an archived segment, so that replicas can still catch up
+    /// from the changes in it (see catchUp), until discardChanges deletes it. Only the newest segments are kept,
+    /// default_retained_segments of them unless setRetainedSegments says otherwise, and older ones are deleted here.
+    /// Does nothing for an address book that only lives in memory.
+    void compact();
+
+    /// How many archived journal segments compact keeps unless told otherwise
+    static const std::size_t default_retained_segments = 8;
+
+    /// Set how many archived journal segments compact keeps, newest first, or SIZE_MAX to keep them all until
+    /// discardChanges deletes them. A replica that falls further behind than the segments kept is brought level
+    /// with the snapshot by catchUp, as it is when the changes it needs have been discarded.
+    void setRetainedSegments(std::size_t count);
+
+    /// The sequence number of the last change made to the address book, or copied into it by catchUp.
+    /// Every add, remove and change to an entry is numbered one on from the change before it,
+    /// and is written to the journal under that number.
+    std::uint64_t sequence() const;
+
+    /// Bring this address book, a read-only copy (a replica) of the one stored at primary_path, up to date with it.
+    /// The changes the primary has made since this book's sequence number are read from its journal and archived
+    /// segments and made here in the same order, under the same numbers, so catching up costs time in proportion to the
+    /// number of changes rather than to the size of the book. A replica that has never caught up, or that needs changes
+    /// the primary has since discarded, is first brought level with the primary's snapshot using a diff.
+    /// The replica must not be changed in any other way. Returns the number of changes made.
+    std::size_t catchUp(const std::string& primary_path);
+
+    /// Delete the archived journal segments that only hold changes up to up_to_sequence,
+    /// once every replica has caught up that far. Does nothing for an address book that only lives in memory.
+    void discardChanges(std::uint64_t up_to_sequence);
+
+    /// How two address books differ, from diff or diffSnapshots. A renamed entry shows as removed and added
+    struct Diff
+    {
+        /// Entries that are only in the newer book
+        std::vector<Entry> added;
+        /// Entries that are only in the older book
+        std::vector<Entry> removed;
+        /// Entries in both books whose phone numbers differ, as they are in the newer book
+        std::vector<Entry> changed;
+
+        bool empty() const;
+    };
+
+    /// Compare this address book with a newer copy of it. The two are walked side by side in key order,
+    /// so it takes a single pass over each without looking anything up.
+    Diff diff(const AddressBook& newer) const;
+
+    /// Compare two snapshots in the same way, straight from their files, without loading either into an address book.
+    /// Changes still in their journals are left out, so the books should be compacted first.
+    static Diff diffSnapshots(const std::string& older_path, const std::string& newer_path);
+
+    /// The outcome of a bulk import
+    struct ImportReport
+    {
+        /// A row that was not added, along with why
+        struct RejectedRow
+        {
+            std::size_t row_number;
+            std::string reason;
+        };
+
+        std::size_t rows_read = 0;
+        std::size_t rows_added = 0;
+        std::vector<RejectedRow> rejected_rows;
+        double seconds = 0;
+
+        double rowsPerSecond() const;
+    };
+
+    /// Add every entry in a CSV or TSV file with the columns first name, last name (optional) and phone number (optional).
+    /// Files ending in .tsv, or whose first row contains a tab, are read as TSV.
+    /// A first row starting with a "first name" heading is skipped.
+    /// Rows are numbered from 1 by their line in the file.
+    /// The rows are journaled in one write, and if that fails none of them are added and the exception is passed on.
+    ImportReport importFile(const std::string& path);
+
+    /// Add many entries at once. Names are cleaned up the same way as add does it,
+    /// and rows without a first name or whose name is already taken are rejected rather than prompted for.
+    /// Rows are numbered from 1 by their position in entries. A failed journal write is handled as in importFile.
+    ImportReport addBatch(std::vector<Entry> entries);
+
+    /// The outcome of add
+    enum class AddStatus
+    {
+        Inserted,
+        /// An entry with the same first and last name already exists
+        Duplicate,
+        /// The first name is blank
+        InvalidName
+    };
+
+    /// The outcome of remove
+    struct RemoveResult
+    {
+        enum class Status
+        {
+            Removed,
+            /// The name did not pick out a single entry. candidates holds the entries it matched,
+            /// and one of them can be removed with removeExact
+            Candidates,
+            NotFound
+        };
+
+        Status status = Status::NotFound;
+        std::map<std::string,Entry> candidates;
+    };
+
+    /// The changes to make to an entry. Fields that are left empty are not changed.
+    struct EntryPatch
+    {
+        std::optional<std::string> first_name;
+        std::optional<std::string> last_name;
+        std::optional<std::string> phone_number;
+    };
+
+    /// The outcome of alter
+    enum class AlterStatus
+    {
+        Altered,
+        /// The new names belong to another entry, so nothing was changed
+        Duplicate,
+        /// The new first name is blank, so nothing was changed
+        InvalidName,
+        NotFound
+    };
+
     /// Add an entry. Implement in address_book.cpp.
-    void add(std::string first_name,std::string last_name="",std::string phone_number="");
+    /// Whitespace is removed from the names.
+    AddStatus add(std::string first_name,std::string last_name="",std::string phone_number="");
 
     /// Remove an entry. Implement in address_book.cpp.
-    void remove(const std::string&);
+    /// The entry is removed straight away if the name is the exact key of an entry with a last name,
+    /// otherwise the entries that the name matches are returned.
+    RemoveResult remove(const std::string&);
+
+    /// Remove the entry with exactly this key. Returns false if there isn't one.
+    bool removeExact(const std::string& key);
+
+    /// Change the details of the entry with exactly this key.
+    /// Changing a name moves the entry to its new key without copying it. If the new key belongs to another entry,
+    /// Duplicate is returned and nothing is changed. If the change can't be written to the journal,
+    /// the entry is left as it was and the exception is passed on.
+    AlterStatus alter(const std::string& key, const EntryPatch&);
+
+    /// Adds, removes and alters collected to be made together by apply.
+    /// Changes are made in the order they were added to the batch, so a batch can, for example,
+    /// remove an entry and then add a new one with the same name.
+    class WriteBatch
+    {
+    public:
+        /// Add an entry, as add does
+        void add(std::string first_name, std::string last_name = "", std::string phone_number = "");
+
+        /// Remove the entry with exactly this key, as removeExact does
+        void remove(std::string key);
+
+        /// Change the entry with exactly this key, as alter does
+        void alter(std::string key, EntryPatch patch);
+
+        std::size_t size() const;
+        bool empty() const;
+        void clear();
+
+    private:
+        friend class AddressBook;
+
+        struct Change
+        {
+            enum class Kind
+            {
+                Add,
+                Remove,
+                Alter
+            };
+
+            Kind kind;
+            // The entry to add, or the key of the entry to remove or alter
+            Entry entry;
+            std::string key;
+            EntryPatch patch;
+        };
+
+        std::vector<Change> changes;
+    };
+
+    /// The outcome of apply
+    struct BatchResult
+    {
+        /// A change that could not be made, along with why
+        struct Conflict
+        {
+            /// The position of the change in the batch, counting from 0
+            std::size_t change_index;
+            std::string reason;
+        };
+
+        /// True if every change was made. If any change conflicts, none of them are made
+        bool committed = false;
+        std::vector<Conflict> conflicts;
+        std::size_t added = 0;
+        std::size_t removed = 0;
+        std::size_t altered = 0;
+    };
 
-    /// Change the details of an entry.
-    void alter(std::string);
+    /// Make every change in a batch, or none of them.
+    /// The whole batch is checked first, and if any change would fail (a name that is taken, an entry that
+    /// isn't there, a blank first name) nothing is changed and every such change is reported.
+    /// Otherwise the changes are made and written to the journal in a single write. An entry renamed by an alter
+    /// is moved to its new key as alter moves it, rather than removed and added again.
+    /// If that write fails, the changes are undone and the exception is passed on.
+    BatchResult apply(WriteBatch batch);
 
-    /// Print all entries from a specific search
-    void printSearchResults(const std::string&, bool* is_empty);
+    /// Returns the key used for an entry: "*first name* *last name*", or "*first name*" if there's no last name
+    static std::string makeKey(const std::string& first_name, const std::string& last_name);
 
     /// Return all entries sorted by first names. Implement in address_book.cpp.
-    std::map<std::string,Entry> sortedByFirstName();
+    /// The map is keyed by the entries' address book keys, so it is in the byte order of the keys, which puts "Émile"
+    /// after "Zoe". listByFirstName and entriesByFirstName give the entries in collation order instead.
+    std::map<std::string,Entry> sortedByFirstName() const;
 
     /// Return all entries sorted by last names. Implement in address_book.cpp.
-    std::map<std::string,Entry> sortedByLastName();
+    /// The map is keyed by "*last name* *first name*", or just the first name for an entry with a blank last name,
+    /// and is in the byte order of those keys. listByLastName and entriesByLastName give collation order instead.
+    std::map<std::string,Entry> sortedByLastName() const;
+
+    /// Return copies of all entries sorted by first names.
+    /// Names are sorted by their collation keys (see collationKey in name_normalization.h), so case and accents
+    /// don't change the order, and entries with the same first name are sorted by last name.
+    /// The entries are copies, so they stay valid as the address book changes; entriesByFirstName avoids copying them all.
+    std::vector<Entry> listByFirstName() const;
+
+    /// Return copies of all entries sorted by last names, and then by first names, in the same way.
+    /// Entries with a blank last name are sorted by just their first name.
+    std::vector<Entry> listByLastName() const;
+
+    /// View all entries sorted by first names as listByFirstName does, unpacking one at a time rather than copying them all
+    FirstNameView entriesByFirstName() const;
+
+    /// View all entries sorted by last names as listByLastName does, in the same way.
+    /// Entries with a blank last name are sorted by just their first name.
+    LastNameView entriesByLastName() const;
+
+    /// View all entries in the byte order of their keys, which is the order lookup and contains search in
+    KeyOrderView entriesByKey() const;
 
     /// Return all matching entries. Implement in address_book.cpp.
-    std::map<std::string,Entry> find(std::string name);
+    std::map<std::string,Entry> find(std::string name) const;
+
+    /// A page of results from findPage, pageByFirstName or pageByLastName
+    struct Page
+    {
+        std::vector<Entry> entries;
+        /// Pass this back to get the next page. It is empty if there are no more results.
+        /// It names where the next page starts rather than how far in it is, so changes made between
+        /// pages don't make the next page skip or repeat entries.
+        std::string resume_token;
+    };
+
+    /// Return up to limit of the entries that find would return, starting where resume_token says (or at the start).
+    /// Entries are read straight from the indexes as the page is filled, so a broad search costs no more than its first page.
+    /// Entries matching on their first name come first, in first name order, followed by those matching only on their
+    /// last name, in last name order. Entries passed over in the last name order because they matched on their first name
+    /// too count against the limit, so a page costs at most limit steps but can hold fewer entries, or none, while more
+    /// follow. Only an empty resume_token means there are no more.
+    /// Throws std::invalid_argument if resume_token did not come from findPage.
+    Page findPage(const std::string& name, std::size_t limit, const std::string& resume_token = "") const;
+
+    /// Return up to limit entries in first name order, starting where resume_token says (or at the start).
+    /// Throws std::invalid_argument if limit is 0.
+    Page pageByFirstName(std::size_t limit, const std::string& resume_token = "") const;
+
+    /// Return up to limit entries in last name order, starting where resume_token says (or at the start).
+    /// Throws std::invalid_argument if limit is 0.
+    Page pageByLastName(std::size_t limit, const std::string& resume_token = "") const;
+
+    /// Return the entries whose phone number starts with these digits, for working out who a number belongs to.
+    /// Only the digits of the numbers are compared, so "01632 960001" is found by "01632960" or "(01632) 96".
+    std::map<std::string,Entry> findByPhone(const std::string& number_prefix) const;
+
+    /// An entry found by findFuzzy
+    struct FuzzyMatch
+    {
+        /// How many single character edits separate the search from the matching first or last name
+        unsigned distance;
+        std::string key;
+        Entry entry;
+    };
+
+    /// Return the entries whose first or last name is within max_distance edits (insertions, deletions or substitutions)
+    /// of name, ignoring case, accents and whitespace, for when the user may have misspelt a name.
+    /// The edits are counted on the names' collation keys, so a Greek or Cyrillic letter counts as two.
+    /// At most limit entries are returned, closest first, and entries with the same distance are in key order.
+    /// The names are searched in a trie, which only goes down prefixes still within max_distance of the word, so the
+    /// cost grows with max_distance and the length of the word rather than with the size of the book: with a million
+    /// entries, a misspelt name takes about 0.05 ms at distance 1 and 0.5 ms at distance 2 (1 ms at the 90th percentile).
+    std::vector<FuzzyMatch> findFuzzy(std::string name, unsigned max_distance = 1, std::size_t limit = 10) const;
+
+    /// Conditions on an entry's fields for query, every one of which an entry must meet.
+    /// Names are compared by their collation keys, so case, accents and whitespace are ignored,
+    /// and phone numbers by their digits. For example, Query().firstNameStartsWith("jo").lastNameStartsWith("sm")
+    /// or Query().lastNameIs("Smith").phoneNumberStartsWith("07").
+    class Query
+    {
+    public:
+        Query& firstNameIs(const std::string& name);
+        Query& firstNameStartsWith(const std::string& prefix);
+
+        /// An empty name matches the entries without a last name
+        Query& lastNameIs(const std::string& name);
+        Query& lastNameStartsWith(const std::string& prefix);
+
+        /// A number without any digits matches the entries whose phone number has none
+        Query& phoneNumberIs(const std::string& number);
+        Query& phoneNumberStartsWith(const std::string& prefix);
+
+        std::size_t size() const;
+        bool empty() const;
 
+    private:
+        friend class AddressBook;
+
+        struct Condition
+        {
+            enum class Field
+            {
+                FirstName,
+                LastName,
+                PhoneNumber
+            };
+
+            Field field;
+            // Whether the field only has to start with value rather than be equal to it
+            bool prefix;
+            // The collation key of the name, or the digits of the phone number
+            std::string value;
+        };
+
+        std::vector<Condition> conditions;
+    };
+
+    /// Return the entries that meet every condition of the query.
+    /// The entries are not checked one at a time. The condition matching the fewest entries is looked up in the indexes,
+    /// and the other conditions only narrow those entries down, so a query takes time in proportion to its narrowest
+    /// condition rather than to the size of the address book. A query without conditions matches every entry.
+    std::map<std::string,Entry> query(const Query&) const;
+
+    /// Return up to limit entries whose first or last name starts with prefix, for completing a name as it is typed.
+    /// Case, accents and whitespace are ignored, as in find. Entries that have been used (see recordUse) come first,
+    /// the most used first and the most recently used of those used equally often. The rest follow in first name order,
+    /// and then those matching only on their last name in last name order.
+    /// The used entries are kept in a trie that keeps the best few entries under each prefix, so those are found
+    /// without looking at every used entry, and recent results are cached by prefix. The rest are read from the name orders,
+    /// stopping once there are enough. Either way it takes time in proportion to limit, plus the used entries and the entries
+    /// matching on both names that it passes over, rather than to the number of matches.
+    std::vector<Entry> suggest(const std::string& prefix, std::size_t limit = 10) const;
+
+    /// Count a use of the entry with exactly this key, such as the user picking it from suggest's results,
+    /// so that suggest puts it ahead of entries used less often. Returns false if there isn't one.
+    /// Uses are only counted in memory: they are not journaled, and start again from nothing when the book is opened.
+    /// An entry renamed by alter or apply keeps its uses.
+    bool recordUse(const std::string& key);
+
+    /// Return a copy of the entry with exactly this key ("*first name* *last name*", or "*first name*" if there's
+    /// no last name), or nothing if there isn't one. Entries are stored packed (see entry_table.h), so it is unpacked here.
+    std::optional<Entry> lookup(const std::string& key) const;
+
+    /// Return whether an entry has exactly this key
+    bool contains(const std::string& key) const;
+
+    /// Return the usage statistics gathered so far, along with the number of entries and an estimate of their memory use.
+    /// Operations are only counted and timed in builds that define ADDRESS_BOOK_METRICS (see address_book_metrics.h).
+    /// Working out the memory use walks every index, so this is not meant to be called often.
+    MetricsReport metrics() const;
 
 private:
-    // A map is used for the address book.
+    // The entries themselves, packed into columns (see entry_table.h). Everything else refers to an entry by its row
+    // in the table, which stays the same while the entry is in the book, even when it is renamed.
+    // A book of a million entries takes about a third of the memory it did with a map node and three strings per entry
+    EntryTable entry_table;
+
+    // A set of rows sorted by key is used for the address book.
     // It's private to follow the customs of encapsulation,
     // ensuring it can only be altered or obtained through an object of this class.
     // Since names are used for keys, it works well for retrieval operations,
@@ -51,6 +573,215 @@ private:
     // This is a lot faster than sequentially searching through the address book,
     // which would have a large number of entries.
     // A slight downside to this however is the automatic alphabetical sorting
-    // that a map does when a new entry is added, as this slightly reduces the speed of the program.
-    std::map<std::string,Entry> address_book_list;
+    // that a set does when a new entry is added, as this slightly reduces the speed of the program.
+    RowIndex address_book_list{RowOrder(this->entry_table, RowOrder::By::Key)};
+
+    // Case and accent folded prefix indexes over the first and last names.
+    // Each is sorted by the collation key of the name and then the address book key, so the set keeps every name
+    // in alphabetical order and a prefix search becomes a lower_bound followed by a short walk
+    // over the names that share that prefix, instead of a scan over the whole address book.
+    // Entries with a blank last name are left out of last_name_index.
+    RowIndex first_name_index{RowOrder(this->entry_table, RowOrder::By::FirstName)};
+    RowIndex last_name_index{RowOrder(this->entry_table, RowOrder::By::LastName)};
+
+    // The same for phone numbers, sorted by their digits, which are read from the packed numbers as they are compared.
+    // Entries whose phone number has no digits are left out
+    std::set<Row,PhoneOrder> phone_number_index{PhoneOrder(this->entry_table)};
+
+    // The address book in last name order, sorted by the collation keys of the last and first names
+    // (or just the first name if there's no last name) followed by the address book key, which keeps the entries distinct.
+    // The collation keys are worked out once for each distinct name, so keeping the order costs a byte comparison per step
+    RowIndex last_name_order{RowOrder(this->entry_table, RowOrder::By::LastNameOrder)};
+
+    // The same in first name order, as address_book_list itself has to stay in the byte order of its keys
+    RowIndex first_name_order{RowOrder(this->entry_table, RowOrder::By::FirstNameOrder)};
+
+    // The entries using each first name and each last name, by the names' collation keys, for query.
+    // Each list (a posting list) is kept sorted by row, which serves as the entries' ids:
+    // an entry keeps its row while it is in the address book, even when it is renamed.
+    // That lets the lists for different conditions be intersected by walking them side by side.
+    // Entries with a blank last name are listed under "".
+    using PostingList = std::vector<Row>;
+    std::map<std::string,PostingList,std::less<>> first_name_postings;
+    std::map<std::string,PostingList,std::less<>> last_name_postings;
+
+    // The distinct names in first_name_postings and last_name_postings (bar ""), as tries, for findFuzzy.
+    // Walking a trie works out the edit distances for a shared prefix once, and a prefix that is already too far
+    // from the word rules out everything under it just by not going down. A node is added when the first entry using
+    // a name is indexed and removed with the last one, so the tries only change as often as the set of names does.
+    // There are hundreds of thousands of nodes in a large book, so each keeps its children in a vector sorted by letter
+    // rather than in a map like SuggestionNode
+    struct NameTrieNode
+    {
+        std::vector<std::pair<char,std::unique_ptr<NameTrieNode>>> children;
+        // Whether a name ends here, rather than only passing through
+        bool ends_name = false;
+    };
+    NameTrieNode first_name_trie;
+    NameTrieNode last_name_trie;
+
+    // How often each entry has been used, as (number of uses, use_clock when it was last used), for suggest.
+    // Comparing these pairs ranks entries by how often they are used and then by how recently, and no two are equal.
+    // Only entries that have been used are kept
+    using UseRank = std::pair<std::uint64_t,std::uint64_t>;
+    std::unordered_map<Row,UseRank> uses;
+    std::uint64_t use_clock = 0;
+
+    // The entries that have been used, in a trie of the collation keys of their first and last names.
+    // Each node holds the entries with a name ending there, best first, and the best few at or below it,
+    // which answer suggest for that prefix straight away. For a larger limit, suggest starts at the node
+    // and always goes on with the best ranked node or entry it has reached, so it stops after about limit steps
+    // down the trie, however many used entries the prefix covers
+    struct Suggestion
+    {
+        UseRank rank;
+        Row row;
+        // Whether this is the entry's last name. An entry whose names fold to the same thing is only placed once
+        bool by_last_name;
+    };
+    struct SuggestionNode
+    {
+        std::map<char,std::unique_ptr<SuggestionNode>> children;
+        std::vector<Suggestion> suggestions;
+        std::vector<Suggestion> best;
+    };
+    SuggestionNode suggestion_root;
+
+    // The results of recent suggest calls by folded prefix, most recently used first, so that the prefixes typed most
+    // often are answered without a search. A change to an entry drops the results for every prefix of its names.
+    // suggest is const and runs on several threads at once under ConcurrentAddressBook's read lock, so it only uses the
+    // cache while holding suggestion_cache_mutex, and skips the cache rather than wait for it.
+    // Changes never run alongside suggest, so they drop results without taking the mutex
+    struct CachedSuggestions
+    {
+        std::string prefix;
+        std::size_t limit;
+        std::vector<Row> rows;
+    };
+    mutable std::list<CachedSuggestions> suggestion_cache;
+    // The keys point at the prefixes in suggestion_cache, which stay put as the list is reordered
+    mutable std::unordered_map<std::string_view,std::list<CachedSuggestions>::iterator> cached_prefixes;
+    mutable std::mutex suggestion_cache_mutex;
+
+    // Where the snapshot is stored. Empty for an address book that only lives in memory
+    std::string storage_path;
+    Journal journal;
+    std::size_t retained_segments = default_retained_segments;
+
+#if defined(ADDRESS_BOOK_METRICS)
+    // Counters and latency histograms, updated by the ADDRESS_BOOK_TIME and ADDRESS_BOOK_COUNT macros
+    AddressBookMetrics usage;
+#endif
+
+    // Whether the indexes other than address_book_list are kept up to date as entries change.
+    // Opening a stored book leaves them out until its entries are loaded, and then builds them on another thread
+    bool indexed = true;
+    // Ready once that thread has built them. It is declared last so that it is destroyed first,
+    // which waits for the thread before the indexes it writes to go
+    mutable std::shared_future<void> indexes_built;
+
+    /// Wait for the indexes if they are still being built, before anything reads or changes them.
+    /// Rethrows whatever building them threw
+    void waitForIndexes() const;
+
+    /// Insert a new entry, keeping the indexes and the journal up to date.
+    /// Returns false if an entry with the same key already exists.
+    /// insertEntry, eraseEntry, setPhoneNumber and renameEntry write to the journal before they change anything,
+    /// so if the write throws, the book is left as it was.
+    bool insertEntry(const Entry&);
+
+    /// Erase an entry, keeping the indexes and the journal up to date
+    void eraseEntry(Row);
+
+    /// Make a change read from a journal, under the sequence number it was given there
+    void applyChange(const Journal::Change&);
+
+    /// Make this book hold the same entries as the snapshot of the book stored at path, and take on its sequence number.
+    /// Returns the number of changes made.
+    std::size_t levelWithSnapshot(const std::string& path);
+
+    /// Change an entry's phone number, keeping the journal up to date
+    void setPhoneNumber(Row, const std::string&);
+
+    /// Change an entry's names, keeping the indexes and the journal up to date. Nothing may already use the new key.
+    /// The entry keeps its row.
+    void renameEntry(Row, const std::string& first_name, const std::string& last_name);
+
+    /// Clean up, validate and insert a batch of rows in one sorted pass.
+    /// row_numbers holds the number reported for each row if it is rejected.
+    void mergeBatch(std::vector<Entry>& rows, const std::vector<std::size_t>& row_numbers, ImportReport& report);
+
+    /// The fields to search address_book_list with for a key
+    static SortFields keyFields(std::string_view key);
+
+    /// Where the entry with exactly this key is in address_book_list, or its end if there isn't one
+    RowIndex::const_iterator findKey(std::string_view key) const;
+
+    /// Unpack the entry in a row into entry, reusing its strings' buffers
+    void readEntry(Row, Entry& entry) const;
+    Entry entryAt(Row) const;
+
+    /// The address book key of the entry in a row
+    std::string keyOf(Row) const;
+
+    /// Adds an entry to the prefix indexes, phone_number_index, first_name_order, last_name_order and the posting lists.
+    /// The entry must already be in address_book_list.
+    void indexEntry(Row);
+
+    /// indexEntry without phone_number_index, for renameEntry
+    void indexNames(Row);
+
+    /// indexEntry for many entries at once, which is quicker when there are a lot of them
+    void indexEntries(const std::vector<Row>& rows);
+
+    /// Removes an entry from the prefix indexes, phone_number_index, first_name_order, last_name_order and the posting lists
+    void unindexEntry(Row);
+
+    /// unindexEntry for many entries at once, which is quicker when there are a lot of them
+    void unindexEntries(const std::vector<Row>& rows);
+
+    /// unindexEntry without phone_number_index, for renameEntry, as a rename doesn't change the entry's number
+    void unindexNames(Row);
+
+    /// Copies every entry whose indexed name starts with the folded prefix into matches
+    void collectPrefixMatches(const RowIndex& index, const std::string& folded_prefix,
+                              std::map<std::string,Entry>& matches) const;
+
+    /// Adds a folded name to a name trie, or removes it and any nodes left with no names below them
+    static void addTrieName(NameTrieNode& root, std::string_view folded_name);
+    static void removeTrieName(NameTrieNode& root, std::string_view folded_name);
+
+    /// Adds each name in the trie within max_distance edits of the folded word to names, with its distance
+    void collectFuzzyNames(const NameTrieNode& root,
+                           const std::string& folded_word, unsigned max_distance,
+                           std::vector<std::pair<unsigned,std::string>>& names) const;
+
+    /// Returns how many entries meet a query condition, worked out from the indexes.
+    /// Gives up and returns SIZE_MAX once the count reaches give_up_at, or if the condition can't be counted that way
+    std::size_t countMatches(const Query::Condition&, std::size_t give_up_at) const;
+
+    /// Returns the entries that meet a query condition, sorted by row like a posting list
+    PostingList collectMatches(const Query::Condition&) const;
+
+    /// Whether an entry meets a query condition, checked against the collation keys and phone digits the table holds for it
+    bool meetsCondition(Row, const Query::Condition&) const;
+
+    /// Keep the trie and cache used by suggest up to date with an entry whose names are being indexed
+    void indexUses(Row);
+
+    /// The same for an entry whose names are being unindexed. Its uses are forgotten if forget is set,
+    /// as they are when the entry is removed, but kept for a rename
+    void unindexUses(Row, bool forget);
+
+    /// Place an entry in the trie under one of its names with this rank, or move it to this rank if it is already there
+    void placeSuggestion(std::string_view folded_name, Row, UseRank, bool by_last_name);
+
+    /// Take an entry out of the trie under one of its names, along with any nodes left empty
+    void removeSuggestion(std::string_view folded_name, Row, bool by_last_name);
+
+    /// Drop the cached results of suggest for every prefix of the folded name
+    void dropCachedSuggestions(std::string_view folded_name);
+
+    /// Returns the best limit entries for the folded prefix, as suggest does without its cache
+    std::vector<Row> rankSuggestions(const std::string& folded_prefix, std::size_t limit) const;
 };
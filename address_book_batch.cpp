@@ -0,0 +1,369 @@
+#include "include/address_book.h"
+#include "include/name_normalization.h"
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <string_view>
+
+void AddressBook::WriteBatch::add(std::string first_name, std::string last_name, std::string phone_number)
+{
+    Change change;
+    change.kind = Change::Kind::Add;
+    change.entry.first_name = std::move(first_name);
+    change.entry.last_name = std::move(last_name);
+    change.entry.phone_number = std::move(phone_number);
+    this->changes.push_back(std::move(change));
+}
+
+void AddressBook::WriteBatch::remove(std::string key)
+{
+    Change change;
+    change.kind = Change::Kind::Remove;
+    change.key = std::move(key);
+    this->changes.push_back(std::move(change));
+}
+
+void AddressBook::WriteBatch::alter(std::string key, EntryPatch patch)
+{
+    Change change;
+    change.kind = Change::Kind::Alter;
+    change.key = std::move(key);
+    change.patch = std::move(patch);
+    this->changes.push_back(std::move(change));
+}
+
+std::size_t AddressBook::WriteBatch::size() const
+{
+    return this->changes.size();
+}
+
+bool AddressBook::WriteBatch::empty() const
+{
+    return this->changes.empty();
+}
+
+void AddressBook::WriteBatch::clear()
+{
+    this->changes.clear();
+}
+
+AddressBook::BatchResult AddressBook::apply(WriteBatch batch)
+{
+    ADDRESS_BOOK_TIME(Apply);
+    this->waitForIndexes();
+    BatchResult result;
+    std::vector<WriteBatch::Change>& changes = batch.changes;
+
+    // Work out every key the batch touches: the key each change acts on, plus the new key of each alter.
+    // A key is "*first name*" or "*first name* *last name*" and names hold no whitespace,
+    // so an alter's new key can be worked out from its old key and its patch without looking anything up
+    std::vector<std::string> new_keys(changes.size());
+    for (WriteBatch::Change& change : changes){
+        std::size_t i = static_cast<std::size_t>(&change - changes.data());
+        if (change.kind == WriteBatch::Change::Kind::Add){
+            removeWhitespaceInPlace(change.entry.first_name);
+            removeWhitespaceInPlace(change.entry.last_name);
+            change.key = makeKey(change.entry.first_name, change.entry.last_name);
+        } else if (change.kind == WriteBatch::Change::Kind::Alter){
+            std::size_t space = change.key.find(' ');
+            std::string first_name = change.patch.first_name ? removeWhitespace(*change.patch.first_name)
+                                                             : change.key.substr(0, space);
+            std::string last_name = change.patch.last_name ? removeWhitespace(*change.patch.last_name)
+                                                           : (space == std::string::npos ? "" : change.key.substr(space + 1));
+            change.patch.first_name = first_name;
+            change.patch.last_name = last_name;
+            new_keys[i] = makeKey(first_name, last_name);
+        }
+    }
+
+    // The keys are sorted and each distinct one becomes a slot. Element 2i of key_slots is the slot of change i's key,
+    // and element 2i + 1 is the slot of its new key if it is an alter
+    std::vector<std::pair<std::string_view,std::size_t>> uses;
+    uses.reserve(2 * changes.size());
+    for (std::size_t i = 0 ; i<changes.size() ; i++){
+        uses.emplace_back(changes[i].key, 2 * i);
+        if (changes[i].kind == WriteBatch::Change::Kind::Alter){
+            uses.emplace_back(new_keys[i], 2 * i + 1);
+        }
+    }
+    std::sort(uses.begin(), uses.end());
+
+    // What a key holds in the address book, and what it will hold once the changes so far are made.
+    // The address book itself is only read until the whole batch has been checked,
+    // so a batch with any conflicts is turned down without having changed anything
+    const std::size_t no_slot = static_cast<std::size_t>(-1);
+    struct Slot
+    {
+        std::string_view key;
+        // The row of the entry with the key, if it existed
+        EntryTable::Row row;
+        bool existed;
+        bool present;
+        // The entry the batch gives the key, if it gives it a new one
+        std::optional<Entry> entry;
+        // The slot whose existing entry was altered into entry, or no_slot if entry is added by the batch
+        std::size_t source;
+    };
+    std::vector<Slot> slots;
+    std::vector<std::size_t> key_slots(2 * changes.size());
+    for (const auto& use : uses){
+        if (slots.empty() || slots.back().key != use.first){
+            Slot slot;
+            slot.key = use.first;
+            auto position = this->findKey(use.first);
+            slot.existed = position != this->address_book_list.end();
+            slot.row = slot.existed ? *position : 0;
+            slot.present = slot.existed;
+            slots.push_back(std::move(slot));
+        }
+        key_slots[use.second] = slots.size() - 1;
+    }
+
+    // The changes are then played out in order against the slots
+    for (std::size_t i = 0 ; i<changes.size() ; i++){
+        WriteBatch::Change& change = changes[i];
+        Slot& slot = slots[key_slots[2 * i]];
+        switch (change.kind){
+            case WriteBatch::Change::Kind::Add:
+                if (change.entry.first_name.empty()){
+                    result.conflicts.push_back({i, "missing first name"});
+                } else if (slot.present){
+                    result.conflicts.push_back({i, "entry already exists"});
+                } else{
+                    slot.present = true;
+                    slot.entry = std::move(change.entry);
+                    slot.source = no_slot;
+                    result.added++;
+                }
+                break;
+
+            case WriteBatch::Change::Kind::Remove:
+                if (!slot.present){
+                    result.conflicts.push_back({i, "no entry with that name"});
+                } else{
+                    slot.present = false;
+                    slot.entry.reset();
+                    result.removed++;
+                }
+                break;
+
+            case WriteBatch::Change::Kind::Alter:
+            {
+                Slot& new_slot = slots[key_slots[2 * i + 1]];
+                if (!slot.present){
+                    result.conflicts.push_back({i, "no entry with that name"});
+                    break;
+                }
+                if (change.patch.first_name->empty()){
+                    result.conflicts.push_back({i, "missing first name"});
+                    break;
+                }
+                if (&new_slot != &slot && new_slot.present){
+                    result.conflicts.push_back({i, "entry already exists"});
+                    break;
+                }
+                std::size_t source = slot.entry ? slot.source : key_slots[2 * i];
+                Entry altered = slot.entry ? std::move(*slot.entry) : this->entryAt(slot.row);
+                altered.first_name = std::move(*change.patch.first_name);
+                altered.last_name = std::move(*change.patch.last_name);
+                if (change.patch.phone_number){
+                    altered.phone_number = std::move(*change.patch.phone_number);
+                }
+                slot.present = false;
+                slot.entry.reset();
+                new_slot.present = true;
+                new_slot.entry = std::move(altered);
+                new_slot.source = source;
+                result.altered++;
+            }
+                break;
+        }
+    }
+    if (!result.conflicts.empty()){
+        result.added = 0;
+        result.removed = 0;
+        result.altered = 0;
+        return result;
+    }
+
+    // Where each entry already in the book ends up: the slot whose entry was altered from it, or no_slot if it is removed
+    std::vector<std::size_t> destination(slots.size(), no_slot);
+    // The reverse, for entries that move to a new key: the slot whose entry moves to each slot
+    std::vector<std::size_t> arriving(slots.size(), no_slot);
+    for (std::size_t i = 0 ; i<slots.size() ; i++){
+        if (!slots[i].present){
+            continue;
+        }
+        std::size_t source = slots[i].entry ? slots[i].source : i;
+        if (source != no_slot){
+            destination[source] = i;
+            if (source != i){
+                arriving[i] = source;
+            }
+        }
+    }
+
+    // Each step is noted with what it replaced, so the changes can be undone if anything fails part way.
+    // The journal records for all of them go out in one write
+    struct Undo
+    {
+        enum class Kind { Removed, PhoneChanged, Renamed, Parked, Added };
+        Kind kind;
+        // The key the step acted on, as it is once the step has been made
+        std::string key;
+        // The removed entry, the old phone number, or the old names
+        Entry entry;
+    };
+    std::vector<Undo> undo_log;
+    // An entry taken out of the book to break a cycle of renames, until it is put back under its new key
+    std::optional<EntryTable::Row> parked;
+    // New entries are only indexed once they are all in
+    std::vector<EntryTable::Row> added;
+    bool added_indexed = false;
+    this->journal.beginBatch();
+    try{
+        // Removed entries go first, which frees their keys for the entries moved or added there.
+        // The indexes are updated for all of them together, which is quicker than one at a time
+        std::vector<EntryTable::Row> removed;
+        for (std::size_t i = 0 ; i<slots.size() ; i++){
+            if (slots[i].existed && destination[i] == no_slot){
+                Entry entry = this->entryAt(slots[i].row);
+                this->journal.append(Journal::Operation::Remove, entry.first_name, entry.last_name);
+                undo_log.push_back({Undo::Kind::Removed, std::string(slots[i].key), std::move(entry)});
+                removed.push_back(slots[i].row);
+            }
+        }
+        this->unindexEntries(removed);
+        for (EntryTable::Row row : removed){
+            this->address_book_list.erase(row);
+        }
+        for (EntryTable::Row row : removed){
+            this->entry_table.erase(row);
+        }
+
+        // The entries that stay are given their new phone numbers while they still have their old names
+        for (std::size_t i = 0 ; i<slots.size() ; i++){
+            if (destination[i] == no_slot || !slots[destination[i]].entry){
+                continue;
+            }
+            std::string phone_number = this->entry_table.phoneNumber(slots[i].row);
+            if (phone_number != slots[destination[i]].entry->phone_number){
+                Undo undo{Undo::Kind::PhoneChanged, std::string(slots[i].key), Entry()};
+                undo.entry.phone_number = std::move(phone_number);
+                this->setPhoneNumber(slots[i].row, slots[destination[i]].entry->phone_number);
+                undo_log.push_back(std::move(undo));
+            }
+        }
+
+        // Renames move the entry itself, as alter does, so it keeps its uses and is journaled as a rename.
+        // An entry can only move once its new key is free, so each chain of renames is made from its far end back
+        std::vector<bool> moved(slots.size(), false);
+        auto moveEntry = [&](std::size_t from, std::size_t to){
+            const Entry& altered = *slots[to].entry;
+            Undo undo{Undo::Kind::Renamed, std::string(slots[to].key), Entry()};
+            undo.entry.first_name = std::string(this->entry_table.firstName(slots[from].row));
+            undo.entry.last_name = std::string(this->entry_table.lastName(slots[from].row));
+            this->renameEntry(slots[from].row, altered.first_name, altered.last_name);
+            undo_log.push_back(std::move(undo));
+            moved[from] = true;
+        };
+        for (std::size_t end = 0 ; end<slots.size() ; end++){
+            // A chain ends at a key that was free, or whose entry was removed
+            if (arriving[end] == no_slot || (slots[end].existed && destination[end] != no_slot)){
+                continue;
+            }
+            for (std::size_t to = end ; arriving[to] != no_slot ; to = arriving[to]){
+                moveEntry(arriving[to], to);
+            }
+        }
+        // What is left are cycles, such as two entries swapping names. One entry of each is taken out of the book,
+        // which frees its key for the rest of the cycle to move round, and put back under its new key at the end.
+        // The journal has it removed and added again, as a rename can't be replayed onto a key that is taken
+        for (std::size_t start = 0 ; start<slots.size() ; start++){
+            if (destination[start] == no_slot || destination[start] == start || moved[start]){
+                continue;
+            }
+            EntryTable::Row row = slots[start].row;
+            this->journal.append(Journal::Operation::Remove, this->entry_table.firstName(row), this->entry_table.lastName(row));
+            this->unindexNames(row);
+            this->address_book_list.erase(row);
+            parked = row;
+            undo_log.push_back({Undo::Kind::Parked, std::string(slots[start].key), Entry()});
+            moved[start] = true;
+            std::size_t to = start;
+            for ( ; arriving[to] != start ; to = arriving[to]){
+                moveEntry(arriving[to], to);
+            }
+            const Entry& altered = *slots[to].entry;
+            this->journal.append(Journal::Operation::Add, altered.first_name, altered.last_name, altered.phone_number);
+            Undo renamed{Undo::Kind::Renamed, std::string(slots[to].key), Entry()};
+            renamed.entry.first_name = std::string(this->entry_table.firstName(row));
+            renamed.entry.last_name = std::string(this->entry_table.lastName(row));
+            this->entry_table.rename(row, altered.first_name, altered.last_name);
+            this->address_book_list.insert(row);
+            parked.reset();
+            undo_log.push_back(std::move(renamed));
+            this->indexNames(row);
+        }
+
+        // New entries go in last, in key order. Each is placed with the entry after the one added before it as the hint,
+        // which is right whenever nothing in the book sorts between the two
+        auto hint = this->address_book_list.end();
+        for (Slot& slot : slots){
+            if (!slot.present || !slot.entry || slot.source != no_slot){
+                continue;
+            }
+            this->journal.append(Journal::Operation::Add, slot.entry->first_name, slot.entry->last_name,
+                                 slot.entry->phone_number);
+            EntryTable::Row row = this->entry_table.insert(slot.entry->first_name, slot.entry->last_name,
+                                                           slot.entry->phone_number);
+            auto inserted = this->address_book_list.emplace_hint(hint, row);
+            undo_log.push_back({Undo::Kind::Added, std::string(slot.key), Entry()});
+            added.push_back(row);
+            hint = std::next(inserted);
+        }
+        this->indexEntries(added);
+        added_indexed = true;
+        this->journal.commitBatch();
+    } catch(std::exception& ex){
+        // Take back each step, newest first. The journal records this produces are thrown away,
+        // as none of the batch's own records were written
+        this->journal.beginBatch();
+        for (auto undo = undo_log.rbegin() ; undo != undo_log.rend() ; ++undo){
+            auto entry = this->findKey(undo->key);
+            switch (undo->kind){
+                case Undo::Kind::Removed:
+                    if (entry == this->address_book_list.end()){
+                        this->insertEntry(undo->entry);
+                    }
+                    break;
+                case Undo::Kind::PhoneChanged:
+                    this->setPhoneNumber(*entry, undo->entry.phone_number);
+                    break;
+                case Undo::Kind::Renamed:
+                    this->renameEntry(*entry, undo->entry.first_name, undo->entry.last_name);
+                    break;
+                case Undo::Kind::Parked:
+                    // Unless it was already put back under its new key, and then renamed back above
+                    if (parked){
+                        this->address_book_list.insert(*parked);
+                        this->indexNames(*parked);
+                    }
+                    break;
+                case Undo::Kind::Added:
+                    if (added_indexed){
+                        this->eraseEntry(*entry);
+                    } else{
+                        EntryTable::Row row = *entry;
+                        this->address_book_list.erase(entry);
+                        this->entry_table.erase(row);
+                    }
+                    break;
+            }
+        }
+        this->journal.abortBatch();
+        throw;
+    }
+    result.committed = true;
+    return result;
+}
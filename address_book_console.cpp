@@ -0,0 +1,464 @@
+#include "include/address_book.h"
+#include "include/address_book_server.h"
+#include "include/name_normalization.h"
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+// The console front-end for the address book.
+// Everything that prompts the user or prints to the screen lives here,
+// and it only uses AddressBook's public member functions.
+
+namespace {
+
+// Print all entries from a specific search.
+// Returns false if there were none, in which case the user is told so
+bool printSearchResults(const std::map<std::string, AddressBook::Entry>& search_results) {
+    if (search_results.empty()) {
+        std::cout << "No matching entries for that name" << std::endl;
+        return false;
+    }
+    std::cout << "Here are the matching entries: " << std::endl;
+    for (const auto& i : search_results) {
+        std::cout << "First name: " << i.second.first_name <<
+                  " / Last name: " << i.second.last_name <<
+                  " / Phone number: " << i.second.phone_number << std::endl;
+    }
+    return true;
+}
+
+// Search results are shown this many at a time
+const std::size_t results_per_page = 20;
+
+// Print the entries matching a name a page at a time, asking before each further page.
+// If nothing matches, entries with similar names are suggested instead
+void findInPages(const AddressBook& addressBook, const std::string& name) {
+    AddressBook::Page page = addressBook.findPage(name, results_per_page);
+    if (page.entries.empty()) {
+        std::cout << "No matching entries for that name" << std::endl;
+        // Nothing starts with what they typed, so it may have been misspelt
+        std::vector<AddressBook::FuzzyMatch> suggestions = addressBook.findFuzzy(name, 2, 5);
+        if (!suggestions.empty()) {
+            std::cout << "Did you mean: " << std::endl;
+            for (const auto& i : suggestions) {
+                std::cout << "First name: " << i.entry.first_name <<
+                          " / Last name: " << i.entry.last_name <<
+                          " / Phone number: " << i.entry.phone_number << std::endl;
+            }
+        }
+        return;
+    }
+    std::cout << "Here are the matching entries: " << std::endl;
+    while (true) {
+        for (const AddressBook::Entry& i : page.entries) {
+            std::cout << "First name: " << i.first_name <<
+                      " / Last name: " << i.last_name <<
+                      " / Phone number: " << i.phone_number << std::endl;
+        }
+        if (page.resume_token.empty()) {
+            return;
+        }
+        // A page can come back with nothing on it while more follow (see findPage), and there's nothing to ask about then
+        if (!page.entries.empty()) {
+            std::string user_choice;
+            std::cout << "Press enter to see more, or type \"Q\" to return to the menu" << std::endl;
+            std::getline(std::cin,user_choice);
+            if (user_choice == "Q") {
+                return;
+            }
+        }
+        page = addressBook.findPage(name, results_per_page, page.resume_token);
+    }
+}
+
+// Asks the user to pick one of the entries they were shown by typing its key.
+// Returns an empty string if they type "Q" to go back to the menu instead
+std::string chooseEntry(const AddressBook& addressBook, const std::string& action) {
+    std::string user_choice;
+    while (true) {
+        std::cout << "Please select an entry to be " << action << " by typing \"*first name* *last name*\" " <<
+                  "(or \"*first name*\" if there's no last name) " <<
+                  "or type \"Q\" to quit and return to the menu" <<
+                  std::endl;
+        std::getline(std::cin,user_choice);
+        // Gives the user a chance to go back to the menu so they aren't forced to pick an entry
+        if (user_choice == "Q") {
+            return "";
+        }
+        if (addressBook.contains(user_choice)) {
+            return user_choice;
+        }
+    }
+}
+
+void addInteractively(AddressBook& addressBook, std::string first_name,
+                      const std::string& last_name, const std::string& phone_number) {
+    while (isBlank(first_name)) {
+        // The user must provide a name that is not blank
+        std::cout << "Please enter a valid first name" << std::endl;
+        // getline is used throughout the program as it takes spaces as part of the input,
+        // as opposed to cin which separates an input by spaces and treats them as separate inputs
+        std::getline(std::cin,first_name);
+    }
+    switch (addressBook.add(first_name,last_name,phone_number)) {
+        case AddressBook::AddStatus::Inserted:
+            std::cout << AddressBook::makeKey(removeWhitespace(first_name), removeWhitespace(last_name)) <<
+                      " successfully added" << std::endl;
+            break;
+        case AddressBook::AddStatus::Duplicate:
+            std::cout << "This entry already exists" << std::endl;
+            break;
+        case AddressBook::AddStatus::InvalidName:
+            std::cout << "Please enter a valid first name" << std::endl;
+            break;
+    }
+}
+
+void removeInteractively(AddressBook& addressBook, const std::string& entry_to_remove) {
+    AddressBook::RemoveResult result = addressBook.remove(entry_to_remove);
+    if (result.status == AddressBook::RemoveResult::Status::Removed) {
+        std::cout << "Entry successfully removed" << std::endl;
+        return;
+    }
+    // The user is presented with a series of options to remove based on their search
+    // if it didn't match a singular entry, making it easier to remove entries
+    if (!printSearchResults(result.candidates)) {
+        return;
+    }
+    std::string entry_choice = chooseEntry(addressBook, "removed");
+    if (!entry_choice.empty() && addressBook.removeExact(entry_choice)) {
+        std::cout << "Entry successfully removed" << std::endl;
+    }
+}
+
+void alterInteractively(AddressBook& addressBook, std::string entry_to_alter) {
+    // The entry can be altered straight away if the user entered its exact key (except if the last name is blank),
+    // otherwise they pick it from the search results
+    std::optional<AddressBook::Entry> exact_match = addressBook.lookup(entry_to_alter);
+    if (!exact_match || exact_match->last_name.empty()) {
+        if (!printSearchResults(addressBook.find(entry_to_alter))) {
+            return;
+        }
+        entry_to_alter = chooseEntry(addressBook, "altered");
+        if (entry_to_alter.empty()) {
+            return;
+        }
+    }
+    AddressBook::EntryPatch patch;
+    std::string user_choice;
+    bool verified_entry = false;
+    while(!verified_entry){
+        std::cout << "What would you like to do? (1,2,3,4) \n "
+                     "1.) Alter the first name \n " <<
+                     "2.) Alter the last name \n " <<
+                     "3.) Alter the phone number \n " <<
+                     "4.) Quit and save the new edits "<< std::endl;
+        std::getline(std::cin,user_choice);
+        while (user_choice != "1" && user_choice != "2" && user_choice != "3" && user_choice != "4"){
+            std::cout << "Please choose one of the options (1,2,3,4)" << std::endl;
+            std::getline(std::cin,user_choice);
+        }
+        std::string new_value;
+        // Converts user's choice to an integer
+        switch(std::stoi(user_choice)){
+            case 1:
+                std::cout << "Please enter the new first name" << std::endl;
+                std::getline(std::cin,new_value);
+                while (isBlank(new_value)){
+                    std::cout << "This is not valid, please enter the new first name" << std::endl;
+                    std::getline(std::cin,new_value);
+                }
+                patch.first_name = new_value;
+                std::cout << "New details stored" << std::endl;
+                break;
+            case 2:
+                std::cout << "Please enter the new last name (optional)" << std::endl;
+                std::getline(std::cin,new_value);
+                patch.last_name = new_value;
+                std::cout << "New details stored" << std::endl;
+                break;
+
+            case 3:
+                std::cout << "Please enter the new phone number (optional)" << std::endl;
+                std::getline(std::cin,new_value);
+                patch.phone_number = new_value;
+                std::cout << "New details stored" << std::endl;
+                break;
+
+            case 4:
+                switch (addressBook.alter(entry_to_alter, patch)) {
+                    case AddressBook::AlterStatus::Altered:
+                        std::cout << "Details successfully changed" << std::endl;
+                        verified_entry = true;
+                        break;
+                    case AddressBook::AlterStatus::Duplicate:
+                        std::cout << "This entry already exists, please change the first or last name"
+                        << std::endl;
+                        break;
+                    case AddressBook::AlterStatus::InvalidName:
+                        std::cout << "This is not valid, please change the first name" << std::endl;
+                        break;
+                    case AddressBook::AlterStatus::NotFound:
+                        std::cout << "No matching entries for that name" << std::endl;
+                        verified_entry = true;
+                        break;
+                }
+        }
+    }
+}
+
+// The server started by --serve, for the signal handler to stop
+AddressBookServer* running_server = nullptr;
+
+void stopServer(int) {
+    if (running_server != nullptr) {
+        running_server->stop();
+    }
+}
+
+// Serve the address book on address until the process is interrupted or terminated,
+// then fold the journal into the snapshot as quitting from the menu does.
+// The archived journal segments are left for replicas, and compact keeps only the newest of them
+int serve(AddressBook& addressBook, const std::string& address) {
+    try{
+        AddressBookServer server(addressBook, address);
+        running_server = &server;
+        std::signal(SIGINT, stopServer);
+        std::signal(SIGTERM, stopServer);
+        std::cout << "Serving the address book on " << address << std::endl;
+        server.run();
+        running_server = nullptr;
+    } catch(std::exception& ex){
+        running_server = nullptr;
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    addressBook.compact();
+    return 0;
+}
+
+void printDiffEntries(const std::vector<AddressBook::Entry>& entries, char marker) {
+    for (const AddressBook::Entry& entry : entries) {
+        std::cout << marker << " First name: " << entry.first_name <<
+                  " / Last name: " << entry.last_name <<
+                  " / Phone number: " << entry.phone_number << std::endl;
+    }
+}
+
+// Print how the snapshot at newer_path differs from the one at older_path
+int printDiff(const std::string& older_path, const std::string& newer_path) {
+    try{
+        AddressBook::Diff difference = AddressBook::diffSnapshots(older_path, newer_path);
+        printDiffEntries(difference.removed, '-');
+        printDiffEntries(difference.added, '+');
+        printDiffEntries(difference.changed, '~');
+        std::cout << difference.added.size() << " added, " << difference.removed.size() << " removed, " <<
+                  difference.changed.size() << " changed" << std::endl;
+    } catch(std::exception& ex){
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+}
+
+// A menu that provides a user-friendly way to interact with the address book.
+// This menu is on a loop and the program will only stop once the user makes it stop.
+// The address book is kept in address_book.dat in the working directory, so changes are kept between runs.
+// Changes are written to its journal as they are made and folded into the snapshot when the user quits.
+// Run with --serve <address> to serve the address book to other programs instead of showing the menu
+// (see address_book_server.h for the addresses and the protocol),
+// or with --diff <older snapshot> <newer snapshot> to show how two copies of the address book differ.
+
+int main(int argc, char** argv){
+    if (argc == 3 && std::strcmp(argv[1], "--serve") == 0){
+        AddressBook addressBook("address_book.dat");
+        return serve(addressBook, argv[2]);
+    }
+    if (argc == 4 && std::strcmp(argv[1], "--diff") == 0){
+        return printDiff(argv[2], argv[3]);
+    }
+    if (argc != 1){
+        std::cerr << "Usage: " << argv[0] << " [--serve unix:<path> | --serve [<host>:]<port> | " <<
+                  "--diff <older snapshot> <newer snapshot>]" << std::endl;
+        return 1;
+    }
+    bool quit = false;
+    AddressBook addressBook("address_book.dat");
+    std::string menu_choice;
+    while (!quit){
+        std::cout << "\nWhat would you like to do? (1,2,3,4,5,6,7,8,9,10) \n " <<
+                  "1.) Add an entry to the address book \n " <<
+                  "2.) Remove an entry from the address book \n " <<
+                  "3.) Alter an entry in the address book \n " <<
+                  "4.) Get the list in alphabetical order (by first name) \n " <<
+                  "5.) Get the list in alphabetical order (by last name) \n " <<
+                  "6.) Find an entry in the address book \n " <<
+                  "7.) Find who a phone number belongs to \n " <<
+                  "8.) Import entries from a CSV or TSV file \n " <<
+                  "9.) Show usage statistics \n " <<
+                  "10.) Quit" << std::endl;
+        std::getline(std::cin,menu_choice);
+        while(menu_choice != "1" && menu_choice != "2" && menu_choice != "3" && menu_choice != "4"
+        && menu_choice != "5" && menu_choice != "6" && menu_choice != "7" && menu_choice != "8" && menu_choice != "9"
+        && menu_choice != "10"){
+            std::cout << "Please choose one of the options (1,2,3,4,5,6,7,8,9,10)" << std::endl;
+            std::getline(std::cin,menu_choice);
+        }
+        switch (std::stoi(menu_choice)) {
+            case 1:
+            {
+                std::string first_name;
+                std::cout << "Please enter the first name" << std::endl;
+                std::getline(std::cin,first_name);
+                std::string last_name;
+                std::cout << "Please enter the last name (optional)" << std::endl;
+                std::getline(std::cin,last_name);
+                std::string phone_number;
+                std::cout << "Please enter the phone number (optional)" << std::endl;
+                std::getline(std::cin,phone_number);
+                // A change that can't be written to the journal is not made, and the user is told why
+                try{
+                    addInteractively(addressBook,first_name,last_name,phone_number);
+                } catch(std::exception& ex){
+                    std::cout << ex.what() << std::endl;
+                }
+            }
+                break;
+
+            case 2:
+            {
+                std::string entry_to_remove;
+                std::cout << "Please enter a name" << std::endl;
+                std::getline(std::cin,entry_to_remove);
+                try{
+                    removeInteractively(addressBook,entry_to_remove);
+                } catch(std::exception& ex){
+                    std::cout << ex.what() << std::endl;
+                }
+            }
+                break;
+
+            case 3:
+            {
+                std::string entry_to_alter;
+                std::cout << "Please enter a name" << std::endl;
+                std::getline(std::cin,entry_to_alter);
+                try{
+                    alterInteractively(addressBook,entry_to_alter);
+                } catch(std::exception& ex){
+                    std::cout << ex.what() << std::endl;
+                }
+            }
+                break;
+
+            case 4:
+            {
+                // The views stream straight out of the address book, so nothing is copied to list it
+                auto first_name_order = addressBook.entriesByFirstName();
+                if (first_name_order.empty()){
+                    std::cout << "The address book is currently empty" << std::endl;
+                } else{
+                    std::cout << "The address book organised by first name: " << std::endl;
+                    for (const AddressBook::Entry& i : first_name_order){
+                        if (i.last_name.empty()){
+                            std::cout << "Name: " << i.first_name <<
+                                      " / Phone number: " << i.phone_number << std::endl;
+                        } else{
+                            std::cout << "First name: " << i.first_name <<
+                                      " / Last name: " << i.last_name <<
+                                      " / Phone number: " << i.phone_number << std::endl;
+                        }
+                    }
+                }
+            }
+                break;
+
+            case 5:
+            {
+                // The views stream straight out of the address book, so nothing is copied to list it
+                auto last_name_order = addressBook.entriesByLastName();
+                if (last_name_order.empty()){
+                    std::cout << "The address book is currently empty" << std::endl;
+                } else{
+                    std::cout << "The address book organised by last name: " << std::endl;
+                    for (const AddressBook::Entry& i : last_name_order){
+                        if (i.last_name.empty()){
+                            std::cout << "Name: " << i.first_name <<
+                                      " / Phone number: " << i.phone_number << std::endl;
+                        } else{
+                            std::cout << "Last name: " << i.last_name <<
+                                      " / First name: " << i.first_name <<
+                                      " / Phone number: " << i.phone_number << std::endl;
+                        }
+                    }
+                }
+            }
+                break;
+
+            case 6:
+            {
+                std::string name;
+                std::cout << "Please enter a name" << std::endl;
+                std::getline(std::cin,name);
+                findInPages(addressBook,name);
+            }
+                break;
+
+            case 7:
+            {
+                std::string phone_number;
+                std::cout << "Please enter the phone number, or the start of it" << std::endl;
+                std::getline(std::cin,phone_number);
+                std::map<std::string, AddressBook::Entry> owners = addressBook.findByPhone(phone_number);
+                if (owners.empty()) {
+                    std::cout << "No entries have that phone number" << std::endl;
+                } else{
+                    printSearchResults(owners);
+                }
+            }
+                break;
+
+            case 8:
+            {
+                std::string path;
+                std::cout << "Please enter the path of the file" << std::endl;
+                std::getline(std::cin,path);
+                try{
+                    AddressBook::ImportReport report = addressBook.importFile(path);
+                    std::cout << report.rows_added << " of " << report.rows_read << " rows added in " <<
+                              report.seconds << " seconds (" << report.rowsPerSecond() << " rows/sec)" << std::endl;
+                    for (const AddressBook::ImportReport::RejectedRow& i : report.rejected_rows){
+                        std::cout << "Row " << i.row_number << " was not added: " << i.reason << std::endl;
+                    }
+                } catch(std::exception& ex){
+                    std::cout << ex.what() << std::endl;
+                }
+            }
+                break;
+
+            case 9:
+                std::cout << addressBook.metrics().toText();
+                break;
+
+            case 10:
+            {
+                // If the snapshot can't be written, every change is still in the journal,
+                // so the user is told why and taken back to the menu to try again
+                try{
+                    addressBook.compact();
+                    // Nothing here keeps track of replicas, so the archived journal segments aren't kept for them.
+                    // A replica that had not caught up yet levels with the snapshot instead
+                    addressBook.discardChanges(addressBook.sequence());
+                    quit = true;
+                } catch(std::exception& ex){
+                    std::cout << ex.what() << std::endl;
+                }
+            }
+                break;
+
+        }
+    }
+    return 0;
+}
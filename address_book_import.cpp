@@ -0,0 +1,358 @@
+#include "include/address_book.h"
+#include "include/name_normalization.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Splitting work across threads isn't worth it for a handful of rows,
+// so each thread is given at least this many
+const std::size_t minimum_rows_per_thread = 16384;
+const std::size_t minimum_bytes_per_thread = 1 << 20;
+
+unsigned threadCount(std::size_t work, std::size_t minimum_per_thread)
+{
+    std::size_t available = std::max(1u, std::thread::hardware_concurrency());
+    return static_cast<unsigned>(std::max<std::size_t>(1, std::min(available, work / minimum_per_thread)));
+}
+
+// Runs work(0) ... work(thread_count - 1) at the same time, using the calling thread for the first one
+template <typename Work>
+void runInParallel(unsigned thread_count, const Work& work)
+{
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (unsigned i = 1 ; i<thread_count ; i++){
+        threads.emplace_back(work, i);
+    }
+    work(0);
+    for (std::thread& thread : threads){
+        thread.join();
+    }
+}
+
+// Splits one line into its fields. A field may be wrapped in double quotes,
+// in which case it can contain the delimiter and "" stands for a single quote.
+// Returns false if a quoted field is never closed
+bool splitFields(std::string_view line, char delimiter, std::vector<std::string>& fields)
+{
+    fields.clear();
+    fields.emplace_back();
+    bool quoted = false;
+    for (std::size_t i = 0 ; i<line.size() ; i++){
+        char c = line[i];
+        if (quoted){
+            if (c == '"' && i + 1 < line.size() && line[i + 1] == '"'){
+                fields.back().push_back('"');
+                i++;
+            } else if (c == '"'){
+                quoted = false;
+            } else{
+                fields.back().push_back(c);
+            }
+        } else if (c == '"'){
+            quoted = true;
+        } else if (c == delimiter){
+            fields.emplace_back();
+        } else{
+            fields.back().push_back(c);
+        }
+    }
+    return !quoted;
+}
+
+bool isHeaderRow(std::string first_field)
+{
+    removeWhitespaceInPlace(first_field);
+    first_field = asciiToLower(first_field);
+    return first_field == "firstname" || first_field == "first_name";
+}
+
+// The rows one thread found in its part of the file. Line numbers start from 0 at the start of that part
+struct ParsedChunk
+{
+    std::vector<AddressBook::Entry> rows;
+    std::vector<std::size_t> lines;
+    std::vector<AddressBook::ImportReport::RejectedRow> rejected_rows;
+    std::size_t line_count = 0;
+};
+
+void parseChunk(std::string_view text, char delimiter, bool skip_header, ParsedChunk& chunk)
+{
+    std::vector<std::string> fields;
+    std::size_t line_start = 0;
+    while (line_start < text.size()){
+        std::size_t line_end = text.find('\n', line_start);
+        if (line_end == std::string_view::npos){
+            line_end = text.size();
+        }
+        std::string_view line = text.substr(line_start, line_end - line_start);
+        if (!line.empty() && line.back() == '\r'){
+            line.remove_suffix(1);
+        }
+        std::size_t line_number = chunk.line_count++;
+        line_start = line_end + 1;
+        // Blank lines are skipped without being reported
+        if (isBlank(line)){
+            continue;
+        }
+        if (!splitFields(line, delimiter, fields)){
+            chunk.rejected_rows.push_back({line_number, "a quoted field is not closed"});
+            continue;
+        }
+        if (fields.size() > 3){
+            chunk.rejected_rows.push_back({line_number, "too many fields"});
+            continue;
+        }
+        if (skip_header && line_number == 0 && isHeaderRow(fields[0])){
+            continue;
+        }
+        fields.resize(3);
+        AddressBook::Entry entry;
+        entry.first_name = std::move(fields[0]);
+        entry.last_name = std::move(fields[1]);
+        entry.phone_number = std::move(fields[2]);
+        chunk.rows.push_back(std::move(entry));
+        chunk.lines.push_back(line_number);
+    }
+}
+
+// A read-only mapping of a whole file, which is unmapped when it goes out of scope
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0){
+            throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+        }
+        struct stat file_info;
+        if (::fstat(fd, &file_info) != 0){
+            ::close(fd);
+            throw std::runtime_error("Could not read " + path + ": " + std::strerror(errno));
+        }
+        this->size = static_cast<std::size_t>(file_info.st_size);
+        if (this->size > 0){
+            this->data = ::mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if (this->data == MAP_FAILED){
+            throw std::runtime_error("Could not map " + path + ": " + std::strerror(errno));
+        }
+        if (this->size > 0){
+            ::madvise(this->data, this->size, MADV_SEQUENTIAL);
+        }
+    }
+
+    ~MappedFile()
+    {
+        if (this->size > 0){
+            ::munmap(this->data, this->size);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view text() const
+    {
+        return std::string_view(static_cast<const char*>(this->data), this->size);
+    }
+
+private:
+    void* data = nullptr;
+    std::size_t size = 0;
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+double AddressBook::ImportReport::rowsPerSecond() const
+{
+    if (this->seconds <= 0){
+        return 0;
+    }
+    return static_cast<double>(this->rows_read) / this->seconds;
+}
+
+AddressBook::ImportReport AddressBook::importFile(const std::string& path)
+{
+    ADDRESS_BOOK_TIME(Import);
+    this->waitForIndexes();
+    auto start = std::chrono::steady_clock::now();
+    ImportReport report;
+    MappedFile file(path);
+    std::string_view text = file.text();
+
+    std::string_view first_line = text.substr(0, text.find('\n'));
+    char delimiter = ',';
+    if ((path.size() >= 4 && path.compare(path.size() - 4, 4, ".tsv") == 0)
+    || first_line.find('\t') != std::string_view::npos){
+        delimiter = '\t';
+    }
+
+    // The file is split into one part per thread, with each part ending on a line break.
+    // Quoted fields are not allowed to span lines, so a line break always ends a row
+    unsigned thread_count = threadCount(text.size(), minimum_bytes_per_thread);
+    std::vector<std::size_t> boundaries(thread_count + 1, text.size());
+    boundaries[0] = 0;
+    for (unsigned i = 1 ; i<thread_count ; i++){
+        std::size_t boundary = text.find('\n', std::max(boundaries[i - 1], text.size() / thread_count * i));
+        boundaries[i] = boundary == std::string_view::npos ? text.size() : boundary + 1;
+    }
+    std::vector<ParsedChunk> chunks(thread_count);
+    runInParallel(thread_count, [&](unsigned i){
+        parseChunk(text.substr(boundaries[i], boundaries[i + 1] - boundaries[i]), delimiter, i == 0, chunks[i]);
+    });
+
+    // Each part counted its lines from 0, so they are offset by the lines in every part before it
+    std::size_t row_count = 0;
+    for (const ParsedChunk& chunk : chunks){
+        row_count += chunk.rows.size();
+    }
+    std::vector<Entry> rows;
+    std::vector<std::size_t> row_numbers;
+    rows.reserve(row_count);
+    row_numbers.reserve(row_count);
+    std::size_t first_line_number = 1;
+    for (ParsedChunk& chunk : chunks){
+        for (std::size_t i = 0 ; i<chunk.rows.size() ; i++){
+            rows.push_back(std::move(chunk.rows[i]));
+            row_numbers.push_back(first_line_number + chunk.lines[i]);
+        }
+        for (ImportReport::RejectedRow& rejected : chunk.rejected_rows){
+            report.rejected_rows.push_back({first_line_number + rejected.row_number, std::move(rejected.reason)});
+        }
+        first_line_number += chunk.line_count;
+    }
+    report.rows_read = rows.size() + report.rejected_rows.size();
+
+    this->mergeBatch(rows, row_numbers, report);
+    ADDRESS_BOOK_COUNT(RowsImported, report.rows_added);
+    ADDRESS_BOOK_COUNT(RowsRejected, report.rejected_rows.size());
+    report.seconds = secondsSince(start);
+    return report;
+}
+
+AddressBook::ImportReport AddressBook::addBatch(std::vector<Entry> entries)
+{
+    ADDRESS_BOOK_TIME(Import);
+    this->waitForIndexes();
+    auto start = std::chrono::steady_clock::now();
+    ImportReport report;
+    report.rows_read = entries.size();
+    std::vector<std::size_t> row_numbers(entries.size());
+    std::iota(row_numbers.begin(), row_numbers.end(), 1);
+    this->mergeBatch(entries, row_numbers, report);
+    ADDRESS_BOOK_COUNT(RowsImported, report.rows_added);
+    ADDRESS_BOOK_COUNT(RowsRejected, report.rejected_rows.size());
+    report.seconds = secondsSince(start);
+    return report;
+}
+
+void AddressBook::mergeBatch(std::vector<Entry>& rows, const std::vector<std::size_t>& row_numbers, ImportReport& report)
+{
+    // Names are cleaned up and turned into keys on every thread at once.
+    // A row without a first name is given an empty key, which sorts before every other key
+    std::vector<std::string> keys(rows.size());
+    unsigned thread_count = threadCount(rows.size(), minimum_rows_per_thread);
+    std::vector<std::size_t> boundaries(thread_count + 1);
+    for (unsigned i = 0 ; i<=thread_count ; i++){
+        boundaries[i] = rows.size() / thread_count * i;
+    }
+    boundaries[thread_count] = rows.size();
+    runInParallel(thread_count, [&](unsigned i){
+        for (std::size_t row = boundaries[i] ; row<boundaries[i + 1] ; row++){
+            removeWhitespaceInPlace(rows[row].first_name);
+            removeWhitespaceInPlace(rows[row].last_name);
+            if (!rows[row].first_name.empty()){
+                keys[row] = makeKey(rows[row].first_name, rows[row].last_name);
+            }
+        }
+    });
+
+    // The rows are put in key order so that they can be checked for duplicates and inserted in one pass.
+    // Each thread sorts its own slice, and then neighbouring slices are merged until one remains.
+    // Ties are broken by position, so the first of several rows with the same name is the one that is kept
+    std::vector<std::size_t> order(rows.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto keyOrder = [&keys](std::size_t a, std::size_t b){
+        int comparison = keys[a].compare(keys[b]);
+        return comparison < 0 || (comparison == 0 && a < b);
+    };
+    runInParallel(thread_count, [&](unsigned i){
+        std::sort(order.begin() + boundaries[i], order.begin() + boundaries[i + 1], keyOrder);
+    });
+    for (unsigned width = 1 ; width<thread_count ; width *= 2){
+        unsigned merge_count = (thread_count + 2 * width - 1) / (2 * width);
+        runInParallel(merge_count, [&](unsigned i){
+            unsigned first = i * 2 * width;
+            unsigned middle = std::min(first + width, thread_count);
+            unsigned last = std::min(first + 2 * width, thread_count);
+            std::inplace_merge(order.begin() + boundaries[first], order.begin() + boundaries[middle],
+                               order.begin() + boundaries[last], keyOrder);
+        });
+    }
+
+    // Every change from the batch is written to the journal at once
+    this->journal.beginBatch();
+    std::vector<EntryTable::Row> added;
+    // The key of the row before, whether or not it was added. Rows without a first name have no key and are skipped
+    std::string_view previous_key;
+    for (std::size_t row : order){
+        if (keys[row].empty()){
+            report.rejected_rows.push_back({row_numbers[row], "missing first name"});
+            continue;
+        }
+        if (previous_key == keys[row]){
+            report.rejected_rows.push_back({row_numbers[row], "name appears more than once"});
+            continue;
+        }
+        previous_key = keys[row];
+        auto position = this->address_book_list.lower_bound(keyFields(keys[row]));
+        if (position != this->address_book_list.end()
+        && this->entry_table.key(*position).compare(EntryTable::Key{keys[row], std::string_view()}) == 0){
+            report.rejected_rows.push_back({row_numbers[row], "entry already exists"});
+            continue;
+        }
+        const Entry& entry = rows[row];
+        EntryTable::Row inserted = this->entry_table.insert(entry.first_name, entry.last_name, entry.phone_number);
+        this->address_book_list.emplace_hint(position, inserted);
+        added.push_back(inserted);
+        this->journal.append(Journal::Operation::Add, entry.first_name, entry.last_name, entry.phone_number);
+        report.rows_added++;
+    }
+    try{
+        this->journal.commitBatch();
+    } catch(std::exception& ex){
+        // None of the rows reached the journal, so none of them are kept. They haven't been indexed yet
+        for (EntryTable::Row inserted : added){
+            this->address_book_list.erase(inserted);
+        }
+        for (EntryTable::Row inserted : added){
+            this->entry_table.erase(inserted);
+        }
+        throw;
+    }
+    this->indexEntries(added);
+
+    std::sort(report.rejected_rows.begin(), report.rejected_rows.end(),
+              [](const ImportReport::RejectedRow& a, const ImportReport::RejectedRow& b){
+                  return a.row_number < b.row_number;
+              });
+}
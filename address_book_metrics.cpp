@@ -0,0 +1,194 @@
+#include "include/address_book_metrics.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+// Each power of two is split into 1 << sub_bucket_bits buckets
+const unsigned sub_bucket_bits = 3;
+const std::uint64_t sub_bucket_count = 1 << sub_bucket_bits;
+
+unsigned highestBit(std::uint64_t value)
+{
+    return 63 - static_cast<unsigned>(__builtin_clzll(value));
+}
+
+std::string formatDouble(double value)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.1f", value);
+    return text;
+}
+
+}
+
+const char* AddressBookMetrics::name(Operation operation)
+{
+    switch (operation){
+        case Operation::Add: return "add";
+        case Operation::Remove: return "remove";
+        case Operation::Alter: return "alter";
+        case Operation::Apply: return "apply";
+        case Operation::Find: return "find";
+        case Operation::FindPage: return "find_page";
+        case Operation::PageByFirstName: return "page_by_first_name";
+        case Operation::PageByLastName: return "page_by_last_name";
+        case Operation::FindFuzzy: return "find_fuzzy";
+        case Operation::FindByPhone: return "find_by_phone";
+        case Operation::Query: return "query";
+        case Operation::Suggest: return "suggest";
+        case Operation::SortedByFirstName: return "sorted_by_first_name";
+        case Operation::SortedByLastName: return "sorted_by_last_name";
+        case Operation::ListByFirstName: return "list_by_first_name";
+        case Operation::ListByLastName: return "list_by_last_name";
+        case Operation::Import: return "import";
+        case Operation::Compact: return "compact";
+        case Operation::Count: break;
+    }
+    return "";
+}
+
+const char* AddressBookMetrics::name(Counter counter)
+{
+    switch (counter){
+        case Counter::FindExactKey: return "find_exact_key";
+        case Counter::FindPrefixSearch: return "find_prefix_search";
+        case Counter::FindResults: return "find_results";
+        case Counter::SuggestCacheHits: return "suggest_cache_hits";
+        case Counter::RowsImported: return "rows_imported";
+        case Counter::RowsRejected: return "rows_rejected";
+        case Counter::Count: break;
+    }
+    return "";
+}
+
+std::size_t AddressBookMetrics::Histogram::bucketOf(std::uint64_t value)
+{
+    if (value < sub_bucket_count){
+        return static_cast<std::size_t>(value);
+    }
+    // The top bit picks the power of two and the sub_bucket_bits below it pick the bucket within it
+    unsigned top = highestBit(value);
+    std::uint64_t sub_bucket = (value >> (top - sub_bucket_bits)) & (sub_bucket_count - 1);
+    return static_cast<std::size_t>((top - sub_bucket_bits + 1) * sub_bucket_count + sub_bucket);
+}
+
+std::uint64_t AddressBookMetrics::Histogram::bucketUpperBound(std::size_t bucket)
+{
+    if (bucket < sub_bucket_count){
+        return bucket;
+    }
+    unsigned shift = static_cast<unsigned>(bucket / sub_bucket_count - 1);
+    std::uint64_t lower = (sub_bucket_count + bucket % sub_bucket_count) << shift;
+    return lower + ((std::uint64_t(1) << shift) - 1);
+}
+
+void AddressBookMetrics::Histogram::record(std::uint64_t nanoseconds)
+{
+    this->buckets[bucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    this->recorded.fetch_add(1, std::memory_order_relaxed);
+    this->total.fetch_add(nanoseconds, std::memory_order_relaxed);
+    std::uint64_t current = this->maximum.load(std::memory_order_relaxed);
+    while (nanoseconds > current && !this->maximum.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed)){
+    }
+}
+
+std::uint64_t AddressBookMetrics::Histogram::count() const
+{
+    return this->recorded.load(std::memory_order_relaxed);
+}
+
+std::uint64_t AddressBookMetrics::Histogram::totalNanoseconds() const
+{
+    return this->total.load(std::memory_order_relaxed);
+}
+
+std::uint64_t AddressBookMetrics::Histogram::maxNanoseconds() const
+{
+    return this->maximum.load(std::memory_order_relaxed);
+}
+
+std::uint64_t AddressBookMetrics::Histogram::percentile(double fraction) const
+{
+    // The buckets are read one at a time while other threads may still be recording,
+    // so the count is taken from the buckets themselves rather than from recorded
+    std::uint64_t counts[bucket_count];
+    std::uint64_t total_count = 0;
+    for (std::size_t i = 0 ; i<bucket_count ; i++){
+        counts[i] = this->buckets[i].load(std::memory_order_relaxed);
+        total_count += counts[i];
+    }
+    if (total_count == 0){
+        return 0;
+    }
+    // The top of a bucket can be above anything recorded in it, so the answer is capped at the largest time seen
+    std::uint64_t wanted = static_cast<std::uint64_t>(fraction * static_cast<double>(total_count));
+    std::uint64_t seen = 0;
+    std::size_t bucket = 0;
+    for ( ; bucket<bucket_count - 1 ; bucket++){
+        seen += counts[bucket];
+        if (seen > wanted || seen == total_count){
+            break;
+        }
+    }
+    return std::min(bucketUpperBound(bucket), this->maxNanoseconds());
+}
+
+AddressBookMetrics::ScopedTimer::ScopedTimer(const AddressBookMetrics& metrics, Operation operation)
+    : metrics(metrics), operation(operation), start(std::chrono::steady_clock::now())
+{
+}
+
+AddressBookMetrics::ScopedTimer::~ScopedTimer()
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start);
+    this->metrics.latencies[static_cast<std::size_t>(this->operation)].record(static_cast<std::uint64_t>(elapsed.count()));
+}
+
+void AddressBookMetrics::count(Counter counter, std::uint64_t amount) const
+{
+    this->counters[static_cast<std::size_t>(counter)].fetch_add(amount, std::memory_order_relaxed);
+}
+
+std::string MetricsReport::toText() const
+{
+    std::string text;
+    for (const OperationStats& i : this->operations){
+        text += i.name + " calls " + std::to_string(i.calls) + " mean_ns " + formatDouble(i.mean_ns) +
+                " p50_ns " + std::to_string(i.p50_ns) + " p90_ns " + std::to_string(i.p90_ns) +
+                " p99_ns " + std::to_string(i.p99_ns) + " max_ns " + std::to_string(i.max_ns) + "\n";
+    }
+    for (const auto& i : this->counters){
+        text += i.first + " " + std::to_string(i.second) + "\n";
+    }
+    text += "entries " + std::to_string(this->entries) + "\n";
+    text += "approximate_bytes " + std::to_string(this->approximate_bytes) + "\n";
+    if (!this->enabled){
+        text += "(operations are not counted or timed, as this build does not define ADDRESS_BOOK_METRICS)\n";
+    }
+    return text;
+}
+
+std::string MetricsReport::toJson() const
+{
+    // Every name is a fixed identifier, so nothing needs escaping
+    std::string json = "{\"enabled\": ";
+    json += this->enabled ? "true" : "false";
+    json += ", \"operations\": [";
+    for (std::size_t i = 0 ; i<this->operations.size() ; i++){
+        const OperationStats& stats = this->operations[i];
+        json += (i == 0 ? "" : ", ");
+        json += "{\"name\": \"" + stats.name + "\", \"calls\": " + std::to_string(stats.calls) +
+                ", \"mean_ns\": " + formatDouble(stats.mean_ns) + ", \"p50_ns\": " + std::to_string(stats.p50_ns) +
+                ", \"p90_ns\": " + std::to_string(stats.p90_ns) + ", \"p99_ns\": " + std::to_string(stats.p99_ns) +
+                ", \"max_ns\": " + std::to_string(stats.max_ns) + "}";
+    }
+    json += "], \"counters\": {";
+    for (std::size_t i = 0 ; i<this->counters.size() ; i++){
+        json += (i == 0 ? "" : ", ");
+        json += "\"" + this->counters[i].first + "\": " + std::to_string(this->counters[i].second);
+    }
+    json += "}, \"entries\": " + std::to_string(this->entries) +
+            ", \"approximate_bytes\": " + std::to_string(this->approximate_bytes) + "}";
+    return json;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Usage statistics for an address book: how often each operation runs, how long it takes,
+/// how find calls are answered, and how big the book is.
+///
+/// Counting and timing are only compiled in when ADDRESS_BOOK_METRICS is defined (e.g. -DADDRESS_BOOK_METRICS),
+/// and it must be defined the same way for every file in the build. Without it, the ADDRESS_BOOK_TIME and
+/// ADDRESS_BOOK_COUNT macros expand to nothing, so the operations pay nothing for them,
+/// and a report only holds the size of the book.
+
+/// What is counted and timed
+struct AddressBookMetrics
+{
+    /// The operations that are timed
+    enum class Operation
+    {
+        Add,
+        Remove,
+        Alter,
+        Apply,
+        Find,
+        FindPage,
+        PageByFirstName,
+        PageByLastName,
+        FindFuzzy,
+        FindByPhone,
+        Query,
+        Suggest,
+        SortedByFirstName,
+        SortedByLastName,
+        ListByFirstName,
+        ListByLastName,
+        Import,
+        Compact,
+        Count
+    };
+
+    /// Things that are counted rather than timed
+    enum class Counter
+    {
+        /// find calls answered straight from the exact key of an entry
+        FindExactKey,
+        /// find calls answered by searching the prefix indexes
+        FindPrefixSearch,
+        /// Entries returned by find calls
+        FindResults,
+        /// suggest calls answered from its cache
+        SuggestCacheHits,
+        /// Rows added by importFile and addBatch
+        RowsImported,
+        /// Rows rejected by importFile and addBatch
+        RowsRejected,
+        Count
+    };
+
+    static const char* name(Operation);
+    static const char* name(Counter);
+
+    /// A latency histogram with the same layout as an HDR histogram with 3 bits of precision.
+    /// Values under 8 ns get a bucket each, and every power of two above that is split into 8 buckets,
+    /// so a recorded time is never more than 12.5% away from the bucket it lands in, from nanoseconds up to centuries.
+    /// Recording is a few relaxed atomic additions and can happen on many threads at once.
+    class Histogram
+    {
+    public:
+        static const std::size_t bucket_count = 496;
+
+        void record(std::uint64_t nanoseconds);
+
+        std::uint64_t count() const;
+        std::uint64_t totalNanoseconds() const;
+        std::uint64_t maxNanoseconds() const;
+
+        /// The upper end of the bucket holding the given fraction of recorded values, e.g. 0.99 for the 99th percentile
+        std::uint64_t percentile(double fraction) const;
+
+        static std::size_t bucketOf(std::uint64_t value);
+        static std::uint64_t bucketUpperBound(std::size_t bucket);
+
+    private:
+        std::atomic<std::uint64_t> buckets[bucket_count] = {};
+        std::atomic<std::uint64_t> recorded{0};
+        std::atomic<std::uint64_t> total{0};
+        std::atomic<std::uint64_t> maximum{0};
+    };
+
+    /// Times the rest of the enclosing scope and records it under an operation
+    class ScopedTimer
+    {
+    public:
+        ScopedTimer(const AddressBookMetrics& metrics, Operation operation);
+        ~ScopedTimer();
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        const AddressBookMetrics& metrics;
+        Operation operation;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    void count(Counter counter, std::uint64_t amount = 1) const;
+
+    // Const member functions (find, the listings) are counted and timed too, so everything here is mutable
+    mutable Histogram latencies[static_cast<std::size_t>(Operation::Count)];
+    mutable std::atomic<std::uint64_t> counters[static_cast<std::size_t>(Counter::Count)] = {};
+};
+
+/// A copy of the statistics at one moment, from AddressBook::metrics
+struct MetricsReport
+{
+    struct OperationStats
+    {
+        std::string name;
+        std::uint64_t calls = 0;
+        double mean_ns = 0;
+        std::uint64_t p50_ns = 0;
+        std::uint64_t p90_ns = 0;
+        std::uint64_t p99_ns = 0;
+        std::uint64_t max_ns = 0;
+    };
+
+    /// Whether the build counts and times operations. If not, only the gauges are filled in.
+    bool enabled = false;
+    std::vector<OperationStats> operations;
+    std::vector<std::pair<std::string,std::uint64_t>> counters;
+
+    // Gauges
+    std::size_t entries = 0;
+    /// An estimate of the heap memory held by the entries, the indexes, and suggest's trie, use counts and cache.
+    /// It adds up what each container holds and the pointers it keeps beside each element, but not what the allocator
+    /// adds to each allocation, so the real figure is somewhat higher
+    std::size_t approximate_bytes = 0;
+
+    /// Lines of "name value" pairs, one line per operation, counter and gauge
+    std::string toText() const;
+    std::string toJson() const;
+};
+
+#if defined(ADDRESS_BOOK_METRICS)
+#define ADDRESS_BOOK_METRICS_JOIN_(a, b) a##b
+#define ADDRESS_BOOK_METRICS_JOIN(a, b) ADDRESS_BOOK_METRICS_JOIN_(a, b)
+/// Time the rest of the enclosing scope as the given AddressBookMetrics::Operation
+#define ADDRESS_BOOK_TIME(operation) \
+    AddressBookMetrics::ScopedTimer ADDRESS_BOOK_METRICS_JOIN(address_book_timer_, __LINE__)( \
+        this->usage, AddressBookMetrics::Operation::operation)
+/// Add to the given AddressBookMetrics::Counter (by 1 if no amount is given)
+#define ADDRESS_BOOK_COUNT(...) this->usage.count(AddressBookMetrics::Counter::__VA_ARGS__)
+#else
+#define ADDRESS_BOOK_TIME(operation) static_cast<void>(0)
+#define ADDRESS_BOOK_COUNT(...) static_cast<void>(0)
+#endif
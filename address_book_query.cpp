@@ -0,0 +1,267 @@
+#include "include/address_book.h"
+#include "include/name_normalization.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+using Row = EntryTable::Row;
+using PostingList = std::vector<Row>;
+
+const std::size_t uncounted = std::numeric_limits<std::size_t>::max();
+
+// Keeps only the candidates that are also in list. Both must be sorted by row.
+void intersectWith(PostingList& candidates, const PostingList& list)
+{
+    std::size_t kept = 0;
+    if (list.size() / 16 > candidates.size()){
+        // The list is far longer, so rather than walk all of it, each candidate is found by galloping:
+        // steps that double in size from where the last candidate was found, and then a binary search
+        // within the last step. That costs about c log(l / c) comparisons for c candidates and a list of length l
+        auto low = list.begin();
+        for (Row candidate : candidates){
+            std::size_t remaining = static_cast<std::size_t>(list.end() - low);
+            std::size_t step = 1;
+            while (step <= remaining && low[static_cast<std::ptrdiff_t>(step - 1)] < candidate){
+                step *= 2;
+            }
+            low = std::lower_bound(low + static_cast<std::ptrdiff_t>(step / 2),
+                                   low + static_cast<std::ptrdiff_t>(std::min(step, remaining)),
+                                   candidate);
+            if (low == list.end()){
+                break;
+            }
+            if (*low == candidate){
+                candidates[kept++] = candidate;
+            }
+        }
+    } else{
+        // Lists of similar length are merged. Every step moves one or both sides on and stores the candidate
+        // whether or not it matched, only counting it if it did, so the loop has no branches that depend on the data.
+        // Rows in a list are distinct and the output never gets ahead of the input, so it's written over candidates
+        std::size_t i = 0;
+        std::size_t j = 0;
+        while (i < candidates.size() && j < list.size()){
+            Row candidate = candidates[i];
+            Row listed = list[j];
+            candidates[kept] = candidates[i];
+            kept += candidate == listed;
+            i += candidate <= listed;
+            j += listed <= candidate;
+        }
+    }
+    candidates.resize(kept);
+}
+
+// Whether text is value, or starts with value if prefix is set
+bool fieldMatches(std::string_view text, const std::string& value, bool prefix)
+{
+    return prefix ? text.compare(0, value.size(), value) == 0 : text == value;
+}
+
+// The same for the digits of the phone number in a row, read from the table without unpacking the number
+bool phoneDigitsMatch(const EntryTable& table, Row row, const std::string& digits, bool prefix)
+{
+    return prefix ? table.phoneDigitsStartWith(row, digits) : table.comparePhoneDigits(row, digits) == 0;
+}
+
+}
+
+AddressBook::Query& AddressBook::Query::firstNameIs(const std::string& name)
+{
+    this->conditions.push_back({Condition::Field::FirstName, false, collationKey(removeWhitespace(name))});
+    return *this;
+}
+
+AddressBook::Query& AddressBook::Query::firstNameStartsWith(const std::string& prefix)
+{
+    this->conditions.push_back({Condition::Field::FirstName, true, collationKey(removeWhitespace(prefix))});
+    return *this;
+}
+
+AddressBook::Query& AddressBook::Query::lastNameIs(const std::string& name)
+{
+    this->conditions.push_back({Condition::Field::LastName, false, collationKey(removeWhitespace(name))});
+    return *this;
+}
+
+AddressBook::Query& AddressBook::Query::lastNameStartsWith(const std::string& prefix)
+{
+    this->conditions.push_back({Condition::Field::LastName, true, collationKey(removeWhitespace(prefix))});
+    return *this;
+}
+
+AddressBook::Query& AddressBook::Query::phoneNumberIs(const std::string& number)
+{
+    this->conditions.push_back({Condition::Field::PhoneNumber, false, phoneNumberDigits(number)});
+    return *this;
+}
+
+AddressBook::Query& AddressBook::Query::phoneNumberStartsWith(const std::string& prefix)
+{
+    this->conditions.push_back({Condition::Field::PhoneNumber, true, phoneNumberDigits(prefix)});
+    return *this;
+}
+
+std::size_t AddressBook::Query::size() const
+{
+    return this->conditions.size();
+}
+
+bool AddressBook::Query::empty() const
+{
+    return this->conditions.empty();
+}
+
+std::map<std::string,AddressBook::Entry> AddressBook::query(const Query& query) const
+{
+    ADDRESS_BOOK_TIME(Query);
+    this->waitForIndexes();
+    std::map<std::string,Entry> matches_map;
+    // Conditions that every entry meets, such as a name starting with "", are left out.
+    // The rest are put in the order they are cheapest to count in: an exact name is one lookup,
+    // a name prefix is a walk over the distinct names it covers, and a phone number is a walk over the entries it covers
+    std::vector<const Query::Condition*> conditions;
+    for (const Query::Condition& condition : query.conditions){
+        if (!(condition.prefix && condition.value.empty())){
+            conditions.push_back(&condition);
+        }
+    }
+    auto cost = [](const Query::Condition* condition){
+        if (condition->field == Query::Condition::Field::PhoneNumber){
+            return 2;
+        }
+        return condition->prefix ? 1 : 0;
+    };
+    std::stable_sort(conditions.begin(), conditions.end(),
+                     [&cost](const Query::Condition* a, const Query::Condition* b){ return cost(a) < cost(b); });
+    // The narrowest condition picks the candidates. Counting a condition stops as soon as it matches as many
+    // entries as the narrowest one so far, so the counting costs no more than the narrowest condition does
+    const Query::Condition* narrowest = nullptr;
+    std::size_t fewest = uncounted;
+    for (const Query::Condition* condition : conditions){
+        std::size_t count = this->countMatches(*condition, fewest);
+        if (count < fewest){
+            fewest = count;
+            narrowest = condition;
+        }
+        if (fewest == 0){
+            return matches_map;
+        }
+    }
+    PostingList candidates;
+    if (narrowest != nullptr){
+        candidates = this->collectMatches(*narrowest);
+    } else{
+        // None of the conditions can be looked up, so every entry is a candidate
+        candidates.assign(this->address_book_list.begin(), this->address_book_list.end());
+        std::sort(candidates.begin(), candidates.end());
+    }
+    // Exact names have a posting list to intersect with. The other conditions are checked on each remaining candidate,
+    // which by then are few
+    for (const Query::Condition* condition : conditions){
+        if (condition == narrowest || condition->prefix || condition->field == Query::Condition::Field::PhoneNumber){
+            continue;
+        }
+        const auto& postings = condition->field == Query::Condition::Field::FirstName ? this->first_name_postings
+                                                                                      : this->last_name_postings;
+        auto term = postings.find(condition->value);
+        if (term == postings.end()){
+            return matches_map;
+        }
+        intersectWith(candidates, term->second);
+    }
+    for (const Query::Condition* condition : conditions){
+        if (condition == narrowest || !(condition->prefix || condition->field == Query::Condition::Field::PhoneNumber)){
+            continue;
+        }
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [this, condition](Row row){
+                             return !this->meetsCondition(row, *condition);
+                         }), candidates.end());
+    }
+    for (Row row : candidates){
+        matches_map.emplace(this->keyOf(row), this->entryAt(row));
+    }
+    return matches_map;
+}
+
+std::size_t AddressBook::countMatches(const Query::Condition& condition, std::size_t give_up_at) const
+{
+    std::size_t count = 0;
+    if (condition.field == Query::Condition::Field::PhoneNumber){
+        // Numbers without any digits aren't indexed
+        if (condition.value.empty()){
+            return uncounted;
+        }
+        for (auto it = this->phone_number_index.lower_bound(std::string_view(condition.value));
+             it != this->phone_number_index.end() && phoneDigitsMatch(this->entry_table, *it, condition.value, condition.prefix);
+             ++it){
+            if (++count >= give_up_at){
+                return uncounted;
+            }
+        }
+        return count;
+    }
+    const auto& postings = condition.field == Query::Condition::Field::FirstName ? this->first_name_postings
+                                                                                 : this->last_name_postings;
+    if (!condition.prefix){
+        auto term = postings.find(condition.value);
+        return term == postings.end() ? 0 : term->second.size();
+    }
+    for (auto term = postings.lower_bound(condition.value);
+         term != postings.end() && fieldMatches(term->first, condition.value, true);
+         ++term){
+        count += term->second.size();
+        if (count >= give_up_at){
+            return uncounted;
+        }
+    }
+    return count;
+}
+
+AddressBook::PostingList AddressBook::collectMatches(const Query::Condition& condition) const
+{
+    PostingList matches;
+    if (condition.field == Query::Condition::Field::PhoneNumber){
+        for (auto it = this->phone_number_index.lower_bound(std::string_view(condition.value));
+             it != this->phone_number_index.end() && phoneDigitsMatch(this->entry_table, *it, condition.value, condition.prefix);
+             ++it){
+            matches.push_back(*it);
+        }
+        std::sort(matches.begin(), matches.end());
+        return matches;
+    }
+    const auto& postings = condition.field == Query::Condition::Field::FirstName ? this->first_name_postings
+                                                                                 : this->last_name_postings;
+    if (!condition.prefix){
+        auto term = postings.find(condition.value);
+        if (term != postings.end()){
+            matches = term->second;
+        }
+        return matches;
+    }
+    // An entry has one first and one last name, so the lists of different names never share an entry
+    // and their union is just the lists put together and sorted
+    for (auto term = postings.lower_bound(condition.value);
+         term != postings.end() && fieldMatches(term->first, condition.value, true);
+         ++term){
+        matches.insert(matches.end(), term->second.begin(), term->second.end());
+    }
+    std::sort(matches.begin(), matches.end());
+    return matches;
+}
+
+bool AddressBook::meetsCondition(Row row, const Query::Condition& condition) const
+{
+    // The table holds the collation keys of the names and reads the digits straight from the packed phone number,
+    // so nothing is worked out again for each candidate
+    switch (condition.field){
+        case Query::Condition::Field::FirstName:
+            return fieldMatches(this->entry_table.foldedFirstName(row), condition.value, condition.prefix);
+        case Query::Condition::Field::LastName:
+            return fieldMatches(this->entry_table.foldedLastName(row), condition.value, condition.prefix);
+        case Query::Condition::Field::PhoneNumber:
+            return phoneDigitsMatch(this->entry_table, row, condition.value, condition.prefix);
+    }
+    return false;
+}
@@ -0,0 +1,174 @@
+#include "include/address_book.h"
+#include <stdexcept>
+
+namespace {
+
+// How many times catchUp reads the primary's journals before giving up on a primary that keeps rotating them
+const int catch_up_attempts = 3;
+
+AddressBook::Entry toEntry(const SnapshotFile::EntryFields& fields)
+{
+    AddressBook::Entry entry;
+    entry.first_name = std::string(fields.first_name);
+    entry.last_name = std::string(fields.last_name);
+    entry.phone_number = std::string(fields.phone_number);
+    return entry;
+}
+
+// Builds an entry's key into key, reusing its buffer rather than making a new string for every entry
+void setKey(const SnapshotFile::EntryFields& fields, std::string& key)
+{
+    key.assign(fields.first_name.data(), fields.first_name.size());
+    if (!fields.last_name.empty()){
+        key += ' ';
+        key.append(fields.last_name.data(), fields.last_name.size());
+    }
+}
+
+// Walks two lists of entries in key order side by side, as a merge does, and collects how they differ.
+// next_older and next_newer fill in the next entry of their list and return false once there are no more
+template <typename NextOlder, typename NextNewer>
+AddressBook::Diff diffInKeyOrder(NextOlder next_older, NextNewer next_newer)
+{
+    AddressBook::Diff difference;
+    SnapshotFile::EntryFields older;
+    SnapshotFile::EntryFields newer;
+    std::string older_key;
+    std::string newer_key;
+    bool has_older = next_older(older);
+    bool has_newer = next_newer(newer);
+    if (has_older){
+        setKey(older, older_key);
+    }
+    if (has_newer){
+        setKey(newer, newer_key);
+    }
+    while (has_older || has_newer){
+        int order = !has_older ? 1 : !has_newer ? -1 : older_key.compare(newer_key);
+        if (order > 0){
+            difference.added.push_back(toEntry(newer));
+        } else if (order < 0){
+            difference.removed.push_back(toEntry(older));
+        } else if (older.phone_number != newer.phone_number){
+            difference.changed.push_back(toEntry(newer));
+        }
+        if (order <= 0 && (has_older = next_older(older))){
+            setKey(older, older_key);
+        }
+        if (order >= 0 && (has_newer = next_newer(newer))){
+            setKey(newer, newer_key);
+        }
+    }
+    return difference;
+}
+
+// Returns a function that hands out the entries of an address book in key order, for diffInKeyOrder
+auto entriesOf(const AddressBook& book)
+{
+    AddressBook::KeyOrderView entries = book.entriesByKey();
+    return [next = entries.begin(), end = entries.end()](SnapshotFile::EntryFields& fields) mutable {
+        if (next == end){
+            return false;
+        }
+        fields = {next->first_name, next->last_name, next->phone_number};
+        ++next;
+        return true;
+    };
+}
+
+// The same for a snapshot, whose records are already in key order
+auto entriesOf(const SnapshotFile& snapshot)
+{
+    return [&snapshot, next = std::size_t(0)](SnapshotFile::EntryFields& fields) mutable {
+        if (next == snapshot.size()){
+            return false;
+        }
+        fields = {snapshot.firstName(next), snapshot.lastName(next), snapshot.phoneNumber(next)};
+        ++next;
+        return true;
+    };
+}
+
+}
+
+bool AddressBook::Diff::empty() const
+{
+    return this->added.empty() && this->removed.empty() && this->changed.empty();
+}
+
+std::uint64_t AddressBook::sequence() const
+{
+    return this->journal.lastSequence();
+}
+
+std::size_t AddressBook::catchUp(const std::string& primary_path)
+{
+    this->waitForIndexes();
+    std::string journal_path = primary_path + ".journal";
+    std::size_t changes_made = 0;
+    auto apply = [this, &changes_made](const Journal::Change& change){
+        this->applyChange(change);
+        changes_made++;
+    };
+    // A new replica starts from the primary's snapshot rather than from every change the primary has ever made
+    if (this->sequence() == 0){
+        changes_made += this->levelWithSnapshot(primary_path);
+    }
+    for (int attempt = 0 ; attempt<catch_up_attempts ; attempt++){
+        if (Journal::readChanges(journal_path, this->sequence(), apply)){
+            return changes_made;
+        }
+        // The first time, the primary may just have rotated its journal while it was being read, and reading again is enough.
+        // If that fails too, the changes this book needs next have been discarded, so it starts again from the snapshot
+        if (attempt == 1){
+            changes_made += this->levelWithSnapshot(primary_path);
+        }
+    }
+    throw std::runtime_error("Could not catch up with " + primary_path + " as it kept changing while it was being read");
+}
+
+void AddressBook::discardChanges(std::uint64_t up_to_sequence)
+{
+    if (this->storage_path.empty()){
+        return;
+    }
+    Journal::discardSegments(this->storage_path + ".journal", up_to_sequence);
+}
+
+AddressBook::Diff AddressBook::diff(const AddressBook& newer) const
+{
+    return diffInKeyOrder(entriesOf(*this), entriesOf(newer));
+}
+
+AddressBook::Diff AddressBook::diffSnapshots(const std::string& older_path, const std::string& newer_path)
+{
+    // A snapshot that doesn't exist is read as an empty book
+    SnapshotFile older;
+    SnapshotFile newer;
+    older.open(older_path);
+    newer.open(newer_path);
+    return diffInKeyOrder(entriesOf(older), entriesOf(newer));
+}
+
+std::size_t AddressBook::levelWithSnapshot(const std::string& path)
+{
+    SnapshotFile snapshot;
+    snapshot.open(path);
+    Diff difference = diffInKeyOrder(entriesOf(*this), entriesOf(snapshot));
+    // The changes reach this book's own journal, if it has one, in a single write
+    this->journal.beginBatch();
+    for (const Entry& entry : difference.removed){
+        this->eraseEntry(*this->findKey(makeKey(entry.first_name, entry.last_name)));
+    }
+    for (const Entry& entry : difference.changed){
+        this->setPhoneNumber(*this->findKey(makeKey(entry.first_name, entry.last_name)), entry.phone_number);
+    }
+    for (const Entry& entry : difference.added){
+        this->insertEntry(entry);
+    }
+    this->journal.commitBatch();
+    this->journal.setLastSequence(snapshot.sequence());
+    // The numbers in this book's journal no longer follow on from one another, so it is folded into a snapshot
+    this->compact();
+    return difference.removed.size() + difference.changed.size() + difference.added.size();
+}
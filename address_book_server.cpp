@@ -0,0 +1,516 @@
+#include "include/address_book_server.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+const std::size_t default_limit = 100;
+// Suggestions fill a drop down list under a search box, so fewer are sent by default
+const std::size_t default_suggestions = 10;
+const std::size_t maximum_limit = 10000;
+const std::size_t maximum_conditions = 16;
+// A client that sends this much without a line break is not speaking the protocol
+const std::size_t maximum_request_length = 64 * 1024;
+const int events_per_wait = 256;
+// How long the server waits before accepting again after accept fails, doubling while it keeps failing
+const std::chrono::milliseconds first_accept_retry(100);
+const std::chrono::milliseconds last_accept_retry(5000);
+
+std::runtime_error socketError(const std::string& what)
+{
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+// Splits a line at its tabs into at most field_count fields. The last field holds the rest of the line
+std::vector<std::string_view> splitFields(std::string_view line, std::size_t field_count)
+{
+    std::vector<std::string_view> fields;
+    while (fields.size() + 1 < field_count){
+        std::size_t tab = line.find('\t');
+        if (tab == std::string_view::npos){
+            break;
+        }
+        fields.push_back(line.substr(0, tab));
+        line.remove_prefix(tab + 1);
+    }
+    fields.push_back(line);
+    return fields;
+}
+
+std::size_t parseLimit(const std::vector<std::string_view>& fields, std::size_t position,
+                       std::size_t default_value = default_limit)
+{
+    if (fields.size() <= position || fields[position].empty()){
+        return default_value;
+    }
+    std::string_view text = fields[position];
+    std::size_t limit = 0;
+    auto parsed = std::from_chars(text.data(), text.data() + text.size(), limit);
+    if (parsed.ec != std::errc() || parsed.ptr != text.data() + text.size() || limit == 0 || limit > maximum_limit){
+        throw std::invalid_argument("The limit must be a number from 1 to " + std::to_string(maximum_limit));
+    }
+    return limit;
+}
+
+// Appends a field of a reply. Tabs and line breaks would split the field or the reply,
+// so they are sent as \t, \n and \r, and a backslash is doubled
+void appendField(std::string_view field, std::string& reply)
+{
+    for (char c : field){
+        switch (c){
+            case '\\': reply += "\\\\"; break;
+            case '\t': reply += "\\t"; break;
+            case '\n': reply += "\\n"; break;
+            case '\r': reply += "\\r"; break;
+            default: reply += c; break;
+        }
+    }
+}
+
+void appendEntry(const AddressBook::Entry& entry, std::string& reply)
+{
+    appendField(entry.first_name, reply);
+    reply += '\t';
+    appendField(entry.last_name, reply);
+    reply += '\t';
+    appendField(entry.phone_number, reply);
+    reply += '\n';
+}
+
+void appendPage(const AddressBook::Page& page, std::string& reply)
+{
+    reply += "OK ";
+    reply += std::to_string(page.entries.size());
+    if (!page.resume_token.empty()){
+        reply += '\t';
+        reply += page.resume_token;
+    }
+    reply += '\n';
+    for (const AddressBook::Entry& entry : page.entries){
+        appendEntry(entry, reply);
+    }
+}
+
+// Adds a QUERY condition such as "first^jo" or "phone=01632960001" to the query
+void addCondition(std::string_view condition, AddressBook::Query& query)
+{
+    std::size_t operator_position = condition.find_first_of("=^");
+    if (operator_position == std::string_view::npos){
+        throw std::invalid_argument("A condition is a field, = or ^, and a value");
+    }
+    std::string_view field = condition.substr(0, operator_position);
+    bool prefix = condition[operator_position] == '^';
+    std::string value(condition.substr(operator_position + 1));
+    if (field == "first"){
+        prefix ? query.firstNameStartsWith(value) : query.firstNameIs(value);
+    } else if (field == "last"){
+        prefix ? query.lastNameStartsWith(value) : query.lastNameIs(value);
+    } else if (field == "phone"){
+        prefix ? query.phoneNumberStartsWith(value) : query.phoneNumberIs(value);
+    } else{
+        throw std::invalid_argument("The fields are first, last and phone");
+    }
+}
+
+void watch(int event_loop, int socket, std::uint32_t events, int operation)
+{
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = socket;
+    if (epoll_ctl(event_loop, operation, socket, &event) != 0){
+        throw socketError("Could not watch a socket");
+    }
+}
+
+}
+
+AddressBookServer::AddressBookServer(AddressBook& address_book, const std::string& address)
+    : address_book(address_book)
+{
+    try{
+        if (address.compare(0, 5, "unix:") == 0){
+            this->unix_socket_path = address.substr(5);
+            sockaddr_un socket_address{};
+            socket_address.sun_family = AF_UNIX;
+            if (this->unix_socket_path.empty() || this->unix_socket_path.size() >= sizeof(socket_address.sun_path)){
+                throw std::runtime_error("Not a usable socket path: " + this->unix_socket_path);
+            }
+            std::memcpy(socket_address.sun_path, this->unix_socket_path.c_str(), this->unix_socket_path.size() + 1);
+            // A socket left behind by a server that didn't shut down cleanly is replaced. Anything else at the path is kept
+            struct stat existing;
+            if (lstat(this->unix_socket_path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)){
+                unlink(this->unix_socket_path.c_str());
+            }
+            this->listening_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (this->listening_socket < 0){
+                throw socketError("Could not create a socket");
+            }
+            if (bind(this->listening_socket, reinterpret_cast<const sockaddr*>(&socket_address), sizeof(socket_address)) != 0){
+                std::string path = this->unix_socket_path;
+                // The path isn't ours, so it must not be removed
+                this->unix_socket_path.clear();
+                throw socketError("Could not listen on " + path);
+            }
+        } else{
+            std::size_t colon = address.rfind(':');
+            std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+            std::string port = colon == std::string::npos ? address : address.substr(colon + 1);
+            // An IPv6 address is written in brackets, as in [::1]:7000
+            if (host.size() >= 2 && host.front() == '[' && host.back() == ']'){
+                host = host.substr(1, host.size() - 2);
+            }
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = AI_PASSIVE;
+            addrinfo* found = nullptr;
+            int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found);
+            if (error != 0){
+                throw std::runtime_error("Could not find " + address + ": " + gai_strerror(error));
+            }
+            std::unique_ptr<addrinfo, void (*)(addrinfo*)> addresses(found, freeaddrinfo);
+            this->listening_socket = socket(found->ai_family, found->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                            found->ai_protocol);
+            if (this->listening_socket < 0){
+                throw socketError("Could not create a socket");
+            }
+            int enable = 1;
+            setsockopt(this->listening_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+            if (bind(this->listening_socket, found->ai_addr, found->ai_addrlen) != 0){
+                throw socketError("Could not listen on " + address);
+            }
+        }
+        if (listen(this->listening_socket, SOMAXCONN) != 0){
+            throw socketError("Could not listen on " + address);
+        }
+        this->event_loop = epoll_create1(EPOLL_CLOEXEC);
+        this->stop_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (this->event_loop < 0 || this->stop_event < 0){
+            throw socketError("Could not start the event loop");
+        }
+        watch(this->event_loop, this->listening_socket, EPOLLIN, EPOLL_CTL_ADD);
+        watch(this->event_loop, this->stop_event, EPOLLIN, EPOLL_CTL_ADD);
+    } catch(std::exception& ex){
+        this->release();
+        throw;
+    }
+}
+
+AddressBookServer::~AddressBookServer()
+{
+    this->release();
+}
+
+void AddressBookServer::release()
+{
+    for (auto& i : this->connections){
+        close(i.first);
+    }
+    this->connections.clear();
+    for (int* descriptor : {&this->listening_socket, &this->event_loop, &this->stop_event}){
+        if (*descriptor >= 0){
+            close(*descriptor);
+            *descriptor = -1;
+        }
+    }
+    if (!this->unix_socket_path.empty()){
+        unlink(this->unix_socket_path.c_str());
+        this->unix_socket_path.clear();
+    }
+}
+
+void AddressBookServer::run()
+{
+    epoll_event events[events_per_wait];
+    bool stopping = false;
+    while (!stopping){
+        // While accepting is held back after an error, the wait ends in time to start again
+        int timeout = -1;
+        if (this->accepting_paused){
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                this->resume_accepting_at - std::chrono::steady_clock::now());
+            timeout = static_cast<int>(std::max<std::chrono::milliseconds::rep>(0, remaining.count() + 1));
+        }
+        int count = epoll_wait(this->event_loop, events, events_per_wait, timeout);
+        if (count < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            throw socketError("Could not wait for requests");
+        }
+        if (this->accepting_paused && std::chrono::steady_clock::now() >= this->resume_accepting_at){
+            this->resumeAccepting();
+        }
+        for (int i = 0 ; i<count ; i++){
+            int socket = events[i].data.fd;
+            if (socket == this->stop_event){
+                std::uint64_t signalled;
+                ssize_t ignored = read(this->stop_event, &signalled, sizeof(signalled));
+                static_cast<void>(ignored);
+                stopping = true;
+                continue;
+            }
+            if (socket == this->listening_socket){
+                this->acceptConnections();
+                continue;
+            }
+            // The connection may have been closed while handling an earlier event from the same wait
+            auto found = this->connections.find(socket);
+            if (found == this->connections.end()){
+                continue;
+            }
+            Connection& connection = *found->second;
+            if (connection.waiting_to_write){
+                if (!this->writeReplies(connection) || (connection.finished_reading && !connection.waiting_to_write)){
+                    this->closeConnection(connection);
+                }
+            } else{
+                this->readRequests(connection);
+            }
+        }
+    }
+}
+
+void AddressBookServer::stop()
+{
+    // Only a write, so it is safe in a signal handler
+    std::uint64_t one = 1;
+    ssize_t ignored = write(this->stop_event, &one, sizeof(one));
+    static_cast<void>(ignored);
+}
+
+void AddressBookServer::acceptConnections()
+{
+    while (true){
+        int socket = accept4(this->listening_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socket < 0){
+            if (errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                return;
+            }
+            // The listening socket stays readable while the connection waiting on it can't be accepted,
+            // so it is taken out of the loop, which would otherwise wake for it again straight away.
+            // The error is logged and accepting starts again after a wait that doubles while it keeps failing,
+            // or sooner if a connection closes, which is what running out of file descriptors usually needs
+            int error = errno;
+            epoll_ctl(this->event_loop, EPOLL_CTL_DEL, this->listening_socket, nullptr);
+            this->accepting_paused = true;
+            this->accept_retry = this->accept_retry.count() == 0 ? first_accept_retry
+                                                                 : std::min(2 * this->accept_retry, last_accept_retry);
+            this->resume_accepting_at = std::chrono::steady_clock::now() + this->accept_retry;
+            std::cerr << "Could not accept a connection: " << std::strerror(error) << ". Trying again in "
+                      << this->accept_retry.count() << " ms" << std::endl;
+            return;
+        }
+        this->accept_retry = std::chrono::milliseconds(0);
+        // Replies are written in one go, so there is nothing to gain from holding back small ones.
+        // This fails harmlessly on a Unix socket
+        int enable = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        auto connection = std::make_unique<Connection>();
+        connection->socket = socket;
+        watch(this->event_loop, socket, EPOLLIN, EPOLL_CTL_ADD);
+        this->connections.emplace(socket, std::move(connection));
+    }
+}
+
+void AddressBookServer::readRequests(Connection& connection)
+{
+    char buffer[64 * 1024];
+    ssize_t received = recv(connection.socket, buffer, sizeof(buffer), 0);
+    if (received < 0){
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+            this->closeConnection(connection);
+        }
+        return;
+    }
+    if (received == 0){
+        // The client has finished sending. A last request without a line break is still answered
+        if (!connection.unread.empty()){
+            this->handleRequest(connection.unread, connection.replies);
+            connection.unread.clear();
+        }
+        this->finishReading(connection);
+        return;
+    }
+    // Requests are read straight out of the buffer, and only a part line at the end is kept for next time
+    std::string_view data(buffer, static_cast<std::size_t>(received));
+    if (!connection.unread.empty()){
+        connection.unread.append(data);
+        data = connection.unread;
+    }
+    std::size_t start = 0;
+    std::size_t end;
+    while ((end = data.find('\n', start)) != std::string_view::npos){
+        this->handleRequest(data.substr(start, end - start), connection.replies);
+        start = end + 1;
+    }
+    std::string rest(data.substr(start));
+    connection.unread = std::move(rest);
+    if (connection.unread.size() > maximum_request_length){
+        connection.replies += "ERR request too long\n";
+        connection.unread.clear();
+        this->finishReading(connection);
+        return;
+    }
+    if (!this->writeReplies(connection)){
+        this->closeConnection(connection);
+    }
+}
+
+void AddressBookServer::finishReading(Connection& connection)
+{
+    // The replies may not all fit in the socket at once, so the connection is only closed here if they did.
+    // Otherwise writeReplies leaves the loop waiting to write them, and run closes it once they are all taken
+    connection.finished_reading = true;
+    if (!this->writeReplies(connection) || !connection.waiting_to_write){
+        this->closeConnection(connection);
+    }
+}
+
+bool AddressBookServer::writeReplies(Connection& connection)
+{
+    while (connection.reply_offset < connection.replies.size()){
+        ssize_t sent = send(connection.socket, connection.replies.data() + connection.reply_offset,
+                            connection.replies.size() - connection.reply_offset, MSG_NOSIGNAL);
+        if (sent < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                break;
+            }
+            return false;
+        }
+        connection.reply_offset += static_cast<std::size_t>(sent);
+    }
+    bool finished = connection.reply_offset == connection.replies.size();
+    if (finished){
+        connection.replies.clear();
+        connection.reply_offset = 0;
+    }
+    // Until the client takes its replies, the loop waits for room to write them instead of reading more requests
+    if (finished == connection.waiting_to_write){
+        connection.waiting_to_write = !finished;
+        watch(this->event_loop, connection.socket, finished ? EPOLLIN : EPOLLOUT, EPOLL_CTL_MOD);
+    }
+    return true;
+}
+
+void AddressBookServer::closeConnection(Connection& connection)
+{
+    int socket = connection.socket;
+    close(socket);
+    this->connections.erase(socket);
+    // A file descriptor is free again, so accepting can start again straight away
+    if (this->accepting_paused){
+        this->resumeAccepting();
+    }
+}
+
+void AddressBookServer::resumeAccepting()
+{
+    this->accepting_paused = false;
+    watch(this->event_loop, this->listening_socket, EPOLLIN, EPOLL_CTL_ADD);
+}
+
+void AddressBookServer::handleRequest(std::string_view line, std::string& reply)
+{
+    // Clients such as telnet end their lines with \r\n
+    if (!line.empty() && line.back() == '\r'){
+        line.remove_suffix(1);
+    }
+    std::vector<std::string_view> fields = splitFields(line, 4);
+    std::string_view command = fields[0];
+    try{
+        if (command == "ADD" && fields.size() >= 2){
+            AddressBook::AddStatus status = this->address_book.add(std::string(fields[1]),
+                                                                   std::string(fields.size() > 2 ? fields[2] : ""),
+                                                                   std::string(fields.size() > 3 ? fields[3] : ""));
+            if (status == AddressBook::AddStatus::Inserted){
+                reply += "OK\n";
+            } else if (status == AddressBook::AddStatus::Duplicate){
+                reply += "ERR entry already exists\n";
+            } else{
+                reply += "ERR missing first name\n";
+            }
+        } else if (command == "REMOVE" && fields.size() == 2){
+            reply += this->address_book.removeExact(std::string(fields[1])) ? "OK\n" : "ERR not found\n";
+        } else if (command == "LOOKUP" && fields.size() == 2){
+            std::optional<AddressBook::Entry> entry = this->address_book.lookup(std::string(fields[1]));
+            if (!entry){
+                reply += "OK 0\n";
+            } else{
+                reply += "OK 1\n";
+                appendEntry(*entry, reply);
+            }
+        } else if (command == "FIND" && fields.size() >= 2){
+            std::size_t limit = parseLimit(fields, 2);
+            appendPage(this->address_book.findPage(std::string(fields[1]), limit,
+                                                   fields.size() > 3 ? std::string(fields[3]) : std::string()), reply);
+        } else if (command == "LIST" && fields.size() >= 2 && (fields[1] == "FIRST" || fields[1] == "LAST")){
+            std::size_t limit = parseLimit(fields, 2);
+            std::string resume_token = fields.size() > 3 ? std::string(fields[3]) : std::string();
+            appendPage(fields[1] == "FIRST" ? this->address_book.pageByFirstName(limit, resume_token)
+                                            : this->address_book.pageByLastName(limit, resume_token), reply);
+        } else if (command == "QUERY" && fields.size() >= 2){
+            // The command and its conditions, plus one more field to catch a request with too many conditions
+            std::vector<std::string_view> conditions = splitFields(line, maximum_conditions + 2);
+            if (conditions.size() > maximum_conditions + 1){
+                throw std::invalid_argument("A query can have at most " + std::to_string(maximum_conditions) + " conditions");
+            }
+            AddressBook::Query query;
+            for (std::size_t i = 1 ; i<conditions.size() ; i++){
+                addCondition(conditions[i], query);
+            }
+            std::map<std::string,AddressBook::Entry> matches = this->address_book.query(query);
+            reply += "OK ";
+            reply += std::to_string(matches.size());
+            reply += '\n';
+            for (const auto& i : matches){
+                appendEntry(i.second, reply);
+            }
+        } else if (command == "SUGGEST" && fields.size() >= 2 && fields.size() <= 3){
+            std::size_t limit = parseLimit(fields, 2, default_suggestions);
+            std::vector<AddressBook::Entry> suggestions = this->address_book.suggest(std::string(fields[1]), limit);
+            reply += "OK ";
+            reply += std::to_string(suggestions.size());
+            reply += '\n';
+            for (const AddressBook::Entry& entry : suggestions){
+                appendEntry(entry, reply);
+            }
+        } else if (command == "USE" && fields.size() == 2){
+            reply += this->address_book.recordUse(std::string(fields[1])) ? "OK\n" : "ERR not found\n";
+        } else if (command == "STATS" && fields.size() == 1){
+            reply += "OK 1\n";
+            reply += this->address_book.metrics().toJson();
+            reply += '\n';
+        } else{
+            reply += "ERR unknown request\n";
+        }
+    } catch(std::exception& ex){
+        // A bad resume token or a failed journal write only fails this request
+        reply += "ERR ";
+        appendField(ex.what(), reply);
+        reply += '\n';
+    }
+}
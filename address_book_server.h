@@ -0,0 +1,110 @@
+#pragma once
+
+#include "address_book.h"
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/// Serves an address book to other processes over TCP or a Unix socket, for running it as a lookup service.
+/// One thread runs an epoll event loop over every connection, so the address book needs no locking.
+///
+/// The protocol is one request per line, with its fields separated by tabs:
+///   ADD <first name> <last name> <phone number>    replies OK, or ERR and the reason
+///   REMOVE <key>                                   removes the entry with exactly this key. Replies OK or ERR not found
+///   LOOKUP <key>                                   the entry with exactly this key, if there is one
+///   FIND <name> [<limit>] [<resume token>]         a page of the entries find would return (see AddressBook::findPage)
+///   LIST FIRST|LAST [<limit>] [<resume token>]     a page of the whole book in first or last name order
+///   QUERY <condition> ...                          every entry meeting all of up to 16 conditions (see AddressBook::query).
+///                                                  A condition is first, last or phone, then = for an exact match
+///                                                  or ^ for a prefix, then the value, such as first^jo or last=Smith
+///   SUGGEST <prefix> [<limit>]                     up to limit (10 if left out) entries completing the name being typed,
+///                                                  most used first (see AddressBook::suggest)
+///   USE <key>                                      counts a use of the entry with exactly this key, such as picking it
+///                                                  from a SUGGEST reply. Replies OK or ERR not found
+///   STATS                                          AddressBook::metrics as one line of JSON
+/// Requests that return entries reply "OK <count>", followed by a tab and a resume token if there are more,
+/// and then one line per entry holding its first name, last name and phone number separated by tabs.
+/// The phone number is the rest of the line. A limit left out means 100, and it can be at most 10000.
+/// A backslash, tab, line break or carriage return in a field of a reply is sent as \\, \t, \n or \r,
+/// so every reply line splits into the same fields however the entry was added.
+///
+/// Clients may send any number of requests without waiting for the replies (pipelining).
+/// Replies come back in the order the requests were sent, and every reply to the requests in one read
+/// goes out in a single write. While a client is not reading its replies, no more of its requests are read.
+/// A client may shut down its side of the connection once it has sent its last request, and still gets every reply
+/// before the server closes the connection.
+class AddressBookServer
+{
+public:
+    /// Start listening on address, which is "unix:<path>" for a Unix socket, or "<host>:<port>" or just "<port>"
+    /// for TCP. A TCP port without a host only accepts connections from this machine.
+    /// Throws std::runtime_error if the socket can't be set up.
+    AddressBookServer(AddressBook& address_book, const std::string& address);
+    ~AddressBookServer();
+    AddressBookServer(const AddressBookServer&) = delete;
+    AddressBookServer& operator=(const AddressBookServer&) = delete;
+
+    /// Serve requests until stop is called
+    void run();
+
+    /// Make run return once it has finished the requests it is working on.
+    /// It is safe to call from a signal handler or another thread.
+    void stop();
+
+    /// Carry out one request line (without its line break) and append the reply to reply
+    void handleRequest(std::string_view line, std::string& reply);
+
+private:
+    struct Connection
+    {
+        int socket = -1;
+        // Bytes read that don't make up a whole line yet
+        std::string unread;
+        // Replies not yet written, starting from reply_offset
+        std::string replies;
+        std::size_t reply_offset = 0;
+        // Whether the loop is waiting for the socket to take more replies rather than for more requests
+        bool waiting_to_write = false;
+        // Set once nothing more will be read, because the client has finished sending or sent a request too long
+        // to keep. The connection stays open until the replies it is owed have been written, and is then closed
+        bool finished_reading = false;
+    };
+
+    AddressBook& address_book;
+    int listening_socket = -1;
+    int event_loop = -1;
+    // An eventfd that stop writes to, to wake the loop
+    int stop_event = -1;
+    // The path of the Unix socket, removed again when the server is destroyed
+    std::string unix_socket_path;
+    std::unordered_map<int,std::unique_ptr<Connection>> connections;
+
+    void acceptConnections();
+
+    /// Read what the client has sent, carry out every whole request in it and send the replies
+    void readRequests(Connection&);
+
+    /// Stop reading from a connection, and close it once every reply it is owed has been written
+    void finishReading(Connection&);
+
+    /// Write as many replies as the socket will take. Returns false if the connection has failed.
+    bool writeReplies(Connection&);
+
+    void closeConnection(Connection&);
+
+    /// Put the listening socket back into the loop after accepting was paused
+    void resumeAccepting();
+
+    /// Close every socket, for the destructor and for a constructor that fails part way
+    void release();
+
+    // Set when accept fails, such as by running out of file descriptors. The listening socket is left out of the loop
+    // until a connection closes or resume_accepting_at comes, as otherwise the loop would wake for it again straight away.
+    // accept_retry is the wait after the latest of a run of failures, and 0 once accept succeeds
+    bool accepting_paused = false;
+    std::chrono::milliseconds accept_retry{0};
+    std::chrono::steady_clock::time_point resume_accepting_at;
+};
@@ -0,0 +1,628 @@
+#include "include/address_book_storage.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char snapshot_magic[8] = {'A','D','D','R','B','O','O','K'};
+const std::uint32_t snapshot_version = 2;
+// Version 1 headers end before the sequence number
+const std::size_t version_1_header_size = offsetof(SnapshotFile::SnapshotHeader, sequence);
+
+// Journals from before changes were numbered start straight away with a record, whose first byte is a letter
+const char journal_magic[8] = {'\0','J','O','U','R','N','A','L'};
+// The magic followed by the sequence number of the journal's first change
+const std::size_t journal_header_size = sizeof(journal_magic) + sizeof(std::uint64_t);
+// An archived segment's name is the journal's path, a '.' and this many digits
+const std::size_t segment_digits = 20;
+
+std::runtime_error ioError(const std::string& what, const std::string& path)
+{
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+// write() may write less than it was asked to, so it is called until everything has been written
+void writeAll(int fd, const void* data, std::size_t size, const std::string& path)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0){
+        ssize_t written = ::write(fd, bytes, size);
+        if (written < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            throw ioError("Could not write to", path);
+        }
+        bytes += written;
+        size -= static_cast<std::size_t>(written);
+    }
+}
+
+void appendField(std::vector<char>& buffer, std::string_view field)
+{
+    std::uint32_t length = static_cast<std::uint32_t>(field.size());
+    const char* length_bytes = reinterpret_cast<const char*>(&length);
+    buffer.insert(buffer.end(), length_bytes, length_bytes + sizeof(length));
+    buffer.insert(buffer.end(), field.begin(), field.end());
+}
+
+void writeJournalHeader(int fd, std::uint64_t first_sequence, const std::string& path)
+{
+    char header[journal_header_size];
+    std::memcpy(header, journal_magic, sizeof(journal_magic));
+    std::memcpy(header + sizeof(journal_magic), &first_sequence, sizeof(first_sequence));
+    writeAll(fd, header, sizeof(header), path);
+}
+
+// Reads the sequence number in a journal's header. Returns false if the journal doesn't exist
+// or has no complete header, which includes journals from before changes were numbered
+bool readJournalHeader(const std::string& path, std::uint64_t& first_sequence)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0){
+        if (errno == ENOENT){
+            return false;
+        }
+        throw ioError("Could not open", path);
+    }
+    char header[journal_header_size];
+    ssize_t bytes_read;
+    do{
+        bytes_read = ::pread(fd, header, sizeof(header), 0);
+    } while (bytes_read < 0 && errno == EINTR);
+    ::close(fd);
+    if (bytes_read != static_cast<ssize_t>(sizeof(header)) || std::memcmp(header, journal_magic, sizeof(journal_magic)) != 0){
+        return false;
+    }
+    std::memcpy(&first_sequence, header + sizeof(journal_magic), sizeof(first_sequence));
+    return true;
+}
+
+// Reads a whole file into contents. Returns false if it doesn't exist
+bool readFile(const std::string& path, std::string& contents)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0){
+        if (errno == ENOENT){
+            return false;
+        }
+        throw ioError("Could not open", path);
+    }
+    char chunk[1 << 16];
+    ssize_t bytes_read;
+    while ((bytes_read = ::read(fd, chunk, sizeof(chunk))) != 0){
+        if (bytes_read < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            ::close(fd);
+            throw ioError("Could not read", path);
+        }
+        contents.append(chunk, static_cast<std::size_t>(bytes_read));
+    }
+    ::close(fd);
+    return true;
+}
+
+std::string segmentPath(const std::string& path, std::uint64_t first_sequence)
+{
+    std::string digits = std::to_string(first_sequence);
+    return path + '.' + std::string(segment_digits - digits.size(), '0') + digits;
+}
+
+// The archived segments of the journal at path, as (sequence number of the first change, path) pairs in order
+std::vector<std::pair<std::uint64_t,std::string>> listSegments(const std::string& path)
+{
+    std::size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    std::string prefix = (slash == std::string::npos ? path : path.substr(slash + 1)) + '.';
+    std::vector<std::pair<std::uint64_t,std::string>> segments;
+    DIR* listing = ::opendir(directory.c_str());
+    if (listing == nullptr){
+        if (errno == ENOENT){
+            return segments;
+        }
+        throw ioError("Could not list", directory);
+    }
+    while (const dirent* file = ::readdir(listing)){
+        std::string_view name(file->d_name);
+        if (name.size() != prefix.size() + segment_digits || name.compare(0, prefix.size(), prefix) != 0){
+            continue;
+        }
+        std::uint64_t first_sequence = 0;
+        const char* digits_end = name.data() + name.size();
+        if (std::from_chars(name.data() + prefix.size(), digits_end, first_sequence).ptr == digits_end){
+            segments.emplace_back(first_sequence, segmentPath(path, first_sequence));
+        }
+    }
+    ::closedir(listing);
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+}
+
+SnapshotFile::~SnapshotFile()
+{
+    this->close();
+}
+
+bool SnapshotFile::open(const std::string& path)
+{
+    this->close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0){
+        if (errno == ENOENT){
+            return false;
+        }
+        throw ioError("Could not open", path);
+    }
+    struct stat file_info;
+    if (::fstat(fd, &file_info) != 0){
+        ::close(fd);
+        throw ioError("Could not read", path);
+    }
+    std::size_t file_size = static_cast<std::size_t>(file_info.st_size);
+    if (file_size < version_1_header_size){
+        ::close(fd);
+        throw std::runtime_error(path + " is not an address book snapshot");
+    }
+    void* mapped = ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the file descriptor is closed
+    ::close(fd);
+    if (mapped == MAP_FAILED){
+        throw ioError("Could not map", path);
+    }
+    this->mapping = static_cast<const unsigned char*>(mapped);
+    this->mapping_size = file_size;
+
+    SnapshotHeader header;
+    std::memcpy(&header, this->mapping, version_1_header_size);
+    header.sequence = 0;
+    std::size_t header_size = version_1_header_size;
+    if (header.version == snapshot_version && file_size >= sizeof(SnapshotHeader)){
+        std::memcpy(&header, this->mapping, sizeof(header));
+        header_size = sizeof(header);
+    }
+    std::size_t records_size = static_cast<std::size_t>(header.record_count) * sizeof(SnapshotRecord);
+    if (std::memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0
+    || (header.version != 1 && header.version != snapshot_version)
+    || header_size + records_size + header.pool_size != file_size){
+        this->close();
+        throw std::runtime_error(path + " is not an address book snapshot");
+    }
+    // Loading is done in one sequential pass, so the kernel is told to read ahead
+    ::madvise(mapped, file_size, MADV_SEQUENTIAL);
+    this->record_count = header.record_count;
+    this->last_sequence = header.sequence;
+    this->records = reinterpret_cast<const SnapshotRecord*>(this->mapping + header_size);
+    this->pool = reinterpret_cast<const char*>(this->mapping + header_size + records_size);
+    // Every string is checked to lie inside the pool now, so that a damaged file is reported here
+    // rather than read past the end of the mapping later
+    auto inPool = [&header](std::uint32_t offset, std::uint32_t length){
+        return static_cast<std::uint64_t>(offset) + length <= header.pool_size;
+    };
+    for (std::size_t i = 0 ; i<this->record_count ; i++){
+        const SnapshotRecord& record = this->records[i];
+        if (!inPool(record.first_name_offset, record.first_name_length)
+        || !inPool(record.last_name_offset, record.last_name_length)
+        || !inPool(record.phone_number_offset, record.phone_number_length)){
+            this->close();
+            throw std::runtime_error(path + " is damaged: record " + std::to_string(i) + " points outside its strings");
+        }
+    }
+    return true;
+}
+
+void SnapshotFile::close()
+{
+    if (this->mapping != nullptr){
+        ::munmap(const_cast<unsigned char*>(this->mapping), this->mapping_size);
+    }
+    this->mapping = nullptr;
+    this->mapping_size = 0;
+    this->records = nullptr;
+    this->pool = nullptr;
+    this->record_count = 0;
+    this->last_sequence = 0;
+}
+
+std::size_t SnapshotFile::size() const
+{
+    return this->record_count;
+}
+
+std::uint64_t SnapshotFile::sequence() const
+{
+    return this->last_sequence;
+}
+
+std::string_view SnapshotFile::firstName(std::size_t index) const
+{
+    return this->poolString(this->records[index].first_name_offset, this->records[index].first_name_length);
+}
+
+std::string_view SnapshotFile::lastName(std::size_t index) const
+{
+    return this->poolString(this->records[index].last_name_offset, this->records[index].last_name_length);
+}
+
+std::string_view SnapshotFile::phoneNumber(std::size_t index) const
+{
+    return this->poolString(this->records[index].phone_number_offset, this->records[index].phone_number_length);
+}
+
+std::string_view SnapshotFile::poolString(std::uint32_t offset, std::uint32_t length) const
+{
+    return std::string_view(this->pool + offset, length);
+}
+
+void SnapshotFile::write(const std::string& path, const std::vector<EntryFields>& entries, std::uint64_t sequence)
+{
+    if (entries.size() > UINT32_MAX){
+        throw std::runtime_error("The address book has too many entries for a snapshot");
+    }
+    SnapshotHeader header;
+    std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.version = snapshot_version;
+    header.record_count = static_cast<std::uint32_t>(entries.size());
+    header.pool_size = 0;
+    header.sequence = sequence;
+
+    // Offsets are 32 bits wide, so the pool is built up front to lay out every record
+    std::vector<SnapshotRecord> records;
+    records.reserve(entries.size());
+    std::string pool;
+    auto addToPool = [&pool](std::string_view text, std::uint32_t& offset, std::uint32_t& length){
+        offset = static_cast<std::uint32_t>(pool.size());
+        length = static_cast<std::uint32_t>(text.size());
+        pool.append(text.data(), text.size());
+    };
+    for (const EntryFields& entry : entries){
+        SnapshotRecord record;
+        addToPool(entry.first_name, record.first_name_offset, record.first_name_length);
+        addToPool(entry.last_name, record.last_name_offset, record.last_name_length);
+        addToPool(entry.phone_number, record.phone_number_offset, record.phone_number_length);
+        records.push_back(record);
+    }
+    if (pool.size() > UINT32_MAX){
+        throw std::runtime_error("The address book is too large for a snapshot");
+    }
+    header.pool_size = pool.size();
+
+    std::string temporary_path = path + ".tmp";
+    int fd = ::open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0){
+        throw ioError("Could not create", temporary_path);
+    }
+    try{
+        writeAll(fd, &header, sizeof(header), temporary_path);
+        writeAll(fd, records.data(), records.size() * sizeof(SnapshotRecord), temporary_path);
+        writeAll(fd, pool.data(), pool.size(), temporary_path);
+        if (::fsync(fd) != 0){
+            throw ioError("Could not flush", temporary_path);
+        }
+    } catch(std::exception& ex){
+        ::close(fd);
+        std::remove(temporary_path.c_str());
+        throw;
+    }
+    ::close(fd);
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0){
+        throw ioError("Could not replace", path);
+    }
+}
+
+Journal::~Journal()
+{
+    this->close();
+}
+
+void Journal::open(const std::string& path, std::size_t valid_length, std::uint64_t last_sequence)
+{
+    this->close();
+    this->path = path;
+    this->last_sequence = last_sequence;
+    this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (this->fd < 0){
+        throw ioError("Could not open", path);
+    }
+    // Anything past the last complete record is left over from a crash mid write.
+    // It is cut off so that new records are not appended after it
+    if (valid_length < journal_header_size){
+        valid_length = 0;
+    }
+    struct stat file_info;
+    if (::fstat(this->fd, &file_info) == 0 && static_cast<std::size_t>(file_info.st_size) > valid_length
+    && ::ftruncate(this->fd, static_cast<off_t>(valid_length)) != 0){
+        throw ioError("Could not truncate", path);
+    }
+    if (valid_length == 0){
+        this->first_sequence = last_sequence + 1;
+        this->has_records = false;
+        writeJournalHeader(this->fd, this->first_sequence, path);
+    } else{
+        if (!readJournalHeader(path, this->first_sequence)){
+            throw std::runtime_error(path + " is not a journal with numbered changes");
+        }
+        this->has_records = valid_length > journal_header_size;
+    }
+}
+
+void Journal::close()
+{
+    if (this->fd >= 0){
+        ::close(this->fd);
+    }
+    this->fd = -1;
+}
+
+bool Journal::isOpen() const
+{
+    return this->fd >= 0;
+}
+
+void Journal::append(Operation operation, std::string_view first_name, std::string_view last_name,
+                     std::string_view phone_number)
+{
+    this->last_sequence++;
+    if (this->fd < 0){
+        return;
+    }
+    // Each record is the operation, its sequence number and three length prefixed strings.
+    // The record is built in memory first so it reaches the file in a single write
+    if (!this->batching){
+        this->buffer.clear();
+    }
+    this->buffer.push_back(static_cast<char>(operation));
+    const char* sequence_bytes = reinterpret_cast<const char*>(&this->last_sequence);
+    this->buffer.insert(this->buffer.end(), sequence_bytes, sequence_bytes + sizeof(this->last_sequence));
+    appendField(this->buffer, first_name);
+    appendField(this->buffer, last_name);
+    appendField(this->buffer, phone_number);
+    if (!this->batching){
+        try{
+            this->writeBuffer();
+        } catch(std::exception& ex){
+            // The number is given out again, so the numbers in the journal carry on without a gap
+            this->last_sequence--;
+            throw;
+        }
+    }
+}
+
+std::uint64_t Journal::lastSequence() const
+{
+    return this->last_sequence;
+}
+
+void Journal::setLastSequence(std::uint64_t sequence)
+{
+    this->last_sequence = sequence;
+}
+
+void Journal::beginBatch()
+{
+    this->buffer.clear();
+    this->batching = true;
+    this->batch_start_sequence = this->last_sequence;
+}
+
+void Journal::commitBatch()
+{
+    this->batching = false;
+    if (this->fd >= 0 && !this->buffer.empty()){
+        try{
+            this->writeBuffer();
+        } catch(std::exception& ex){
+            this->buffer.clear();
+            this->last_sequence = this->batch_start_sequence;
+            throw;
+        }
+    }
+    this->buffer.clear();
+}
+
+void Journal::abortBatch()
+{
+    this->batching = false;
+    this->buffer.clear();
+    this->last_sequence = this->batch_start_sequence;
+}
+
+void Journal::writeBuffer()
+{
+    off_t start = ::lseek(this->fd, 0, SEEK_END);
+    try{
+        writeAll(this->fd, this->buffer.data(), this->buffer.size(), "the journal");
+    } catch(std::exception& ex){
+        // A write that stopped part way would leave a torn record, and replay stops at the first torn record,
+        // so every record appended after it would be lost
+        if (start >= 0){
+            static_cast<void>(::ftruncate(this->fd, start));
+        }
+        throw;
+    }
+    this->has_records = true;
+}
+
+void Journal::rotate()
+{
+    // A journal without records already names the next change in its header, so it can stay as it is
+    if (this->fd < 0 || !this->has_records){
+        return;
+    }
+    // The new journal is made beside the old one before anything is renamed, so if that fails the old one is still in use.
+    // A crash between the two renames leaves no journal, which is fine as the snapshot already holds every change
+    std::string new_path = this->path + ".new";
+    int new_fd = ::open(new_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (new_fd < 0){
+        throw ioError("Could not create", new_path);
+    }
+    std::string archived_path = segmentPath(this->path, this->first_sequence);
+    try{
+        writeJournalHeader(new_fd, this->last_sequence + 1, new_path);
+        if (std::rename(this->path.c_str(), archived_path.c_str()) != 0){
+            throw ioError("Could not archive", this->path);
+        }
+        if (std::rename(new_path.c_str(), this->path.c_str()) != 0){
+            std::runtime_error error = ioError("Could not replace", this->path);
+            static_cast<void>(std::rename(archived_path.c_str(), this->path.c_str()));
+            throw error;
+        }
+    } catch(std::exception& ex){
+        ::close(new_fd);
+        std::remove(new_path.c_str());
+        throw;
+    }
+    ::close(this->fd);
+    this->fd = new_fd;
+    this->first_sequence = this->last_sequence + 1;
+    this->has_records = false;
+}
+
+std::size_t Journal::replay(const std::string& path, std::uint64_t after_sequence,
+                            const std::function<void(const Change&)>& apply)
+{
+    std::string contents;
+    if (!readFile(path, contents)){
+        return 0;
+    }
+    std::size_t position = 0;
+    bool numbered = contents.size() >= sizeof(journal_magic)
+                 && std::memcmp(contents.data(), journal_magic, sizeof(journal_magic)) == 0;
+    if (numbered){
+        if (contents.size() < journal_header_size){
+            return 0;
+        }
+        position = journal_header_size;
+    }
+    auto readField = [&contents, &position](std::string_view& field){
+        std::uint32_t length;
+        if (contents.size() - position < sizeof(length)){
+            return false;
+        }
+        std::memcpy(&length, contents.data() + position, sizeof(length));
+        position += sizeof(length);
+        if (contents.size() - position < length){
+            return false;
+        }
+        field = std::string_view(contents.data() + position, length);
+        position += length;
+        return true;
+    };
+    std::size_t valid_length = position;
+    std::uint64_t unnumbered_sequence = after_sequence;
+    Change change;
+    while (position < contents.size()){
+        change.operation = static_cast<Operation>(contents[position]);
+        position++;
+        if (numbered){
+            if (contents.size() - position < sizeof(change.sequence)){
+                break;
+            }
+            std::memcpy(&change.sequence, contents.data() + position, sizeof(change.sequence));
+            position += sizeof(change.sequence);
+        } else{
+            change.sequence = unnumbered_sequence + 1;
+        }
+        if (!readField(change.first_name) || !readField(change.last_name) || !readField(change.phone_number)){
+            break;
+        }
+        valid_length = position;
+        unnumbered_sequence = change.sequence;
+        if (change.sequence > after_sequence){
+            apply(change);
+        }
+    }
+    return valid_length;
+}
+
+bool Journal::hasUnnumberedRecords(const std::string& path)
+{
+    std::uint64_t first_sequence;
+    struct stat file_info;
+    return ::stat(path.c_str(), &file_info) == 0 && file_info.st_size > 0 && !readJournalHeader(path, first_sequence);
+}
+
+bool Journal::readChanges(const std::string& path, std::uint64_t after_sequence,
+                          const std::function<void(const Change&)>& apply)
+{
+    std::vector<std::pair<std::uint64_t,std::string>> segments = listSegments(path);
+    std::uint64_t journal_first_sequence;
+    if (readJournalHeader(path, journal_first_sequence)){
+        segments.emplace_back(journal_first_sequence, path);
+    }
+    // Reading starts from the last segment whose first change is no later than the one needed next.
+    // If every segment starts later, the changes in between have been discarded
+    std::uint64_t next_sequence = after_sequence + 1;
+    auto start = std::upper_bound(segments.begin(), segments.end(), next_sequence,
+        [](std::uint64_t sequence, const std::pair<std::uint64_t,std::string>& segment){
+            return sequence < segment.first;
+        });
+    if (start == segments.begin()){
+        return segments.empty();
+    }
+    bool gap = false;
+    for (auto segment = std::prev(start) ; segment != segments.end() && !gap ; ++segment){
+        // A segment discarded since the listing was made reads as empty, which shows up as a gap at the next one
+        Journal::replay(segment->second, next_sequence - 1, [&](const Change& change){
+            if (gap || change.sequence != next_sequence){
+                gap = true;
+                return;
+            }
+            apply(change);
+            next_sequence++;
+        });
+    }
+    // If the journal was rotated after the listing was made, the changes it held are in a segment that wasn't read.
+    // The new journal starts after them
+    if (!gap && readJournalHeader(path, journal_first_sequence) && journal_first_sequence > next_sequence){
+        gap = true;
+    }
+    return !gap;
+}
+
+void Journal::discardSegments(const std::string& path, std::uint64_t up_to_sequence)
+{
+    std::vector<std::pair<std::uint64_t,std::string>> segments = listSegments(path);
+    std::uint64_t journal_first_sequence;
+    if (!readJournalHeader(path, journal_first_sequence)){
+        return;
+    }
+    segments.emplace_back(journal_first_sequence, path);
+    // A segment holds every change up to the first one of the segment after it
+    for (std::size_t i = 0 ; i + 1<segments.size() ; i++){
+        if (segments[i + 1].first - 1 > up_to_sequence){
+            break;
+        }
+        if (std::remove(segments[i].second.c_str()) != 0 && errno != ENOENT){
+            throw ioError("Could not delete", segments[i].second);
+        }
+    }
+}
+
+void Journal::keepNewestSegments(const std::string& path, std::size_t count)
+{
+    std::vector<std::pair<std::uint64_t,std::string>> segments = listSegments(path);
+    if (segments.size() <= count){
+        return;
+    }
+    // The segments are listed oldest first
+    for (std::size_t i = 0 ; i<segments.size() - count ; i++){
+        if (std::remove(segments[i].second.c_str()) != 0 && errno != ENOENT){
+            throw ioError("Could not delete", segments[i].second);
+        }
+    }
+}
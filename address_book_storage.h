@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Persistence for the address book.
+/// A book on disk is made up of two files: a binary snapshot, which is opened with mmap,
+/// and an append-only journal holding every change made since that snapshot was written.
+/// Every change is numbered in order (its sequence number), and the snapshot records the number of the last change in it.
+/// Once a journal's changes are in a new snapshot it is kept beside the new journal as an archived segment,
+/// so that read-only copies of the book (replicas) can catch up by reading just the changes they don't have yet.
+
+/// A read-only, memory mapped snapshot of an address book.
+/// The file starts with a SnapshotHeader, followed by one fixed width SnapshotRecord per entry
+/// (in the same order as the address book's keys) and then a pool holding every string back to back.
+/// Names are returned as views into the mapping, so nothing is parsed or copied when it is opened.
+class SnapshotFile
+{
+public:
+    struct SnapshotHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t record_count;
+        std::uint64_t pool_size;
+        /// The sequence number of the last change in the snapshot. Version 1 snapshots end their header before it
+        std::uint64_t sequence;
+    };
+
+    struct SnapshotRecord
+    {
+        std::uint32_t first_name_offset;
+        std::uint32_t first_name_length;
+        std::uint32_t last_name_offset;
+        std::uint32_t last_name_length;
+        std::uint32_t phone_number_offset;
+        std::uint32_t phone_number_length;
+    };
+
+    SnapshotFile() = default;
+    ~SnapshotFile();
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    /// Map a snapshot. Returns false if the file does not exist, and throws std::runtime_error if it is not a valid snapshot,
+    /// including one cut short or with records pointing outside its strings. Checking the records reads each of them once.
+    bool open(const std::string& path);
+
+    /// Unmap the snapshot
+    void close();
+
+    /// Number of entries in the snapshot
+    std::size_t size() const;
+
+    /// The sequence number of the last change in the snapshot, or 0 for a snapshot from before changes were numbered
+    std::uint64_t sequence() const;
+
+    std::string_view firstName(std::size_t index) const;
+    std::string_view lastName(std::size_t index) const;
+    std::string_view phoneNumber(std::size_t index) const;
+
+    /// The strings that make up one entry when writing a snapshot
+    struct EntryFields
+    {
+        std::string_view first_name;
+        std::string_view last_name;
+        std::string_view phone_number;
+    };
+
+    /// Write a new snapshot of the book as it was after the change numbered sequence. The entries must be given in key order.
+    /// Throws std::runtime_error if there are more entries, or more bytes of strings, than 32 bit counts and offsets can hold.
+    /// The file is written next to the destination and renamed over it, so a crash part way through
+    /// leaves the previous snapshot untouched.
+    static void write(const std::string& path, const std::vector<EntryFields>& entries, std::uint64_t sequence);
+
+private:
+    std::string_view poolString(std::uint32_t offset, std::uint32_t length) const;
+
+    const unsigned char* mapping = nullptr;
+    std::size_t mapping_size = 0;
+    const SnapshotRecord* records = nullptr;
+    const char* pool = nullptr;
+    std::uint32_t record_count = 0;
+    std::uint64_t last_sequence = 0;
+};
+
+/// The append-only journal that sits beside a snapshot.
+/// Every change to the address book is written to the end of this file as soon as it is made.
+/// When the book is opened again, the journal is replayed on top of the snapshot.
+///
+/// The file starts with a header holding the sequence number its first change has (or will have),
+/// and each record holds the operation, its sequence number and three length prefixed strings.
+/// Journals written before changes were numbered have no header, and their records have no numbers.
+///
+/// Each record is handed to the operating system with write() as soon as its change is made, but the journal is never
+/// flushed with fsync, as that would cost a disk round trip per change. A change therefore survives the process
+/// crashing, but not the machine losing power before the kernel has written it out. Snapshots are flushed before
+/// they replace the old one, so compact is the point at which every change so far is safely on disk.
+class Journal
+{
+public:
+    /// The kind of change a journal record describes
+    enum class Operation : std::uint8_t
+    {
+        Add = 'A',
+        Remove = 'R',
+        Alter = 'U',
+        /// A change of names. Its fields are the old key and then the new first and last names
+        Rename = 'N'
+    };
+
+    /// One change read back from a journal. The strings point into the journal's contents,
+    /// so they are only valid until the function it is passed to returns
+    struct Change
+    {
+        Operation operation;
+        std::uint64_t sequence;
+        std::string_view first_name;
+        std::string_view last_name;
+        std::string_view phone_number;
+    };
+
+    Journal() = default;
+    ~Journal();
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    /// Open (or create) a journal for appending.
+    /// The file is cut down to valid_length, the length of its complete records as returned by replay.
+    /// last_sequence is the number of the last change made so far, which the records appended from now on follow.
+    /// A journal without any complete records is started again with a header, so valid_length must not
+    /// belong to a journal from before changes were numbered.
+    void open(const std::string& path, std::size_t valid_length, std::uint64_t last_sequence);
+
+    /// Close the journal
+    void close();
+
+    bool isOpen() const;
+
+    /// Append a record numbered with the next sequence number. Add and Alter records carry the whole entry,
+    /// Remove records only need the names. The numbers are counted even while the journal is not open.
+    /// If the write fails, whatever part of the record reached the file is cut off again and its number is given out again.
+    void append(Operation operation, std::string_view first_name, std::string_view last_name,
+                std::string_view phone_number = {});
+
+    /// The sequence number of the last record appended
+    std::uint64_t lastSequence() const;
+
+    /// Make the next record appended be numbered sequence + 1, for copying numbered changes from another journal
+    void setLastSequence(std::uint64_t sequence);
+
+    /// Hold back records appended from now on until commitBatch is called,
+    /// so that a large number of changes reaches the file in a single write
+    void beginBatch();
+
+    /// Write every record held back since beginBatch.
+    /// If the write fails, whatever part of it reached the file is cut off again, so none of the batch is kept
+    /// and the sequence numbers the batch used are given out again.
+    void commitBatch();
+
+    /// Throw away every record held back since beginBatch, along with their sequence numbers
+    void abortBatch();
+
+    /// Start a new, empty journal once the changes in this one have been written to a snapshot.
+    /// If this one holds any changes, it is kept beside the new one as an archived segment named
+    /// path + "." + the sequence number of its first change (20 digits, so the names sort in order),
+    /// for replicas that haven't read them yet. discardSegments and keepNewestSegments delete them.
+    void rotate();
+
+    /// Read every complete record in a journal, in the order they were written, and pass those numbered after
+    /// after_sequence to apply. Records from before changes were numbered are numbered from after_sequence + 1.
+    /// A record cut short by a crash is ignored, along with anything after it.
+    /// Returns the length of the complete records.
+    static std::size_t replay(const std::string& path, std::uint64_t after_sequence,
+                              const std::function<void(const Change&)>& apply);
+
+    /// Whether the journal at path holds records from before changes were numbered, which can be replayed but not appended to
+    static bool hasUnnumberedRecords(const std::string& path);
+
+    /// Pass every change numbered after after_sequence to apply, in order, reading the archived segments of the journal
+    /// at path and then the journal itself. Segments holding only earlier changes are not opened, so the cost follows the
+    /// number of changes asked for rather than the length of the whole history.
+    /// Returns false if the changes stop following on from one another, either because the ones needed next were
+    /// discarded or because the journal was rotated while it was being read. The changes before the gap have been passed
+    /// to apply, and reading again picks up from there.
+    static bool readChanges(const std::string& path, std::uint64_t after_sequence,
+                            const std::function<void(const Change&)>& apply);
+
+    /// Delete the archived segments of the journal at path that only hold changes numbered up_to_sequence or less
+    static void discardSegments(const std::string& path, std::uint64_t up_to_sequence);
+
+    /// Delete all but the newest count archived segments of the journal at path
+    static void keepNewestSegments(const std::string& path, std::size_t count);
+
+private:
+    /// Write buffer to the end of the file, cutting the file back to where it was if the write fails
+    void writeBuffer();
+
+    int fd = -1;
+    std::string path;
+    bool batching = false;
+    std::vector<char> buffer;
+    std::uint64_t last_sequence = 0;
+    // The sequence number before the batch being held back, for giving its numbers out again if it is thrown away
+    std::uint64_t batch_start_sequence = 0;
+    // The sequence number in the header, and whether any records have been written after it
+    std::uint64_t first_sequence = 1;
+    bool has_records = false;
+};
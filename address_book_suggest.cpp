@@ -0,0 +1,335 @@
+#include "include/address_book.h"
+#include "include/name_normalization.h"
+#include <algorithm>
+#include <queue>
+
+namespace {
+
+// How many prefixes suggest keeps the results of
+const std::size_t suggestion_cache_capacity = 256;
+
+// How many of the best entries at or below it each node of the trie keeps, which is the largest limit it answers straight away
+const std::size_t best_suggestions = 10;
+
+// Whether two suggestions place the same entry under the same name
+template <typename Suggestion>
+bool samePlace(const Suggestion& a, const Suggestion& b)
+{
+    return a.row == b.row && a.by_last_name == b.by_last_name;
+}
+
+// Puts a suggestion into a list kept best first, or moves it up to its new rank if it is already there.
+// A list that would grow past capacity drops its worst suggestion
+template <typename Suggestion>
+void raiseSuggestion(std::vector<Suggestion>& list, const Suggestion& suggestion, std::size_t capacity)
+{
+    auto placed = std::find_if(list.begin(), list.end(), [&suggestion](const Suggestion& other){
+        return samePlace(other, suggestion);
+    });
+    if (placed == list.end()){
+        if (list.size() >= capacity && !(list.back().rank < suggestion.rank)){
+            return;
+        }
+        list.push_back(suggestion);
+        placed = std::prev(list.end());
+    } else{
+        placed->rank = suggestion.rank;
+    }
+    // The suggestions before it are still best first, so it is rotated back to the first one it outranks
+    auto place = std::find_if(list.begin(), placed, [&suggestion](const Suggestion& other){
+        return other.rank < suggestion.rank;
+    });
+    std::rotate(place, placed, std::next(placed));
+    if (list.size() > capacity){
+        list.pop_back();
+    }
+}
+
+// Whether a collation key starts with the folded prefix
+bool startsWith(std::string_view folded_name, const std::string& folded_prefix)
+{
+    return folded_name.compare(0, folded_prefix.size(), folded_prefix) == 0;
+}
+
+}
+
+std::vector<AddressBook::Entry> AddressBook::suggest(const std::string& prefix, std::size_t limit) const
+{
+    ADDRESS_BOOK_TIME(Suggest);
+    this->waitForIndexes();
+    std::vector<Entry> suggestions;
+    if (limit == 0){
+        return suggestions;
+    }
+    std::string folded_prefix = collationKey(removeWhitespace(prefix));
+    {
+        std::unique_lock<std::mutex> lock(this->suggestion_cache_mutex, std::try_to_lock);
+        if (lock.owns_lock()){
+            auto cached = this->cached_prefixes.find(folded_prefix);
+            // Results cached for a larger limit start with the results for this one.
+            // So do results with fewer entries than their limit, as they hold every match
+            if (cached != this->cached_prefixes.end()
+            && (cached->second->limit >= limit || cached->second->rows.size() < cached->second->limit)){
+                this->suggestion_cache.splice(this->suggestion_cache.begin(), this->suggestion_cache, cached->second);
+                const std::vector<Row>& rows = cached->second->rows;
+                std::size_t count = std::min(limit, rows.size());
+                suggestions.reserve(count);
+                for (std::size_t i = 0 ; i<count ; i++){
+                    suggestions.push_back(this->entryAt(rows[i]));
+                }
+                ADDRESS_BOOK_COUNT(SuggestCacheHits);
+                return suggestions;
+            }
+        }
+    }
+    std::vector<Row> rows = this->rankSuggestions(folded_prefix, limit);
+    suggestions.reserve(rows.size());
+    for (Row row : rows){
+        suggestions.push_back(this->entryAt(row));
+    }
+    std::unique_lock<std::mutex> lock(this->suggestion_cache_mutex, std::try_to_lock);
+    if (lock.owns_lock()){
+        // Another thread may have cached the same prefix in the meantime, in which case these results replace its
+        auto cached = this->cached_prefixes.find(folded_prefix);
+        if (cached != this->cached_prefixes.end()){
+            auto position = cached->second;
+            this->cached_prefixes.erase(cached);
+            this->suggestion_cache.erase(position);
+        }
+        this->suggestion_cache.push_front(CachedSuggestions{std::move(folded_prefix), limit, std::move(rows)});
+        this->cached_prefixes.emplace(this->suggestion_cache.front().prefix, this->suggestion_cache.begin());
+        if (this->suggestion_cache.size() > suggestion_cache_capacity){
+            this->cached_prefixes.erase(this->suggestion_cache.back().prefix);
+            this->suggestion_cache.pop_back();
+        }
+    }
+    return suggestions;
+}
+
+bool AddressBook::recordUse(const std::string& key)
+{
+    this->waitForIndexes();
+    auto entry = this->findKey(key);
+    if (entry == this->address_book_list.end()){
+        return false;
+    }
+    Row used = *entry;
+    UseRank& rank = this->uses[used];
+    rank = UseRank(rank.first + 1, ++this->use_clock);
+    std::string_view folded_first_name = this->entry_table.foldedFirstName(used);
+    std::string_view folded_last_name = this->entry_table.foldedLastName(used);
+    // A use only ever moves an entry up, so it is moved within its nodes rather than taken out and put back
+    this->placeSuggestion(folded_first_name, used, rank, false);
+    if (!folded_last_name.empty() && folded_last_name != folded_first_name){
+        this->placeSuggestion(folded_last_name, used, rank, true);
+    }
+    this->dropCachedSuggestions(folded_first_name);
+    this->dropCachedSuggestions(folded_last_name);
+    return true;
+}
+
+std::vector<EntryTable::Row> AddressBook::rankSuggestions(const std::string& folded_prefix, std::size_t limit) const
+{
+    std::vector<Row> ranked;
+    // The used entries come first. Every one whose name starts with the prefix is at or below the prefix's node
+    const SuggestionNode* start = &this->suggestion_root;
+    for (char letter : folded_prefix){
+        auto child = start->children.find(letter);
+        if (child == start->children.end()){
+            start = nullptr;
+            break;
+        }
+        start = child->second.get();
+    }
+    if (start != nullptr){
+        // The node's best list answers a small limit. An entry listed under both its names is taken under its first name,
+        // so if the list is full and some of it is left out like that, it may not reach far enough
+        for (const Suggestion& suggestion : start->best){
+            if (ranked.size() == limit){
+                break;
+            }
+            if (!(suggestion.by_last_name && startsWith(this->entry_table.foldedFirstName(suggestion.row), folded_prefix))){
+                ranked.push_back(suggestion.row);
+            }
+        }
+        if (ranked.size() < limit && start->best.size() == best_suggestions){
+            ranked.clear();
+        } else{
+            start = nullptr;
+        }
+    }
+    if (start != nullptr){
+        // Each step takes the best ranked thing reached so far: either a node, which stands for everything at and
+        // below it and is ranked by the best of those, or an entry in a node, which is followed by the next one there.
+        // Ranks only fall from a node to what is below it, so the entries are taken in order of rank
+        const std::size_t whole_node = static_cast<std::size_t>(-1);
+        struct Reached
+        {
+            UseRank rank;
+            const SuggestionNode* node;
+            // The position of the entry in node->suggestions, or whole_node for the node itself
+            std::size_t position;
+
+            bool operator<(const Reached& other) const { return this->rank < other.rank; }
+        };
+        std::priority_queue<Reached> reached;
+        reached.push({start->best.front().rank, start, whole_node});
+        while (!reached.empty() && ranked.size() < limit){
+            Reached next = reached.top();
+            reached.pop();
+            if (next.position == whole_node){
+                if (!next.node->suggestions.empty()){
+                    reached.push({next.node->suggestions.front().rank, next.node, 0});
+                }
+                for (const auto& child : next.node->children){
+                    reached.push({child.second->best.front().rank, child.second.get(), whole_node});
+                }
+                continue;
+            }
+            const Suggestion& suggestion = next.node->suggestions[next.position];
+            if (next.position + 1 < next.node->suggestions.size()){
+                reached.push({next.node->suggestions[next.position + 1].rank, next.node, next.position + 1});
+            }
+            // An entry whose first name also starts with the prefix is reached under that name too, and taken from there
+            if (!(suggestion.by_last_name && startsWith(this->entry_table.foldedFirstName(suggestion.row), folded_prefix))){
+                ranked.push_back(suggestion.row);
+            }
+        }
+    }
+    // Every used entry that matches has been taken by now, so the rest are filled in from the entries that haven't been used.
+    // The name orders are sorted first by the collation key of the name they are sorted by, so the names starting with
+    // the prefix sit together
+    for (auto it = this->first_name_order.lower_bound(SortFields{folded_prefix, std::string_view(), EntryTable::Key()});
+         it != this->first_name_order.end() && ranked.size() < limit
+         && startsWith(this->first_name_order.key_comp().fieldsOf(*it).name, folded_prefix);
+         ++it){
+        if (this->uses.count(*it) == 0){
+            ranked.push_back(*it);
+        }
+    }
+    for (auto it = this->last_name_order.lower_bound(SortFields{folded_prefix, std::string_view(), EntryTable::Key()});
+         it != this->last_name_order.end() && ranked.size() < limit
+         && startsWith(this->last_name_order.key_comp().fieldsOf(*it).name, folded_prefix);
+         ++it){
+        // Entries whose first name matches were taken from first_name_order, as were those without a last name,
+        // which are sorted by their first name here
+        if (this->uses.count(*it) == 0 && !this->entry_table.lastName(*it).empty()
+        && !startsWith(this->entry_table.foldedFirstName(*it), folded_prefix)){
+            ranked.push_back(*it);
+        }
+    }
+    return ranked;
+}
+
+void AddressBook::indexUses(Row row)
+{
+    std::string_view folded_first_name = this->entry_table.foldedFirstName(row);
+    std::string_view folded_last_name = this->entry_table.foldedLastName(row);
+    this->dropCachedSuggestions(folded_first_name);
+    this->dropCachedSuggestions(folded_last_name);
+    auto used = this->uses.find(row);
+    if (used == this->uses.end()){
+        return;
+    }
+    this->placeSuggestion(folded_first_name, row, used->second, false);
+    if (!folded_last_name.empty() && folded_last_name != folded_first_name){
+        this->placeSuggestion(folded_last_name, row, used->second, true);
+    }
+}
+
+void AddressBook::unindexUses(Row row, bool forget)
+{
+    std::string_view folded_first_name = this->entry_table.foldedFirstName(row);
+    std::string_view folded_last_name = this->entry_table.foldedLastName(row);
+    this->dropCachedSuggestions(folded_first_name);
+    this->dropCachedSuggestions(folded_last_name);
+    auto used = this->uses.find(row);
+    if (used == this->uses.end()){
+        return;
+    }
+    this->removeSuggestion(folded_first_name, row, false);
+    if (!folded_last_name.empty() && folded_last_name != folded_first_name){
+        this->removeSuggestion(folded_last_name, row, true);
+    }
+    if (forget){
+        this->uses.erase(used);
+    }
+}
+
+void AddressBook::placeSuggestion(std::string_view folded_name, Row row, UseRank rank, bool by_last_name)
+{
+    // The entry is either new to the trie or moving up, so it can only join or move up the best lists on the way down
+    Suggestion suggestion{rank, row, by_last_name};
+    SuggestionNode* node = &this->suggestion_root;
+    raiseSuggestion(node->best, suggestion, best_suggestions);
+    for (char letter : folded_name){
+        std::unique_ptr<SuggestionNode>& child = node->children[letter];
+        if (!child){
+            child = std::make_unique<SuggestionNode>();
+        }
+        node = child.get();
+        raiseSuggestion(node->best, suggestion, best_suggestions);
+    }
+    raiseSuggestion(node->suggestions, suggestion, static_cast<std::size_t>(-1));
+}
+
+void AddressBook::removeSuggestion(std::string_view folded_name, Row row, bool by_last_name)
+{
+    Suggestion removed{UseRank(), row, by_last_name};
+    std::vector<SuggestionNode*> path = {&this->suggestion_root};
+    for (char letter : folded_name){
+        auto child = path.back()->children.find(letter);
+        if (child == path.back()->children.end()){
+            return;
+        }
+        path.push_back(child->second.get());
+    }
+    std::vector<Suggestion>& suggestions = path.back()->suggestions;
+    suggestions.erase(std::remove_if(suggestions.begin(), suggestions.end(), [&removed](const Suggestion& suggestion){
+                          return samePlace(suggestion, removed);
+                      }), suggestions.end());
+    // On the way back up, nodes left with nothing at or below them are removed, and a best list the entry was in
+    // is made again from the node's own entries and its children's best lists, which between them hold its best
+    for (std::size_t depth = path.size() ; depth-- > 0 ; ){
+        SuggestionNode* node = path[depth];
+        if (depth + 1 < path.size()){
+            auto child = node->children.find(folded_name[depth]);
+            if (child->second->suggestions.empty() && child->second->children.empty()){
+                node->children.erase(child);
+            }
+        }
+        auto listed = std::find_if(node->best.begin(), node->best.end(), [&removed](const Suggestion& suggestion){
+            return samePlace(suggestion, removed);
+        });
+        if (listed == node->best.end()){
+            continue;
+        }
+        std::vector<Suggestion> candidates(node->suggestions.begin(),
+                                           node->suggestions.begin()
+                                           + static_cast<std::ptrdiff_t>(std::min(node->suggestions.size(), best_suggestions)));
+        for (const auto& child : node->children){
+            candidates.insert(candidates.end(), child.second->best.begin(), child.second->best.end());
+        }
+        std::size_t kept = std::min(candidates.size(), best_suggestions);
+        std::partial_sort(candidates.begin(), candidates.begin() + static_cast<std::ptrdiff_t>(kept), candidates.end(),
+                          [](const Suggestion& a, const Suggestion& b){ return b.rank < a.rank; });
+        candidates.resize(kept);
+        node->best = std::move(candidates);
+    }
+}
+
+void AddressBook::dropCachedSuggestions(std::string_view folded_name)
+{
+    if (this->cached_prefixes.empty()){
+        return;
+    }
+    // The results for every prefix of the name, down to "", may hold the entry or have left it out
+    for (std::size_t length = 0 ; length<=folded_name.size() ; length++){
+        auto cached = this->cached_prefixes.find(std::string_view(folded_name.data(), length));
+        if (cached != this->cached_prefixes.end()){
+            auto position = cached->second;
+            this->cached_prefixes.erase(cached);
+            this->suggestion_cache.erase(position);
+        }
+    }
+}
@@ -0,0 +1,521 @@
+// Benchmarks for AddressBook at realistic sizes.
+//
+// Builds synthetic address books of increasing size and times add, remove, batched changes, exact lookup, prefix find,
+// paged find, typo tolerant find, reverse phone number lookup, compound queries, autocomplete suggestions
+// and both sorted listings.
+// It times a replica catching up with a stored book's changes, next to diffing the two books in full,
+// and opening the stored book again.
+// It also compares sorting names by their bytes, by collating them on every comparison and by precomputed collation keys.
+// It also measures the memory used per entry and the speed of a full scan.
+// Results are written to stdout as JSON so they can be compared between commits.
+//
+// The sources include their headers as "include/...", so -I must point at a directory in which include/ is this
+// repository. From the directory above a checkout named include, compile include/bench/address_book_bench.cpp together with
+// include/address_book.cpp, include/address_book_storage.cpp, include/address_book_import.cpp, include/address_book_batch.cpp,
+// include/address_book_query.cpp, include/address_book_replication.cpp, include/address_book_suggest.cpp,
+// include/name_normalization.cpp, include/entry_table.cpp and include/address_book_metrics.cpp,
+// using g++ -O2 -std=c++17 -pthread -I.
+// Adding -DADDRESS_BOOK_METRICS measures the cost of the usage metrics.
+//
+// Usage: address_book_bench [--sizes 1000,10000,100000] [--operations 10000] [--seed 1]
+
+#include "include/address_book.h"
+#include "include/name_normalization.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace {
+
+// Common first names, roughly in order of how often they occur
+const char* const first_names[] = {
+    "James", "Mary", "John", "Patricia", "Robert", "Jennifer", "Michael", "Linda", "William", "Elizabeth",
+    "David", "Barbara", "Richard", "Susan", "Joseph", "Jessica", "Thomas", "Sarah", "Charles", "Karen",
+    "Christopher", "Nancy", "Daniel", "Lisa", "Matthew", "Betty", "Anthony", "Margaret", "Mark", "Sandra",
+    "Donald", "Ashley", "Steven", "Kimberly", "Paul", "Emily", "Andrew", "Donna", "Joshua", "Michelle",
+    "Kenneth", "Dorothy", "Kevin", "Carol", "Brian", "Amanda", "George", "Melissa", "Edward", "Deborah",
+    "Ronald", "Stephanie", "Timothy", "Rebecca", "Jason", "Sharon", "Jeffrey", "Laura", "Ryan", "Cynthia",
+    "Jacob", "Kathleen", "Gary", "Amy", "Nicholas", "Shirley", "Eric", "Angela", "Jonathan", "Helen",
+    "Stephen", "Anna", "Larry", "Brenda", "Justin", "Pamela", "Scott", "Nicole", "Brandon", "Emma",
+    "Benjamin", "Samantha", "Samuel", "Katherine", "Gregory", "Christine", "Frank", "Debra", "Alexander", "Rachel",
+    "Raymond", "Catherine", "Patrick", "Carolyn", "Jack", "Janet", "Dennis", "Ruth", "Jerry", "Maria",
+    "Oliver", "Amelia", "Harry", "Isla", "Noah", "Ava", "Leo", "Mia", "Oscar", "Ivy",
+    "Arthur", "Freya", "Muhammad", "Lily", "Theo", "Florence", "Archie", "Grace", "Alfie", "Willow",
+    "Mohammed", "Fatima", "Wei", "Aisha", "Hiroshi", "Yuki", "Priya", "Arjun", "Sofia", "Mateo",
+    "Zoe", "Chloe", "Lucas", "Ethan", "Aiden", "Hannah", "Isabella", "Liam", "Ella", "Jayden",
+    "Émile", "José", "Zoë", "Søren", "Łukasz", "Jürgen", "Björn", "François", "Siobhán", "Ólafur"
+};
+
+// Last names are built from syllables, which gives a few hundred thousand plausible looking names
+const char* const syllables[] = {
+    "ab", "al", "an", "ar", "ba", "be", "bro", "car", "chen", "da", "den", "do", "el", "er", "fer", "field",
+    "ford", "gar", "gon", "ham", "har", "hill", "in", "jo", "kin", "la", "lee", "ley", "lin", "ma", "mar", "mer",
+    "mont", "mor", "na", "ne", "ni", "no", "o", "par", "per", "ra", "ri", "ro", "san", "sen", "son", "ston",
+    "ta", "ter", "ton", "tra", "va", "ven", "ver", "wa", "well", "wen", "win", "wood", "wright", "ya", "zi", "zo"
+};
+
+const std::size_t first_name_count = sizeof(first_names) / sizeof(first_names[0]);
+const std::size_t syllable_count = sizeof(syllables) / sizeof(syllables[0]);
+
+// Picks ranks following Zipf's law, which is how name frequencies are spread in real populations
+class ZipfDistribution
+{
+public:
+    ZipfDistribution(std::size_t count, double exponent) : cumulative(count)
+    {
+        double total = 0;
+        for (std::size_t i = 0 ; i<count ; i++){
+            total += 1.0 / std::pow(static_cast<double>(i + 1), exponent);
+            this->cumulative[i] = total;
+        }
+        for (double& value : this->cumulative){
+            value /= total;
+        }
+    }
+
+    std::size_t operator()(std::mt19937_64& random) const
+    {
+        double sample = std::uniform_real_distribution<double>(0, 1)(random);
+        auto rank = std::lower_bound(this->cumulative.begin(), this->cumulative.end(), sample);
+        return std::min<std::size_t>(static_cast<std::size_t>(rank - this->cumulative.begin()), this->cumulative.size() - 1);
+    }
+
+private:
+    std::vector<double> cumulative;
+};
+
+class NameGenerator
+{
+public:
+    explicit NameGenerator(std::uint64_t seed)
+        : random(seed), first_name_rank(first_name_count, 1.0),
+          last_name_rank(syllable_count * syllable_count * syllable_count, 0.8)
+    {
+    }
+
+    std::string firstName()
+    {
+        return first_names[this->first_name_rank(this->random)];
+    }
+
+    std::string lastName()
+    {
+        std::size_t rank = this->last_name_rank(this->random);
+        std::string name = std::string(syllables[rank % syllable_count]) + syllables[rank / syllable_count % syllable_count];
+        if (rank >= syllable_count * syllable_count){
+            name += syllables[rank / syllable_count / syllable_count];
+        }
+        name[0] = static_cast<char>(name[0] - 'a' + 'A');
+        return name;
+    }
+
+    std::string phoneNumber()
+    {
+        return "07" + std::to_string(std::uniform_int_distribution<std::uint64_t>(100000000, 999999999)(this->random));
+    }
+
+    std::mt19937_64& engine()
+    {
+        return this->random;
+    }
+
+private:
+    std::mt19937_64 random;
+    ZipfDistribution first_name_rank;
+    ZipfDistribution last_name_rank;
+};
+
+// Makes count entries with distinct names. Popular combinations come up again quickly at large sizes,
+// so after a few clashes a number is added to the last name, as happens with real duplicate names
+std::vector<AddressBook::Entry> makeEntries(std::size_t count, NameGenerator& names)
+{
+    std::vector<AddressBook::Entry> entries;
+    entries.reserve(count);
+    std::unordered_set<std::string> keys;
+    keys.reserve(count);
+    while (entries.size() < count){
+        AddressBook::Entry entry;
+        entry.first_name = names.firstName();
+        entry.last_name = names.lastName();
+        for (int attempt = 0 ; !keys.insert(AddressBook::makeKey(entry.first_name, entry.last_name)).second ; attempt++){
+            if (attempt < 3){
+                entry.last_name = names.lastName();
+            } else{
+                entry.last_name += std::to_string(attempt);
+            }
+        }
+        entry.phone_number = names.phoneNumber();
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+struct Measurement
+{
+    std::string operation;
+    std::size_t book_size = 0;
+    std::vector<double> latencies_ns;
+    double total_seconds = 0;
+    std::size_t items = 0;
+    long peak_rss_kb = 0;
+};
+
+long peakResidentKilobytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Bytes currently handed out by malloc, used to work out how much memory a structure takes
+std::size_t heapBytesInUse()
+{
+    return mallinfo2().uordblks;
+}
+
+struct StorageMeasurement
+{
+    std::size_t book_size = 0;
+    double address_book_bytes_per_entry = 0;
+};
+
+// Times each call of operation(i) for i from 0 to count - 1
+template <typename Operation>
+Measurement measure(const std::string& name, std::size_t book_size, std::size_t count, const Operation& operation)
+{
+    Measurement measurement;
+    measurement.operation = name;
+    measurement.book_size = book_size;
+    measurement.latencies_ns.reserve(count);
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0 ; i<count ; i++){
+        auto before = std::chrono::steady_clock::now();
+        measurement.items += operation(i);
+        auto after = std::chrono::steady_clock::now();
+        measurement.latencies_ns.push_back(std::chrono::duration<double, std::nano>(after - before).count());
+    }
+    measurement.total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    measurement.peak_rss_kb = peakResidentKilobytes();
+    return measurement;
+}
+
+double percentile(std::vector<double>& sorted_values, double fraction)
+{
+    if (sorted_values.empty()){
+        return 0;
+    }
+    std::size_t index = static_cast<std::size_t>(fraction * static_cast<double>(sorted_values.size() - 1) + 0.5);
+    return sorted_values[index];
+}
+
+void printMeasurement(Measurement& measurement, bool last)
+{
+    std::sort(measurement.latencies_ns.begin(), measurement.latencies_ns.end());
+    double calls = static_cast<double>(measurement.latencies_ns.size());
+    std::printf("    {\"operation\": \"%s\", \"book_size\": %zu, \"calls\": %zu, \"items\": %zu, "
+                "\"ops_per_sec\": %.1f, \"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, "
+                "\"max_ns\": %.1f, \"peak_rss_kb\": %ld}%s\n",
+                measurement.operation.c_str(), measurement.book_size, measurement.latencies_ns.size(), measurement.items,
+                measurement.total_seconds > 0 ? calls / measurement.total_seconds : 0,
+                calls > 0 ? measurement.total_seconds * 1e9 / calls : 0,
+                percentile(measurement.latencies_ns, 0.5), percentile(measurement.latencies_ns, 0.9),
+                percentile(measurement.latencies_ns, 0.99),
+                measurement.latencies_ns.empty() ? 0 : measurement.latencies_ns.back(),
+                measurement.peak_rss_kb, last ? "" : ",");
+}
+
+std::vector<std::size_t> parseSizes(const char* text)
+{
+    std::vector<std::size_t> sizes;
+    std::string list = text;
+    std::size_t start = 0;
+    while (start <= list.size()){
+        std::size_t end = list.find(',', start);
+        if (end == std::string::npos){
+            end = list.size();
+        }
+        if (end > start){
+            sizes.push_back(static_cast<std::size_t>(std::strtod(list.substr(start, end - start).c_str(), nullptr)));
+        }
+        start = end + 1;
+    }
+    return sizes;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::size_t> sizes = {1000, 10000, 100000, 1000000};
+    std::size_t operations = 10000;
+    std::uint64_t seed = 1;
+    for (int i = 1 ; i + 1<argc ; i += 2){
+        std::string option = argv[i];
+        if (option == "--sizes"){
+            sizes = parseSizes(argv[i + 1]);
+        } else if (option == "--operations"){
+            operations = static_cast<std::size_t>(std::strtoull(argv[i + 1], nullptr, 10));
+        } else if (option == "--seed"){
+            seed = std::strtoull(argv[i + 1], nullptr, 10);
+        } else{
+            std::fprintf(stderr, "Unknown option %s\n", option.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<Measurement> measurements;
+    std::vector<StorageMeasurement> storages;
+    for (std::size_t size : sizes){
+        NameGenerator names(seed);
+        // A few extra entries are made to be added and removed during the benchmark
+        std::size_t extra = std::min(operations, size);
+        std::vector<AddressBook::Entry> entries = makeEntries(size + extra, names);
+        std::vector<AddressBook::Entry> extra_entries(entries.end() - static_cast<std::ptrdiff_t>(extra), entries.end());
+        entries.resize(size);
+
+        std::vector<std::string> keys;
+        keys.reserve(operations);
+        std::vector<std::string> prefixes;
+        std::vector<std::string> typos;
+        std::vector<std::string> phone_numbers;
+        std::vector<AddressBook::Entry> query_entries;
+        prefixes.reserve(operations);
+        for (std::size_t i = 0 ; i<operations ; i++){
+            const AddressBook::Entry& entry = entries[std::uniform_int_distribution<std::size_t>(0, size - 1)(names.engine())];
+            keys.push_back(AddressBook::makeKey(entry.first_name, entry.last_name));
+            // Searches are the first two or three letters of a name, as typed into a search box
+            const std::string& name = (i % 2 == 0) ? entry.first_name : entry.last_name;
+            prefixes.push_back(name.substr(0, 2 + i % 2));
+            // A typo swaps two neighbouring letters of the name
+            std::string typo = name;
+            std::size_t position = i % (typo.size() - 1);
+            std::swap(typo[position], typo[position + 1]);
+            typos.push_back(typo);
+            phone_numbers.push_back(entry.phone_number);
+            query_entries.push_back(entry);
+        }
+
+        AddressBook book;
+        std::size_t heap_before_load = heapBytesInUse();
+        measurements.push_back(measure("bulk_load", size, 1, [&](std::size_t){
+            return book.addBatch(entries).rows_added;
+        }));
+        StorageMeasurement storage;
+        storage.book_size = size;
+        storage.address_book_bytes_per_entry = static_cast<double>(heapBytesInUse() - heap_before_load) / static_cast<double>(size);
+        measurements.push_back(measure("add", size, extra, [&](std::size_t i){
+            const AddressBook::Entry& entry = extra_entries[i];
+            return static_cast<std::size_t>(book.add(entry.first_name, entry.last_name, entry.phone_number)
+                                            == AddressBook::AddStatus::Inserted);
+        }));
+        measurements.push_back(measure("remove", size, extra, [&](std::size_t i){
+            const AddressBook::Entry& entry = extra_entries[i];
+            return static_cast<std::size_t>(book.removeExact(AddressBook::makeKey(entry.first_name, entry.last_name)));
+        }));
+        // The same changes again, made as one batch each
+        measurements.push_back(measure("batch_add", size, 1, [&](std::size_t){
+            AddressBook::WriteBatch batch;
+            for (const AddressBook::Entry& entry : extra_entries){
+                batch.add(entry.first_name, entry.last_name, entry.phone_number);
+            }
+            return book.apply(std::move(batch)).added;
+        }));
+        measurements.push_back(measure("batch_remove", size, 1, [&](std::size_t){
+            AddressBook::WriteBatch batch;
+            for (const AddressBook::Entry& entry : extra_entries){
+                batch.remove(AddressBook::makeKey(entry.first_name, entry.last_name));
+            }
+            return book.apply(std::move(batch)).removed;
+        }));
+        measurements.push_back(measure("lookup", size, operations, [&](std::size_t i){
+            return static_cast<std::size_t>(book.lookup(keys[i]).has_value());
+        }));
+        measurements.push_back(measure("find_prefix", size, operations, [&](std::size_t i){
+            return book.find(prefixes[i]).size();
+        }));
+        // The first page of the same searches, which is all a search box shows at first
+        measurements.push_back(measure("find_first_page", size, operations, [&](std::size_t i){
+            return book.findPage(prefixes[i], 20).entries.size();
+        }));
+        // A caller ID lookup, with the whole number
+        measurements.push_back(measure("find_by_phone", size, operations, [&](std::size_t i){
+            return book.findByPhone(phone_numbers[i]).size();
+        }));
+        measurements.push_back(measure("find_fuzzy", size, operations, [&](std::size_t i){
+            return book.findFuzzy(typos[i], 2, 10).size();
+        }));
+        // Compound searches: both names starting with the same two letters as an entry's,
+        // and a last name along with the first four digits of a phone number
+        measurements.push_back(measure("query_two_prefixes", size, operations, [&](std::size_t i){
+            const AddressBook::Entry& entry = query_entries[i];
+            return book.query(AddressBook::Query().firstNameStartsWith(entry.first_name.substr(0, 2))
+                                                  .lastNameStartsWith(entry.last_name.substr(0, 2))).size();
+        }));
+        // The same search done by finding the first name prefix and filtering the results, as a caller without query would
+        measurements.push_back(measure("find_then_filter_two_prefixes", size, operations, [&](std::size_t i){
+            const AddressBook::Entry& entry = query_entries[i];
+            std::string first_prefix = collationKey(entry.first_name.substr(0, 2));
+            std::string last_prefix = collationKey(entry.last_name.substr(0, 2));
+            std::size_t count = 0;
+            for (const auto& match : book.find(entry.first_name.substr(0, 2))){
+                count += collationKey(match.second.first_name).compare(0, first_prefix.size(), first_prefix) == 0
+                      && collationKey(match.second.last_name).compare(0, last_prefix.size(), last_prefix) == 0;
+            }
+            return count;
+        }));
+        measurements.push_back(measure("query_last_name_and_phone", size, operations, [&](std::size_t i){
+            const AddressBook::Entry& entry = query_entries[i];
+            return book.query(AddressBook::Query().lastNameIs(entry.last_name)
+                                                  .phoneNumberStartsWith(entry.phone_number.substr(0, 4))).size();
+        }));
+        // Autocomplete as the user types one to four letters of a name, which asks for the same short prefixes again and again
+        measurements.push_back(measure("suggest_typing", size, operations, [&](std::size_t i){
+            const AddressBook::Entry& entry = query_entries[i];
+            const std::string& name = (i % 2 == 0) ? entry.first_name : entry.last_name;
+            return book.suggest(name.substr(0, 1 + i % 4), 10).size();
+        }));
+        // The user picks from the suggestions, mostly the same few hundred people
+        measurements.push_back(measure("record_use", size, operations, [&](std::size_t i){
+            return static_cast<std::size_t>(book.recordUse(keys[i % 200]));
+        }));
+        // A pick followed by the next search for that person, which the pick has just dropped from the cache
+        measurements.push_back(measure("record_use_then_suggest", size, operations, [&](std::size_t i){
+            const AddressBook::Entry& entry = query_entries[i % 200];
+            book.recordUse(keys[i % 200]);
+            return book.suggest(entry.first_name.substr(0, 2), 10).size();
+        }));
+        // Listing the whole book is much slower than the other operations, so it is run fewer times
+        std::size_t listings = std::max<std::size_t>(1, std::min<std::size_t>(20, 10000000 / size));
+        measurements.push_back(measure("sorted_by_first_name", size, listings, [&](std::size_t){
+            return book.sortedByFirstName().size();
+        }));
+        measurements.push_back(measure("sorted_by_last_name", size, listings, [&](std::size_t){
+            return book.sortedByLastName().size();
+        }));
+        measurements.push_back(measure("list_by_first_name", size, listings, [&](std::size_t){
+            return book.listByFirstName().size();
+        }));
+        measurements.push_back(measure("list_by_last_name", size, listings, [&](std::size_t){
+            return book.listByLastName().size();
+        }));
+        measurements.push_back(measure("entries_by_first_name", size, listings, [&](std::size_t){
+            std::size_t count = 0;
+            for (const AddressBook::Entry& entry : book.entriesByFirstName()){
+                count += !entry.phone_number.empty();
+            }
+            return count;
+        }));
+        measurements.push_back(measure("entries_by_last_name", size, listings, [&](std::size_t){
+            std::size_t count = 0;
+            for (const AddressBook::Entry& entry : book.entriesByLastName()){
+                count += !entry.phone_number.empty();
+            }
+            return count;
+        }));
+        // Sorting every name three ways: by its bytes, which is quick but puts "Émile" after "Zoe",
+        // by folding both names on every comparison, and by folding each name once and then comparing the bytes of the keys
+        std::vector<std::string> full_names;
+        full_names.reserve(entries.size());
+        for (const AddressBook::Entry& entry : entries){
+            full_names.push_back(entry.first_name + " " + entry.last_name);
+        }
+        measurements.push_back(measure("sort_names_bytewise", size, listings, [&](std::size_t){
+            std::vector<std::string> sorted = full_names;
+            std::sort(sorted.begin(), sorted.end());
+            return sorted.size();
+        }));
+        measurements.push_back(measure("sort_names_collating_each_comparison", size, listings, [&](std::size_t){
+            std::vector<std::string> sorted = full_names;
+            std::sort(sorted.begin(), sorted.end(), [](const std::string& a, const std::string& b){
+                return collationKey(a) < collationKey(b);
+            });
+            return sorted.size();
+        }));
+        measurements.push_back(measure("sort_names_collation_keys", size, listings, [&](std::size_t){
+            std::vector<std::pair<std::string,const std::string*>> sorted;
+            sorted.reserve(full_names.size());
+            for (const std::string& name : full_names){
+                sorted.emplace_back(collationKey(name), &name);
+            }
+            std::sort(sorted.begin(), sorted.end());
+            return sorted.size();
+        }));
+
+        // A stored copy of the book and a replica of it in memory. Once the replica has caught up, the extra entries are added
+        // to the stored book, and the replica catches up with just those changes. The changes are not compacted yet,
+        // so they are read from the journal. Diffing the two books afterwards walks both in full, whatever changed
+        char directory[] = "/tmp/address_book_bench_XXXXXX";
+        if (mkdtemp(directory) == nullptr){
+            std::perror("mkdtemp");
+            return 1;
+        }
+        std::string primary_path = std::string(directory) + "/address_book.dat";
+        {
+            AddressBook primary(primary_path);
+            primary.addBatch(entries);
+            primary.compact();
+            AddressBook replica;
+            measurements.push_back(measure("replica_initial_sync", size, 1, [&](std::size_t){
+                return replica.catchUp(primary_path);
+            }));
+            primary.addBatch(extra_entries);
+            measurements.push_back(measure("replica_catch_up", size, 1, [&](std::size_t){
+                return replica.catchUp(primary_path);
+            }));
+            measurements.push_back(measure("diff_books", size, 1, [&](std::size_t){
+                AddressBook::Diff difference = book.diff(replica);
+                return difference.added.size() + difference.removed.size() + difference.changed.size();
+            }));
+            primary.compact();
+            primary.discardChanges(primary.sequence());
+        }
+        // Opening the stored book again. It is usable once open, while its indexes are built on another thread,
+        // so the first find after opening also waits for those to be finished
+        {
+            std::unique_ptr<AddressBook> reopened;
+            measurements.push_back(measure("open_stored_book", size, 1, [&](std::size_t){
+                reopened = std::make_unique<AddressBook>(primary_path);
+                return static_cast<std::size_t>(reopened->contains(keys[0]));
+            }));
+            measurements.push_back(measure("first_find_after_open", size, 1, [&](std::size_t){
+                return reopened->find(prefixes[0]).size();
+            }));
+        }
+        unlink(primary_path.c_str());
+        unlink((primary_path + ".journal").c_str());
+        rmdir(directory);
+
+        storages.push_back(storage);
+        // The scan reads every name and phone number, which is what a full scan (an export or a filter) does
+        measurements.push_back(measure("scan_address_book", size, listings, [&](std::size_t){
+            std::size_t characters = 0;
+            for (const AddressBook::Entry& entry : book.entriesByKey()){
+                characters += entry.first_name.size() + entry.last_name.size() + entry.phone_number.size();
+            }
+            return characters;
+        }));
+    }
+
+    std::printf("{\n  \"benchmark\": \"address_book\",\n  \"seed\": %llu,\n  \"results\": [\n",
+                static_cast<unsigned long long>(seed));
+    for (std::size_t i = 0 ; i<measurements.size() ; i++){
+        printMeasurement(measurements[i], i + 1 == measurements.size());
+    }
+    std::printf("  ],\n  \"storage\": [\n");
+    for (std::size_t i = 0 ; i<storages.size() ; i++){
+        std::printf("    {\"book_size\": %zu, \"address_book_bytes_per_entry\": %.1f}%s\n",
+                    storages[i].book_size, storages[i].address_book_bytes_per_entry, i + 1 == storages.size() ? "" : ",");
+    }
+    std::printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,384 @@
+// A load generator for the address book server (address_book_console --serve).
+//
+// Fills the book with synthetic entries, then opens many connections and keeps a number of pipelined requests
+// in flight on each of them for a fixed time: mostly exact lookups and prefix finds, with a few adds and removes.
+// Every request is timed from being written to its reply arriving, and the throughput and latency percentiles
+// are written to stdout as JSON, like address_book_bench.
+//
+// It only talks to the server over its socket, so it is compiled on its own:
+// g++ -O2 -std=c++17 bench/address_book_loadgen.cpp -o address_book_loadgen
+//
+// Usage: address_book_loadgen --address unix:<path>|[<host>:]<port> [--connections 256] [--pipeline 8]
+//                             [--seconds 10] [--entries 100000] [--write-percent 5] [--seed 1]
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char* const first_names[] = {
+    "James", "Mary", "John", "Patricia", "Robert", "Jennifer", "Michael", "Linda", "William", "Elizabeth",
+    "David", "Barbara", "Richard", "Susan", "Joseph", "Jessica", "Thomas", "Sarah", "Charles", "Karen",
+    "Oliver", "Amelia", "Harry", "Isla", "Noah", "Ava", "Leo", "Mia", "Oscar", "Ivy",
+    "Mohammed", "Fatima", "Wei", "Aisha", "Hiroshi", "Yuki", "Priya", "Arjun", "Sofia", "Mateo"
+};
+
+const char* const syllables[] = {
+    "ab", "al", "an", "ar", "ba", "be", "bro", "car", "chen", "da", "den", "do", "el", "er", "fer", "field",
+    "ford", "gar", "gon", "ham", "har", "hill", "in", "jo", "kin", "la", "lee", "ley", "lin", "ma", "mar", "mer",
+    "mont", "mor", "na", "ne", "ni", "no", "o", "par", "per", "ra", "ri", "ro", "san", "sen", "son", "ston",
+    "ta", "ter", "ton", "tra", "va", "ven", "ver", "wa", "well", "wen", "win", "wood", "wright", "ya", "zi", "zo"
+};
+
+const std::size_t first_name_count = sizeof(first_names) / sizeof(first_names[0]);
+const std::size_t syllable_count = sizeof(syllables) / sizeof(syllables[0]);
+
+// Entry number i gets a first name from the list and a last name spelling out i / first_name_count in syllables,
+// so every entry has a different name
+std::string firstName(std::size_t i)
+{
+    return first_names[i % first_name_count];
+}
+
+std::string lastName(std::size_t i)
+{
+    std::size_t rest = i / first_name_count;
+    std::string name;
+    do{
+        name += syllables[rest % syllable_count];
+        rest /= syllable_count;
+    } while (rest != 0);
+    name[0] = static_cast<char>(name[0] - 'a' + 'A');
+    return name;
+}
+
+int connectTo(const std::string& address)
+{
+    int connected = -1;
+    if (address.compare(0, 5, "unix:") == 0){
+        sockaddr_un socket_address{};
+        socket_address.sun_family = AF_UNIX;
+        std::string path = address.substr(5);
+        if (path.size() >= sizeof(socket_address.sun_path)){
+            throw std::runtime_error("The socket path is too long");
+        }
+        std::memcpy(socket_address.sun_path, path.c_str(), path.size() + 1);
+        connected = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connected >= 0 && connect(connected, reinterpret_cast<const sockaddr*>(&socket_address), sizeof(socket_address)) != 0){
+            close(connected);
+            connected = -1;
+        }
+    } else{
+        std::size_t colon = address.rfind(':');
+        std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+        std::string port = colon == std::string::npos ? address : address.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']'){
+            host = host.substr(1, host.size() - 2);
+        }
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+        if (error != 0){
+            throw std::runtime_error("Could not find " + address + ": " + gai_strerror(error));
+        }
+        connected = socket(found->ai_family, found->ai_socktype | SOCK_CLOEXEC, found->ai_protocol);
+        if (connected >= 0 && connect(connected, found->ai_addr, found->ai_addrlen) != 0){
+            close(connected);
+            connected = -1;
+        }
+        freeaddrinfo(found);
+        int enable = 1;
+        if (connected >= 0){
+            setsockopt(connected, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        }
+    }
+    if (connected < 0){
+        throw std::runtime_error("Could not connect to " + address + ": " + std::strerror(errno));
+    }
+    return connected;
+}
+
+void sendAll(int socket, const std::string& data)
+{
+    std::size_t offset = 0;
+    while (offset < data.size()){
+        ssize_t sent = send(socket, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (sent < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            throw std::runtime_error(std::string("Could not send: ") + std::strerror(errno));
+        }
+        offset += static_cast<std::size_t>(sent);
+    }
+}
+
+// Reads replies as they arrive and works out where each one ends.
+// A reply is one line, unless it is "OK <count>", in which case count lines of entries follow it
+class ReplyReader
+{
+public:
+    /// Take in received bytes and return how many replies they finished. Replies starting with ERR are counted in errors
+    std::size_t consume(const char* data, std::size_t size, std::size_t& errors)
+    {
+        std::size_t finished = 0;
+        for (std::size_t i = 0 ; i<size ; i++){
+            if (data[i] != '\n'){
+                if (this->line.size() < 32){
+                    this->line.push_back(data[i]);
+                }
+                continue;
+            }
+            if (this->entry_lines_left > 0){
+                this->entry_lines_left--;
+                finished += this->entry_lines_left == 0;
+            } else if (this->line.compare(0, 3, "OK ") == 0){
+                this->entry_lines_left = std::strtoull(this->line.c_str() + 3, nullptr, 10);
+                finished += this->entry_lines_left == 0;
+            } else{
+                errors += this->line.compare(0, 3, "ERR") == 0;
+                finished++;
+            }
+            this->line.clear();
+        }
+        return finished;
+    }
+
+private:
+    std::string line;
+    std::size_t entry_lines_left = 0;
+};
+
+struct Connection
+{
+    int socket = -1;
+    std::size_t number = 0;
+    std::string unsent;
+    std::size_t unsent_offset = 0;
+    std::deque<Clock::time_point> sent_at;
+    ReplyReader replies;
+    // The key of the entry this connection added last, which its next write removes again
+    std::string added_key;
+    std::size_t writes = 0;
+};
+
+struct Options
+{
+    std::string address;
+    std::size_t connections = 256;
+    std::size_t pipeline = 8;
+    double seconds = 10;
+    std::size_t entries = 100000;
+    unsigned write_percent = 5;
+    std::uint64_t seed = 1;
+};
+
+// Adds entries 0 to count - 1, a thousand requests at a time. Entries already in the book are rejected and left alone
+void fillBook(const Options& options)
+{
+    int socket = connectTo(options.address);
+    ReplyReader replies;
+    std::size_t errors = 0;
+    char buffer[64 * 1024];
+    for (std::size_t start = 0 ; start<options.entries ; start += 1000){
+        std::size_t end = std::min(options.entries, start + 1000);
+        std::string requests;
+        for (std::size_t i = start ; i<end ; i++){
+            requests += "ADD\t" + firstName(i) + "\t" + lastName(i) + "\t07" + std::to_string(100000000 + i) + "\n";
+        }
+        sendAll(socket, requests);
+        std::size_t waiting = end - start;
+        while (waiting > 0){
+            ssize_t received = recv(socket, buffer, sizeof(buffer), 0);
+            if (received <= 0){
+                throw std::runtime_error("The server closed the connection while the book was being filled");
+            }
+            waiting -= replies.consume(buffer, static_cast<std::size_t>(received), errors);
+        }
+    }
+    close(socket);
+}
+
+void queueRequest(Connection& connection, const Options& options, std::mt19937_64& random)
+{
+    std::uniform_int_distribution<std::size_t> pick_entry(0, options.entries == 0 ? 0 : options.entries - 1);
+    unsigned roll = std::uniform_int_distribution<unsigned>(0, 99)(random);
+    if (roll < options.write_percent || options.entries == 0){
+        // Writes add an entry of the connection's own and then remove it again, so the book stays the same size
+        if (connection.added_key.empty()){
+            // The process id keeps the names apart from those left behind by an earlier run
+            std::string first_name = "Load" + std::to_string(connection.number);
+            std::string last_name = "Run" + std::to_string(getpid()) + "n" + std::to_string(connection.writes++);
+            connection.unsent += "ADD\t" + first_name + "\t" + last_name + "\t0\n";
+            connection.added_key = first_name + " " + last_name;
+        } else{
+            connection.unsent += "REMOVE\t" + connection.added_key + "\n";
+            connection.added_key.clear();
+        }
+    } else if (roll % 2 == 0){
+        std::size_t i = pick_entry(random);
+        connection.unsent += "LOOKUP\t" + firstName(i) + " " + lastName(i) + "\n";
+    } else{
+        // A search box showing its first page for the first three letters of a last name
+        connection.unsent += "FIND\t" + lastName(pick_entry(random)).substr(0, 3) + "\t20\n";
+    }
+    connection.sent_at.push_back(Clock::now());
+}
+
+double percentile(const std::vector<double>& sorted_values, double fraction)
+{
+    if (sorted_values.empty()){
+        return 0;
+    }
+    return sorted_values[static_cast<std::size_t>(fraction * static_cast<double>(sorted_values.size() - 1) + 0.5)];
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1 ; i + 1<argc ; i += 2){
+        std::string option = argv[i];
+        if (option == "--address"){
+            options.address = argv[i + 1];
+        } else if (option == "--connections"){
+            options.connections = static_cast<std::size_t>(std::strtoull(argv[i + 1], nullptr, 10));
+        } else if (option == "--pipeline"){
+            options.pipeline = std::max<std::size_t>(1, std::strtoull(argv[i + 1], nullptr, 10));
+        } else if (option == "--seconds"){
+            options.seconds = std::strtod(argv[i + 1], nullptr);
+        } else if (option == "--entries"){
+            options.entries = static_cast<std::size_t>(std::strtoull(argv[i + 1], nullptr, 10));
+        } else if (option == "--write-percent"){
+            options.write_percent = static_cast<unsigned>(std::strtoul(argv[i + 1], nullptr, 10));
+        } else if (option == "--seed"){
+            options.seed = std::strtoull(argv[i + 1], nullptr, 10);
+        } else{
+            std::fprintf(stderr, "Unknown option %s\n", option.c_str());
+            return 1;
+        }
+    }
+    if (options.address.empty()){
+        std::fprintf(stderr, "Usage: %s --address unix:<path>|[<host>:]<port> [--connections 256] [--pipeline 8] "
+                             "[--seconds 10] [--entries 100000] [--write-percent 5] [--seed 1]\n", argv[0]);
+        return 1;
+    }
+
+    try{
+        fillBook(options);
+
+        int event_loop = epoll_create1(EPOLL_CLOEXEC);
+        std::vector<std::unique_ptr<Connection>> connections;
+        for (std::size_t i = 0 ; i<options.connections ; i++){
+            auto connection = std::make_unique<Connection>();
+            connection->socket = connectTo(options.address);
+            connection->number = i;
+            fcntl(connection->socket, F_SETFL, fcntl(connection->socket, F_GETFL) | O_NONBLOCK);
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLOUT;
+            event.data.ptr = connection.get();
+            epoll_ctl(event_loop, EPOLL_CTL_ADD, connection->socket, &event);
+            connections.push_back(std::move(connection));
+        }
+
+        // The first second warms up the server's caches and allocator and isn't counted
+        std::mt19937_64 random(options.seed);
+        std::vector<double> latencies_us;
+        std::size_t errors = 0;
+        std::size_t counted_errors = 0;
+        Clock::time_point start = Clock::now();
+        Clock::time_point measuring_from = start + std::chrono::seconds(1);
+        Clock::time_point end = measuring_from + std::chrono::duration_cast<Clock::duration>(
+                                                     std::chrono::duration<double>(options.seconds));
+        std::vector<epoll_event> events(options.connections);
+        char buffer[64 * 1024];
+        while (Clock::now() < end){
+            int count = epoll_wait(event_loop, events.data(), static_cast<int>(events.size()), 100);
+            for (int e = 0 ; e<count ; e++){
+                Connection& connection = *static_cast<Connection*>(events[e].data.ptr);
+                if (events[e].events & EPOLLIN){
+                    ssize_t received = recv(connection.socket, buffer, sizeof(buffer), 0);
+                    if (received == 0){
+                        throw std::runtime_error("The server closed a connection");
+                    }
+                    if (received > 0){
+                        std::size_t errors_before = errors;
+                        std::size_t finished = connection.replies.consume(buffer, static_cast<std::size_t>(received), errors);
+                        Clock::time_point now = Clock::now();
+                        for (std::size_t i = 0 ; i<finished ; i++){
+                            if (connection.sent_at.front() >= measuring_from){
+                                latencies_us.push_back(std::chrono::duration<double, std::micro>(now - connection.sent_at.front()).count());
+                            }
+                            connection.sent_at.pop_front();
+                        }
+                        if (now >= measuring_from){
+                            counted_errors += errors - errors_before;
+                        }
+                    }
+                }
+                // Top the pipeline back up and write every new request at once
+                while (connection.sent_at.size() < options.pipeline){
+                    queueRequest(connection, options, random);
+                }
+                while (connection.unsent_offset < connection.unsent.size()){
+                    ssize_t sent = send(connection.socket, connection.unsent.data() + connection.unsent_offset,
+                                        connection.unsent.size() - connection.unsent_offset, MSG_NOSIGNAL);
+                    if (sent <= 0){
+                        break;
+                    }
+                    connection.unsent_offset += static_cast<std::size_t>(sent);
+                }
+                if (connection.unsent_offset == connection.unsent.size()){
+                    connection.unsent.clear();
+                    connection.unsent_offset = 0;
+                }
+                epoll_event event{};
+                event.events = connection.unsent.empty() ? EPOLLIN : (EPOLLIN | EPOLLOUT);
+                event.data.ptr = &connection;
+                epoll_ctl(event_loop, EPOLL_CTL_MOD, connection.socket, &event);
+            }
+        }
+        double measured_seconds = std::chrono::duration<double>(Clock::now() - measuring_from).count();
+        for (const auto& connection : connections){
+            close(connection->socket);
+        }
+        close(event_loop);
+
+        std::sort(latencies_us.begin(), latencies_us.end());
+        std::printf("{\"benchmark\": \"address_book_server\", \"address\": \"%s\", \"connections\": %zu, \"pipeline\": %zu, "
+                    "\"entries\": %zu, \"write_percent\": %u, \"seconds\": %.1f, \"requests\": %zu, \"errors\": %zu, "
+                    "\"qps\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}\n",
+                    options.address.c_str(), options.connections, options.pipeline, options.entries, options.write_percent,
+                    measured_seconds, latencies_us.size(), counted_errors,
+                    measured_seconds > 0 ? static_cast<double>(latencies_us.size()) / measured_seconds : 0,
+                    percentile(latencies_us, 0.5), percentile(latencies_us, 0.9), percentile(latencies_us, 0.99),
+                    percentile(latencies_us, 0.999), latencies_us.empty() ? 0 : latencies_us.back());
+    } catch(std::exception& ex){
+        std::fprintf(stderr, "%s\n", ex.what());
+        return 1;
+    }
+    return 0;
+}
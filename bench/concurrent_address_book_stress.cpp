@@ -0,0 +1,356 @@
+// A stress test for ConcurrentAddressBook, meant to be run under ThreadSanitizer.
+//
+// Writer threads add, remove, alter, rename, batch and use entries of their own, while reader threads look entries up,
+// search, page through listings, run queries and suggestions, and walk the views under read(), all on one shared book.
+// Every entry's phone number starts with its first name and a '-', so a reader that sees an entry half changed notices.
+// Each writer is the only one to touch its entries, so it also checks that every call reports exactly what its own
+// record of those entries says it should, and readers check that the sequence number never goes backwards.
+// A summary is written to stdout as JSON, like address_book_bench, and the exit status is 1 if any check failed.
+//
+// The sources include their headers as "include/...", so -I must point at a directory in which include/ is this
+// repository. From the directory above a checkout named include, compile include/bench/concurrent_address_book_stress.cpp
+// together with include/concurrent_address_book.cpp, include/address_book.cpp, include/address_book_storage.cpp,
+// include/address_book_import.cpp, include/address_book_batch.cpp, include/address_book_query.cpp,
+// include/address_book_replication.cpp, include/address_book_suggest.cpp, include/name_normalization.cpp,
+// include/entry_table.cpp and include/address_book_metrics.cpp, using g++ -O1 -g -std=c++17 -pthread -fsanitize=thread -I.
+//
+// Usage: concurrent_address_book_stress [--writers 2] [--readers 4] [--seconds 5] [--entries 2000] [--seed 1]
+
+#include "include/concurrent_address_book.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options
+{
+    std::size_t writers = 2;
+    std::size_t readers = 4;
+    double seconds = 5;
+    // Entries that are there from the start and never change, and entries each writer works on
+    std::size_t entries = 2000;
+    std::uint64_t seed = 1;
+};
+
+// Failures are counted by every thread, and the first few are printed
+std::atomic<std::size_t> failures{0};
+std::mutex report_mutex;
+
+void fail(const std::string& what)
+{
+    if (failures.fetch_add(1) < 20){
+        std::lock_guard<std::mutex> lock(report_mutex);
+        std::fprintf(stderr, "%s\n", what.c_str());
+    }
+}
+
+bool isWhole(const AddressBook::Entry& entry)
+{
+    return entry.phone_number.compare(0, entry.first_name.size() + 1, entry.first_name + "-") == 0;
+}
+
+void checkWhole(const AddressBook::Entry& entry, const char* where)
+{
+    if (!isWhole(entry)){
+        fail(std::string(where) + " returned " + entry.first_name + " " + entry.last_name + " with the phone number "
+             + entry.phone_number);
+    }
+}
+
+template <typename Entries>
+void checkAllWhole(const Entries& entries, const char* where)
+{
+    for (const auto& entry : entries){
+        checkWhole(entry, where);
+    }
+}
+
+template <typename Key, typename Entry>
+void checkAllWhole(const std::map<Key,Entry>& entries, const char* where)
+{
+    for (const auto& entry : entries){
+        checkWhole(entry.second, where);
+    }
+}
+
+// A writer's entries are named W<writer>x<number>, and have the last name Churn, or Moved once they are renamed
+class Writer
+{
+public:
+    Writer(ConcurrentAddressBook& book, std::size_t number, std::size_t entries, std::uint64_t seed)
+        : book(book), number(number), states(entries, State::Absent), random(seed)
+    {
+    }
+
+    void run(const std::atomic<bool>& stop, std::atomic<std::size_t>& writes)
+    {
+        std::size_t done = 0;
+        std::uint64_t generation = 0;
+        while (!stop.load(std::memory_order_relaxed)){
+            std::size_t i = std::uniform_int_distribution<std::size_t>(0, this->states.size() - 1)(this->random);
+            State& state = this->states[i];
+            std::string phone_number = this->firstName(i) + "-" + std::to_string(++generation);
+            switch (std::uniform_int_distribution<int>(0, 5)(this->random)){
+                case 0:
+                {
+                    if (state == State::Moved){
+                        break;
+                    }
+                    AddressBook::AddStatus status = this->book.add(this->firstName(i), "Churn", phone_number);
+                    this->expect(status == (state == State::Absent ? AddressBook::AddStatus::Inserted
+                                                                   : AddressBook::AddStatus::Duplicate), "add", i);
+                    state = State::Churn;
+                }
+                    break;
+                case 1:
+                    this->expect(this->book.removeExact(this->key(i)) == (state != State::Absent), "removeExact", i);
+                    state = State::Absent;
+                    break;
+                case 2:
+                {
+                    AddressBook::EntryPatch patch;
+                    patch.phone_number = phone_number;
+                    AddressBook::AlterStatus status = this->book.alter(this->key(i), patch);
+                    this->expect(status == (state == State::Absent ? AddressBook::AlterStatus::NotFound
+                                                                   : AddressBook::AlterStatus::Altered), "alter", i);
+                }
+                    break;
+                case 3:
+                {
+                    if (state == State::Absent){
+                        break;
+                    }
+                    AddressBook::EntryPatch patch;
+                    patch.last_name = state == State::Churn ? "Moved" : "Churn";
+                    patch.phone_number = phone_number;
+                    this->expect(this->book.alter(this->key(i), patch) == AddressBook::AlterStatus::Altered, "rename", i);
+                    state = state == State::Churn ? State::Moved : State::Churn;
+                }
+                    break;
+                case 4:
+                {
+                    // Adds this entry if it is missing, or removes it, along with the one after it, in one batch
+                    std::size_t j = (i + 1) % this->states.size();
+                    if (j == i){
+                        break;
+                    }
+                    AddressBook::WriteBatch batch;
+                    for (std::size_t k : {i, j}){
+                        if (this->states[k] == State::Absent){
+                            batch.add(this->firstName(k), "Churn", this->firstName(k) + "-" + std::to_string(++generation));
+                        } else{
+                            batch.remove(this->key(k));
+                        }
+                    }
+                    this->expect(this->book.apply(std::move(batch)).committed, "apply", i);
+                    for (std::size_t k : {i, j}){
+                        this->states[k] = this->states[k] == State::Absent ? State::Churn : State::Absent;
+                    }
+                }
+                    break;
+                case 5:
+                    this->expect(this->book.recordUse(this->key(i)) == (state != State::Absent), "recordUse", i);
+                    break;
+            }
+            done++;
+        }
+        writes += done;
+    }
+
+private:
+    enum class State
+    {
+        Absent,
+        Churn,
+        Moved
+    };
+
+    std::string firstName(std::size_t i) const
+    {
+        return "W" + std::to_string(this->number) + "x" + std::to_string(i);
+    }
+
+    std::string key(std::size_t i) const
+    {
+        return this->firstName(i) + (this->states[i] == State::Moved ? " Moved" : " Churn");
+    }
+
+    void expect(bool as_expected, const char* operation, std::size_t i)
+    {
+        if (!as_expected){
+            fail(std::string(operation) + " of " + this->firstName(i) + " did not do what it should have");
+        }
+    }
+
+    ConcurrentAddressBook& book;
+    std::size_t number;
+    std::vector<State> states;
+    std::mt19937_64 random;
+};
+
+// Reads the stable entries, S<number> Keep, and anything the writers have put in
+void runReader(const ConcurrentAddressBook& book, const Options& options, std::uint64_t seed,
+          const std::atomic<bool>& stop, std::atomic<std::size_t>& reads)
+{
+    std::mt19937_64 random(seed);
+    std::uint64_t last_sequence = 0;
+    std::size_t done = 0;
+    while (!stop.load(std::memory_order_relaxed)){
+        std::size_t i = std::uniform_int_distribution<std::size_t>(0, options.entries - 1)(random);
+        std::size_t writer = std::uniform_int_distribution<std::size_t>(0, options.writers - 1)(random);
+        std::string writer_prefix = "W" + std::to_string(writer) + "x" + std::to_string(i % 10);
+        switch (std::uniform_int_distribution<int>(0, 8)(random)){
+            case 0:
+            {
+                std::optional<AddressBook::Entry> entry = book.lookup("S" + std::to_string(i) + " Keep");
+                if (!entry){
+                    fail("lookup lost S" + std::to_string(i) + " Keep");
+                } else{
+                    checkWhole(*entry, "lookup");
+                }
+                std::optional<AddressBook::Entry> churned = book.lookup("W" + std::to_string(writer) + "x" + std::to_string(i)
+                                                                       + " Churn");
+                if (churned){
+                    checkWhole(*churned, "lookup");
+                }
+            }
+                break;
+            case 1:
+                checkAllWhole(book.find(writer_prefix), "find");
+                break;
+            case 2:
+            {
+                AddressBook::Page page = book.findPage("W", 20);
+                checkAllWhole(page.entries, "findPage");
+                if (!page.resume_token.empty()){
+                    checkAllWhole(book.findPage("W", 20, page.resume_token).entries, "findPage");
+                }
+            }
+                break;
+            case 3:
+            {
+                AddressBook::Page page = book.pageByFirstName(50);
+                checkAllWhole(page.entries, "pageByFirstName");
+                checkAllWhole(book.pageByLastName(50, page.resume_token).entries, "pageByLastName");
+            }
+                break;
+            case 4:
+                checkAllWhole(book.suggest(writer_prefix.substr(0, 2), 10), "suggest");
+                break;
+            case 5:
+            {
+                std::map<std::string,AddressBook::Entry> stable = book.query(AddressBook::Query().lastNameIs("Keep"));
+                if (stable.size() != options.entries){
+                    fail("query found " + std::to_string(stable.size()) + " of the stable entries");
+                }
+                checkAllWhole(book.query(AddressBook::Query().lastNameIs("Moved")), "query");
+            }
+                break;
+            case 6:
+                checkAllWhole(book.findByPhone(std::to_string(i)), "findByPhone");
+                break;
+            case 7:
+            {
+                // Every view over the book has the same entries, as no change can happen while it is read
+                bool consistent = book.read([](const AddressBook& locked){
+                    std::size_t by_key = 0;
+                    std::size_t by_first_name = 0;
+                    std::size_t by_last_name = 0;
+                    for (const AddressBook::Entry& entry : locked.entriesByKey()){
+                        by_key += isWhole(entry) ? 1 : 0;
+                    }
+                    for (const AddressBook::Entry& entry : locked.entriesByFirstName()){
+                        by_first_name += isWhole(entry) ? 1 : 0;
+                    }
+                    for (const AddressBook::Entry& entry : locked.entriesByLastName()){
+                        by_last_name += isWhole(entry) ? 1 : 0;
+                    }
+                    return by_key == by_first_name && by_key == by_last_name;
+                });
+                if (!consistent){
+                    fail("the views under read() disagree");
+                }
+            }
+                break;
+            case 8:
+            {
+                std::uint64_t sequence = book.sequence();
+                if (sequence < last_sequence){
+                    fail("the sequence number went back from " + std::to_string(last_sequence) + " to "
+                         + std::to_string(sequence));
+                }
+                last_sequence = sequence;
+            }
+                break;
+        }
+        done++;
+    }
+    reads += done;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1 ; i + 1<argc ; i += 2){
+        std::string option = argv[i];
+        if (option == "--writers"){
+            options.writers = std::max<std::size_t>(1, std::strtoull(argv[i + 1], nullptr, 10));
+        } else if (option == "--readers"){
+            options.readers = static_cast<std::size_t>(std::strtoull(argv[i + 1], nullptr, 10));
+        } else if (option == "--seconds"){
+            options.seconds = std::strtod(argv[i + 1], nullptr);
+        } else if (option == "--entries"){
+            options.entries = std::max<std::size_t>(1, std::strtoull(argv[i + 1], nullptr, 10));
+        } else if (option == "--seed"){
+            options.seed = std::strtoull(argv[i + 1], nullptr, 10);
+        } else{
+            std::fprintf(stderr, "Unknown option %s\n", option.c_str());
+            return 1;
+        }
+    }
+
+    ConcurrentAddressBook book;
+    AddressBook::WriteBatch stable;
+    for (std::size_t i = 0 ; i<options.entries ; i++){
+        stable.add("S" + std::to_string(i), "Keep", "S" + std::to_string(i) + "-" + std::to_string(i));
+    }
+    book.apply(std::move(stable));
+
+    std::atomic<bool> stop{false};
+    std::atomic<std::size_t> writes{0};
+    std::atomic<std::size_t> reads{0};
+    std::vector<Writer> writers;
+    writers.reserve(options.writers);
+    for (std::size_t i = 0 ; i<options.writers ; i++){
+        writers.emplace_back(book, i, options.entries, options.seed + i);
+    }
+    std::vector<std::thread> threads;
+    for (Writer& writer : writers){
+        threads.emplace_back([&writer, &stop, &writes]{ writer.run(stop, writes); });
+    }
+    for (std::size_t i = 0 ; i<options.readers ; i++){
+        threads.emplace_back(runReader, std::cref(book), std::cref(options), options.seed + options.writers + i,
+                             std::cref(stop), std::ref(reads));
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    stop = true;
+    for (std::thread& thread : threads){
+        thread.join();
+    }
+
+    std::printf("{\"benchmark\": \"concurrent_address_book_stress\", \"writers\": %zu, \"readers\": %zu, \"seconds\": %.1f, "
+                "\"entries\": %zu, \"writes\": %zu, \"reads\": %zu, \"failures\": %zu}\n",
+                options.writers, options.readers, options.seconds, options.entries, writes.load(), reads.load(),
+                failures.load());
+    return failures.load() == 0 ? 0 : 1;
+}
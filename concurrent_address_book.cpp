@@ -0,0 +1,196 @@
+#include "include/concurrent_address_book.h"
+#include "include/name_normalization.h"
+#include <functional>
+#include <thread>
+
+namespace {
+
+// Each thread keeps using the same reader slot, worked out once from its id
+std::size_t readerSlotForThisThread(std::size_t slot_count)
+{
+    thread_local const std::size_t slot = std::hash<std::thread::id>()(std::this_thread::get_id());
+    return slot % slot_count;
+}
+
+}
+
+ConcurrentAddressBook::ReadLock::ReadLock(const ConcurrentAddressBook& book)
+    : mutex(book.reader_slots[readerSlotForThisThread(reader_slot_count)].mutex)
+{
+    this->mutex.lock_shared();
+}
+
+ConcurrentAddressBook::ReadLock::~ReadLock()
+{
+    this->mutex.unlock_shared();
+}
+
+ConcurrentAddressBook::WriteLock::WriteLock(ConcurrentAddressBook& book) : book(book)
+{
+    // The slots are always locked in the same order, so two writers can't deadlock
+    for (ReaderSlot& slot : this->book.reader_slots){
+        slot.mutex.lock();
+    }
+}
+
+ConcurrentAddressBook::WriteLock::~WriteLock()
+{
+    for (auto slot = this->book.reader_slots.rbegin() ; slot != this->book.reader_slots.rend() ; ++slot){
+        slot->mutex.unlock();
+    }
+}
+
+ConcurrentAddressBook::ConcurrentAddressBook(const std::string& path) : address_book(path)
+{
+}
+
+AddressBook::AddStatus ConcurrentAddressBook::add(std::string first_name, std::string last_name,
+                                                  std::string phone_number)
+{
+    // The names are cleaned up before the lock is taken to keep the time spent holding it short
+    removeWhitespaceInPlace(first_name);
+    removeWhitespaceInPlace(last_name);
+    WriteLock lock(*this);
+    return this->address_book.add(std::move(first_name), std::move(last_name), std::move(phone_number));
+}
+
+bool ConcurrentAddressBook::removeExact(const std::string& key)
+{
+    WriteLock lock(*this);
+    return this->address_book.removeExact(key);
+}
+
+AddressBook::AlterStatus ConcurrentAddressBook::alter(const std::string& key, const AddressBook::EntryPatch& patch)
+{
+    WriteLock lock(*this);
+    return this->address_book.alter(key, patch);
+}
+
+AddressBook::BatchResult ConcurrentAddressBook::apply(AddressBook::WriteBatch batch)
+{
+    WriteLock lock(*this);
+    return this->address_book.apply(std::move(batch));
+}
+
+std::optional<AddressBook::Entry> ConcurrentAddressBook::lookup(const std::string& key) const
+{
+    ReadLock lock(*this);
+    return this->address_book.lookup(key);
+}
+
+bool ConcurrentAddressBook::contains(const std::string& key) const
+{
+    ReadLock lock(*this);
+    return this->address_book.contains(key);
+}
+
+std::map<std::string,AddressBook::Entry> ConcurrentAddressBook::find(const std::string& name) const
+{
+    ReadLock lock(*this);
+    return this->address_book.find(name);
+}
+
+AddressBook::Page ConcurrentAddressBook::findPage(const std::string& name, std::size_t limit,
+                                                  const std::string& resume_token) const
+{
+    ReadLock lock(*this);
+    return this->address_book.findPage(name, limit, resume_token);
+}
+
+AddressBook::Page ConcurrentAddressBook::pageByFirstName(std::size_t limit, const std::string& resume_token) const
+{
+    ReadLock lock(*this);
+    return this->address_book.pageByFirstName(limit, resume_token);
+}
+
+AddressBook::Page ConcurrentAddressBook::pageByLastName(std::size_t limit, const std::string& resume_token) const
+{
+    ReadLock lock(*this);
+    return this->address_book.pageByLastName(limit, resume_token);
+}
+
+std::map<std::string,AddressBook::Entry> ConcurrentAddressBook::findByPhone(const std::string& number_prefix) const
+{
+    ReadLock lock(*this);
+    return this->address_book.findByPhone(number_prefix);
+}
+
+std::map<std::string,AddressBook::Entry> ConcurrentAddressBook::query(const AddressBook::Query& query) const
+{
+    ReadLock lock(*this);
+    return this->address_book.query(query);
+}
+
+std::vector<AddressBook::Entry> ConcurrentAddressBook::suggest(const std::string& prefix, std::size_t limit) const
+{
+    ReadLock lock(*this);
+    return this->address_book.suggest(prefix, limit);
+}
+
+bool ConcurrentAddressBook::recordUse(const std::string& key)
+{
+    WriteLock lock(*this);
+    return this->address_book.recordUse(key);
+}
+
+MetricsReport ConcurrentAddressBook::metrics() const
+{
+    ReadLock lock(*this);
+    return this->address_book.metrics();
+}
+
+std::map<std::string,AddressBook::Entry> ConcurrentAddressBook::sortedByFirstName() const
+{
+    ReadLock lock(*this);
+    return this->address_book.sortedByFirstName();
+}
+
+std::map<std::string,AddressBook::Entry> ConcurrentAddressBook::sortedByLastName() const
+{
+    ReadLock lock(*this);
+    return this->address_book.sortedByLastName();
+}
+
+std::vector<AddressBook::Entry> ConcurrentAddressBook::listByFirstName() const
+{
+    ReadLock lock(*this);
+    return this->address_book.listByFirstName();
+}
+
+std::vector<AddressBook::Entry> ConcurrentAddressBook::listByLastName() const
+{
+    ReadLock lock(*this);
+    return this->address_book.listByLastName();
+}
+
+void ConcurrentAddressBook::compact()
+{
+    // Readers could carry on during a compaction, but the journal must not change while the snapshot is written
+    WriteLock lock(*this);
+    this->address_book.compact();
+}
+
+void ConcurrentAddressBook::setRetainedSegments(std::size_t count)
+{
+    WriteLock lock(*this);
+    this->address_book.setRetainedSegments(count);
+}
+
+std::uint64_t ConcurrentAddressBook::sequence() const
+{
+    ReadLock lock(*this);
+    return this->address_book.sequence();
+}
+
+std::size_t ConcurrentAddressBook::catchUp(const std::string& primary_path)
+{
+    WriteLock lock(*this);
+    return this->address_book.catchUp(primary_path);
+}
+
+void ConcurrentAddressBook::discardChanges(std::uint64_t up_to_sequence)
+{
+    // Only files are deleted, but the lock keeps this from running during a compaction, which adds a segment
+    WriteLock lock(*this);
+    this->address_book.discardChanges(up_to_sequence);
+}
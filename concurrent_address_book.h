@@ -0,0 +1,143 @@
+#pragma once
+
+#include "address_book.h"
+#include <array>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+
+/// A thread-safe address book that can be shared between worker threads.
+/// Lookups take a read lock and can run on every thread at once,
+/// while add, removeExact, alter, apply and recordUse take the write lock and happen one at a time,
+/// so every change appears to happen at a single point between the reads around it.
+/// bench/concurrent_address_book_stress.cpp runs mixed reads and writes on one of these, for ThreadSanitizer to check.
+class ConcurrentAddressBook
+{
+public:
+    /// Create an empty address book that only lives in memory
+    ConcurrentAddressBook() = default;
+
+    /// Open the address book stored at path. See AddressBook(const std::string&).
+    explicit ConcurrentAddressBook(const std::string& path);
+
+    /// Add an entry. See AddressBook::add.
+    AddressBook::AddStatus add(std::string first_name, std::string last_name = "", std::string phone_number = "");
+
+    /// Remove the entry with exactly this key. Returns false if there isn't one.
+    bool removeExact(const std::string& key);
+
+    /// Change the details of the entry with exactly this key. See AddressBook::alter.
+    AddressBook::AlterStatus alter(const std::string& key, const AddressBook::EntryPatch& patch);
+
+    /// Make every change in a batch, or none of them. See AddressBook::apply.
+    /// Readers never see the batch half applied.
+    AddressBook::BatchResult apply(AddressBook::WriteBatch batch);
+
+    /// Return a copy of the entry with exactly this key, if there is one
+    std::optional<AddressBook::Entry> lookup(const std::string& key) const;
+
+    /// Return whether an entry has exactly this key
+    bool contains(const std::string& key) const;
+
+    /// Return all matching entries. See AddressBook::find.
+    std::map<std::string,AddressBook::Entry> find(const std::string& name) const;
+
+    /// Return a page of the entries that find would return. See AddressBook::findPage.
+    AddressBook::Page findPage(const std::string& name, std::size_t limit, const std::string& resume_token = "") const;
+
+    /// Return a page of entries in first name order. See AddressBook::pageByFirstName.
+    AddressBook::Page pageByFirstName(std::size_t limit, const std::string& resume_token = "") const;
+
+    /// Return a page of entries in last name order. See AddressBook::pageByLastName.
+    AddressBook::Page pageByLastName(std::size_t limit, const std::string& resume_token = "") const;
+
+    /// Return the entries whose phone number starts with these digits. See AddressBook::findByPhone.
+    std::map<std::string,AddressBook::Entry> findByPhone(const std::string& number_prefix) const;
+
+    /// Return the entries that meet every condition of a query. See AddressBook::query.
+    std::map<std::string,AddressBook::Entry> query(const AddressBook::Query&) const;
+
+    /// Return up to limit entries to complete a name being typed. See AddressBook::suggest.
+    std::vector<AddressBook::Entry> suggest(const std::string& prefix, std::size_t limit = 10) const;
+
+    /// Count a use of the entry with exactly this key, for suggest. See AddressBook::recordUse.
+    bool recordUse(const std::string& key);
+
+    /// Return all entries sorted by first names, keyed as AddressBook::sortedByFirstName keys them
+    std::map<std::string,AddressBook::Entry> sortedByFirstName() const;
+
+    /// Return all entries sorted by last names, keyed as AddressBook::sortedByLastName keys them
+    std::map<std::string,AddressBook::Entry> sortedByLastName() const;
+
+    /// Return copies of all entries in first name collation order. See AddressBook::listByFirstName.
+    std::vector<AddressBook::Entry> listByFirstName() const;
+
+    /// Return copies of all entries in last name collation order. See AddressBook::listByLastName.
+    std::vector<AddressBook::Entry> listByLastName() const;
+
+    /// Run function with the address book held in a read lock, so it can use the views without copying.
+    /// The function must not keep any views, pointers or references once it returns.
+    template <typename Function>
+    auto read(Function function) const
+    {
+        ReadLock lock(*this);
+        return function(static_cast<const AddressBook&>(this->address_book));
+    }
+
+    /// Return the usage statistics. See AddressBook::metrics.
+    MetricsReport metrics() const;
+
+    /// Fold the journal into a new snapshot. See AddressBook::compact.
+    void compact();
+
+    /// Set how many archived journal segments compact keeps. See AddressBook::setRetainedSegments.
+    void setRetainedSegments(std::size_t count);
+
+    /// The sequence number of the last change. See AddressBook::sequence.
+    std::uint64_t sequence() const;
+
+    /// Bring this replica up to date with the address book stored at primary_path. See AddressBook::catchUp.
+    /// Readers see the book as it was before or after each change, never partway through one.
+    std::size_t catchUp(const std::string& primary_path);
+
+    /// Delete archived journal segments every replica has caught up past. See AddressBook::discardChanges.
+    void discardChanges(std::uint64_t up_to_sequence);
+
+private:
+    // Readers are spread over several locks, each on its own cache line, so that threads reading
+    // at the same time don't all write to the same lock word. A reader takes one of them
+    // (picked by its thread) in shared mode, and a writer takes all of them.
+    static const std::size_t reader_slot_count = 16;
+
+    struct alignas(64) ReaderSlot
+    {
+        std::shared_mutex mutex;
+    };
+
+    class ReadLock
+    {
+    public:
+        explicit ReadLock(const ConcurrentAddressBook&);
+        ~ReadLock();
+        ReadLock(const ReadLock&) = delete;
+        ReadLock& operator=(const ReadLock&) = delete;
+
+    private:
+        std::shared_mutex& mutex;
+    };
+
+    class WriteLock
+    {
+    public:
+        explicit WriteLock(ConcurrentAddressBook&);
+        ~WriteLock();
+        WriteLock(const WriteLock&) = delete;
+        WriteLock& operator=(const WriteLock&) = delete;
+
+    private:
+        ConcurrentAddressBook& book;
+    };
+
+    mutable std::array<ReaderSlot, reader_slot_count> reader_slots;
+    AddressBook address_book;
+};
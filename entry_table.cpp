@@ -0,0 +1,465 @@
+#include "include/entry_table.h"
+#include "include/name_normalization.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+using NameId = std::uint32_t;
+
+// The first name of a row not in use, and the folded name of a name only added as another's collation key
+const NameId no_name = std::numeric_limits<NameId>::max();
+const NameId unfolded = std::numeric_limits<NameId>::max();
+
+// Where the phone number of a row without one is stored
+const std::uint32_t no_phone_number = std::numeric_limits<std::uint32_t>::max();
+
+// Names are copied into blocks of this size, apart from any too long for one, which get a block of their own
+const std::size_t name_block_size = 1 << 16;
+
+// Freed names and phone numbers are only copied away once they take up at least this much
+const std::size_t minimum_reclaimed_bytes = 1 << 16;
+
+// Phone numbers are usually made of only digits and a little punctuation.
+// Each of those characters gets a 4-bit code, so two of them fit in a byte. Anything else is stored as typed
+const char phone_characters[] = "0123456789 +-().";
+
+int phoneCode(char c)
+{
+    const char* position = std::strchr(phone_characters, c);
+    if (c == '\0' || position == nullptr){
+        return -1;
+    }
+    return static_cast<int>(position - phone_characters);
+}
+
+// A stored phone number starts with its length shifted up a bit, with the bottom bit set if it is packed,
+// written 7 bits to a byte with the top bit set on every byte but the last. Nearly every number needs one byte for it
+std::size_t readHeader(const unsigned char* stored, std::size_t& length, bool& packed)
+{
+    std::size_t header = 0;
+    std::size_t size = 0;
+    for (int shift = 0 ; ; shift += 7){
+        unsigned char byte = stored[size++];
+        header |= static_cast<std::size_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0){
+            break;
+        }
+    }
+    length = header >> 1;
+    packed = (header & 1) != 0;
+    return size;
+}
+
+// Reads the characters of a stored phone number one at a time, so its digits can be compared without unpacking it
+class StoredPhoneNumber
+{
+public:
+    explicit StoredPhoneNumber(const unsigned char* stored)
+    {
+        if (stored != nullptr){
+            this->characters = stored + readHeader(stored, this->length, this->packed);
+        }
+    }
+
+    // The next digit, or '\0' once there are no more
+    char nextDigit()
+    {
+        while (this->position < this->length){
+            char c = this->at(this->position++);
+            if (c >= '0' && c <= '9'){
+                return c;
+            }
+        }
+        return '\0';
+    }
+
+    std::size_t size() const
+    {
+        return this->length;
+    }
+
+    char at(std::size_t i) const
+    {
+        if (!this->packed){
+            return static_cast<char>(this->characters[i]);
+        }
+        unsigned char codes = this->characters[i / 2];
+        return phone_characters[i % 2 == 0 ? codes >> 4 : codes & 0x0F];
+    }
+
+private:
+    const unsigned char* characters = nullptr;
+    std::size_t length = 0;
+    bool packed = false;
+    std::size_t position = 0;
+};
+
+// The bytes a stored phone number takes, including its header
+std::size_t storedSize(const unsigned char* stored)
+{
+    std::size_t length;
+    bool packed;
+    std::size_t header_size = readHeader(stored, length, packed);
+    return header_size + (packed ? (length + 1) / 2 : length);
+}
+
+// Compares the digits of a stored phone number with digits, or only with as many of its digits as there are in digits
+// if prefix is set
+int compareDigits(StoredPhoneNumber phone_number, std::string_view digits, bool prefix)
+{
+    for (char digit : digits){
+        char next = phone_number.nextDigit();
+        if (next != digit){
+            return next < digit ? -1 : 1;
+        }
+    }
+    return prefix || phone_number.nextDigit() == '\0' ? 0 : 1;
+}
+
+}
+
+int EntryTable::Key::compare(const Key& other) const
+{
+    // The keys are compared a piece at a time, as if each were built: first name, then a space if there is a last name,
+    // then the last name
+    const std::string_view own_pieces[] = {this->first_name, this->last_name.empty() ? "" : " ", this->last_name};
+    const std::string_view other_pieces[] = {other.first_name, other.last_name.empty() ? "" : " ", other.last_name};
+    std::size_t own_next = 0;
+    std::size_t other_next = 0;
+    std::string_view own;
+    std::string_view others;
+    while (true){
+        while (own.empty() && own_next < 3){
+            own = own_pieces[own_next++];
+        }
+        while (others.empty() && other_next < 3){
+            others = other_pieces[other_next++];
+        }
+        if (own.empty() || others.empty()){
+            return own.empty() ? (others.empty() ? 0 : -1) : 1;
+        }
+        std::size_t length = std::min(own.size(), others.size());
+        int comparison = own.substr(0, length).compare(others.substr(0, length));
+        if (comparison != 0){
+            return comparison;
+        }
+        own.remove_prefix(length);
+        others.remove_prefix(length);
+    }
+}
+
+EntryTable::Row EntryTable::insert(std::string_view first_name, std::string_view last_name, std::string_view phone_number)
+{
+    Row row;
+    if (this->free_rows.empty()){
+        if (this->first_names.size() >= std::numeric_limits<Row>::max()){
+            throw std::length_error("The address book has too many entries");
+        }
+        row = static_cast<Row>(this->first_names.size());
+        this->first_names.push_back(no_name);
+        this->last_names.push_back(no_name);
+        this->phone_numbers.push_back(no_phone_number);
+    } else{
+        row = this->free_rows.back();
+        this->free_rows.pop_back();
+    }
+    this->first_names[row] = this->intern(first_name);
+    this->last_names[row] = this->intern(last_name);
+    this->phone_numbers[row] = this->storePhoneNumber(phone_number);
+    return row;
+}
+
+void EntryTable::erase(Row row)
+{
+    this->release(this->first_names[row]);
+    this->release(this->last_names[row]);
+    this->freePhoneNumber(row);
+    this->first_names[row] = no_name;
+    this->last_names[row] = no_name;
+    this->phone_numbers[row] = no_phone_number;
+    this->free_rows.push_back(row);
+    this->reclaimNameSpace();
+    this->reclaimPhoneSpace();
+}
+
+void EntryTable::rename(Row row, std::string_view first_name, std::string_view last_name)
+{
+    // The new names are added before the old ones are released, as they may be the same names
+    NameId old_first_name = this->first_names[row];
+    NameId old_last_name = this->last_names[row];
+    this->first_names[row] = this->intern(first_name);
+    this->last_names[row] = this->intern(last_name);
+    this->release(old_first_name);
+    this->release(old_last_name);
+    this->reclaimNameSpace();
+}
+
+void EntryTable::setPhoneNumber(Row row, std::string_view phone_number)
+{
+    std::uint32_t stored = this->storePhoneNumber(phone_number);
+    this->freePhoneNumber(row);
+    this->phone_numbers[row] = stored;
+    this->reclaimPhoneSpace();
+}
+
+std::size_t EntryTable::size() const
+{
+    return this->first_names.size() - this->free_rows.size();
+}
+
+std::string_view EntryTable::firstName(Row row) const
+{
+    return this->text(this->first_names[row]);
+}
+
+std::string_view EntryTable::lastName(Row row) const
+{
+    return this->text(this->last_names[row]);
+}
+
+EntryTable::Key EntryTable::key(Row row) const
+{
+    return Key{this->firstName(row), this->lastName(row)};
+}
+
+std::string_view EntryTable::foldedFirstName(Row row) const
+{
+    return this->text(this->names[this->first_names[row]].folded);
+}
+
+std::string_view EntryTable::foldedLastName(Row row) const
+{
+    return this->text(this->names[this->last_names[row]].folded);
+}
+
+void EntryTable::readPhoneNumber(Row row, std::string& phone_number) const
+{
+    phone_number.clear();
+    if (this->phone_numbers[row] == no_phone_number){
+        return;
+    }
+    StoredPhoneNumber stored(&this->phone_bytes[this->phone_numbers[row]]);
+    phone_number.resize(stored.size());
+    for (std::size_t i = 0 ; i<stored.size() ; i++){
+        phone_number[i] = stored.at(i);
+    }
+}
+
+std::string EntryTable::phoneNumber(Row row) const
+{
+    std::string phone_number;
+    this->readPhoneNumber(row, phone_number);
+    return phone_number;
+}
+
+int EntryTable::comparePhoneDigits(Row a, Row b) const
+{
+    StoredPhoneNumber first(this->phone_numbers[a] == no_phone_number ? nullptr : &this->phone_bytes[this->phone_numbers[a]]);
+    StoredPhoneNumber second(this->phone_numbers[b] == no_phone_number ? nullptr : &this->phone_bytes[this->phone_numbers[b]]);
+    while (true){
+        char first_digit = first.nextDigit();
+        char second_digit = second.nextDigit();
+        if (first_digit != second_digit){
+            return first_digit < second_digit ? -1 : 1;
+        }
+        if (first_digit == '\0'){
+            return 0;
+        }
+    }
+}
+
+int EntryTable::comparePhoneDigits(Row row, std::string_view digits) const
+{
+    std::uint32_t stored = this->phone_numbers[row];
+    return compareDigits(StoredPhoneNumber(stored == no_phone_number ? nullptr : &this->phone_bytes[stored]), digits, false);
+}
+
+bool EntryTable::phoneDigitsStartWith(Row row, std::string_view digits) const
+{
+    std::uint32_t stored = this->phone_numbers[row];
+    return compareDigits(StoredPhoneNumber(stored == no_phone_number ? nullptr : &this->phone_bytes[stored]), digits, true) == 0;
+}
+
+bool EntryTable::hasPhoneDigits(Row row) const
+{
+    std::uint32_t stored = this->phone_numbers[row];
+    return stored != no_phone_number && StoredPhoneNumber(&this->phone_bytes[stored]).nextDigit() != '\0';
+}
+
+std::size_t EntryTable::bytesUsed() const
+{
+    // Each element of name_ids is a node of its own, holding the element and a pointer to the next node,
+    // and the map keeps a pointer per bucket
+    return this->first_names.capacity() * sizeof(NameId) + this->last_names.capacity() * sizeof(NameId)
+         + this->phone_numbers.capacity() * sizeof(std::uint32_t) + this->free_rows.capacity() * sizeof(Row)
+         + this->names.capacity() * sizeof(Name) + this->free_names.capacity() * sizeof(NameId)
+         + this->name_ids.size() * (sizeof(std::pair<const std::string_view,NameId>) + 2 * sizeof(void*))
+         + this->name_ids.bucket_count() * sizeof(void*)
+         + this->name_blocks.capacity() * sizeof(this->name_blocks[0]) + this->name_block_bytes
+         + this->phone_bytes.capacity();
+}
+
+EntryTable::NameId EntryTable::intern(std::string_view name)
+{
+    NameId id = this->addName(name);
+    if (this->names[id].folded == unfolded){
+        // Most names are already in their folded form or share it with many others, so it is only worked out once per name
+        std::string folded_name = collationKey(name);
+        NameId folded = folded_name == name ? id : this->addName(folded_name);
+        this->names[id].folded = folded;
+    }
+    return id;
+}
+
+EntryTable::NameId EntryTable::addName(std::string_view name)
+{
+    auto existing = this->name_ids.find(name);
+    if (existing != this->name_ids.end()){
+        this->names[existing->second].uses++;
+        return existing->second;
+    }
+    const char* text = "";
+    if (!name.empty()){
+        if (name.size() > name_block_size){
+            // The block goes before the one names are being added to, which stays the last
+            auto position = this->name_blocks.end();
+            if (this->name_blocks.empty()){
+                this->used_in_last_block = name_block_size;
+            } else{
+                --position;
+            }
+            char* destination = this->name_blocks.insert(position, std::unique_ptr<char[]>(new char[name.size()]))->get();
+            this->name_block_bytes += name.size();
+            std::memcpy(destination, name.data(), name.size());
+            text = destination;
+        } else{
+            if (this->name_blocks.empty() || this->used_in_last_block + name.size() > name_block_size){
+                this->name_blocks.emplace_back(new char[name_block_size]);
+                this->name_block_bytes += name_block_size;
+                this->used_in_last_block = 0;
+            }
+            char* destination = this->name_blocks.back().get() + this->used_in_last_block;
+            std::memcpy(destination, name.data(), name.size());
+            this->used_in_last_block += name.size();
+            text = destination;
+        }
+        this->stored_name_bytes += name.size();
+    }
+    NameId id;
+    if (this->free_names.empty()){
+        if (this->names.size() >= no_name){
+            throw std::length_error("The address book has too many names");
+        }
+        id = static_cast<NameId>(this->names.size());
+        this->names.push_back(Name());
+    } else{
+        id = this->free_names.back();
+        this->free_names.pop_back();
+    }
+    this->names[id] = Name{text, static_cast<std::uint32_t>(name.size()), 1, unfolded};
+    this->name_ids.emplace(std::string_view(text, name.size()), id);
+    return id;
+}
+
+void EntryTable::release(NameId id)
+{
+    Name& name = this->names[id];
+    if (--name.uses != 0){
+        return;
+    }
+    NameId folded = name.folded;
+    this->name_ids.erase(std::string_view(name.text, name.length));
+    this->free_name_bytes += name.length;
+    this->free_names.push_back(id);
+    if (folded != unfolded && folded != id){
+        this->release(folded);
+    }
+}
+
+std::string_view EntryTable::text(NameId id) const
+{
+    return std::string_view(this->names[id].text, this->names[id].length);
+}
+
+void EntryTable::reclaimNameSpace()
+{
+    if (this->free_name_bytes < minimum_reclaimed_bytes || this->free_name_bytes < this->stored_name_bytes - this->free_name_bytes){
+        return;
+    }
+    std::vector<std::unique_ptr<char[]>> old_blocks = std::move(this->name_blocks);
+    this->name_blocks.clear();
+    this->name_block_bytes = 0;
+    this->stored_name_bytes = 0;
+    this->free_name_bytes = 0;
+    this->name_ids.clear();
+    for (NameId id = 0 ; id<this->names.size() ; id++){
+        Name& name = this->names[id];
+        if (name.uses == 0){
+            continue;
+        }
+        // The name is added again as if it were new, and keeps its id and uses
+        std::uint32_t uses = name.uses;
+        NameId folded = name.folded;
+        this->free_names.push_back(id);
+        this->addName(std::string_view(name.text, name.length));
+        this->names[id].uses = uses;
+        this->names[id].folded = folded;
+    }
+}
+
+std::uint32_t EntryTable::storePhoneNumber(std::string_view phone_number)
+{
+    if (phone_number.empty()){
+        return no_phone_number;
+    }
+    bool packed = std::all_of(phone_number.begin(), phone_number.end(), [](char c){ return phoneCode(c) >= 0; });
+    std::size_t header = phone_number.size() << 1 | (packed ? 1 : 0);
+    std::size_t start = this->phone_bytes.size();
+    if (start + 10 + phone_number.size() >= no_phone_number){
+        throw std::length_error("The address book has too many phone numbers");
+    }
+    do{
+        unsigned char byte = header & 0x7F;
+        header >>= 7;
+        this->phone_bytes.push_back(static_cast<unsigned char>(byte | (header != 0 ? 0x80 : 0)));
+    } while (header != 0);
+    if (packed){
+        for (std::size_t i = 0 ; i<phone_number.size() ; i += 2){
+            int high = phoneCode(phone_number[i]);
+            int low = i + 1 < phone_number.size() ? phoneCode(phone_number[i + 1]) : 0;
+            this->phone_bytes.push_back(static_cast<unsigned char>(high << 4 | low));
+        }
+    } else{
+        this->phone_bytes.insert(this->phone_bytes.end(), phone_number.begin(), phone_number.end());
+    }
+    return static_cast<std::uint32_t>(start);
+}
+
+void EntryTable::freePhoneNumber(Row row)
+{
+    if (this->phone_numbers[row] != no_phone_number){
+        this->free_phone_bytes += storedSize(&this->phone_bytes[this->phone_numbers[row]]);
+    }
+}
+
+void EntryTable::reclaimPhoneSpace()
+{
+    if (this->free_phone_bytes < minimum_reclaimed_bytes || this->free_phone_bytes < this->phone_bytes.size() - this->free_phone_bytes){
+        return;
+    }
+    std::vector<unsigned char> kept;
+    kept.reserve(this->phone_bytes.size() - this->free_phone_bytes);
+    for (Row row = 0 ; row<this->phone_numbers.size() ; row++){
+        if (this->first_names[row] == no_name || this->phone_numbers[row] == no_phone_number){
+            continue;
+        }
+        const unsigned char* stored = &this->phone_bytes[this->phone_numbers[row]];
+        this->phone_numbers[row] = static_cast<std::uint32_t>(kept.size());
+        kept.insert(kept.end(), stored, stored + storedSize(stored));
+    }
+    this->phone_bytes = std::move(kept);
+    this->free_phone_bytes = 0;
+}
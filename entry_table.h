@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// The entries of an address book, stored as columns rather than as an object per entry.
+/// An entry is a row: the ids of its first and last names and where its phone number is stored.
+/// Every distinct name is stored once, along with its collation key, so a common name costs 4 bytes per entry,
+/// and phone numbers made of digits and the usual punctuation are packed two characters to a byte.
+/// A row keeps its number for as long as its entry is in the table, even when the entry is renamed,
+/// so the address book's indexes hold rows rather than copies of keys or pointers to entries.
+/// The row of an erased entry is given to a later one.
+class EntryTable
+{
+public:
+    using Row = std::uint32_t;
+
+    /// An entry's key ("*first name* *last name*", or "*first name*" if there's no last name) held as its two names,
+    /// so that keys can be compared without being built. Any key can be held as {key, ""}
+    struct Key
+    {
+        std::string_view first_name;
+        std::string_view last_name;
+
+        /// Compare the keys as the strings they stand for, as std::string::compare does
+        int compare(const Key& other) const;
+    };
+
+    /// Add an entry and return its row
+    Row insert(std::string_view first_name, std::string_view last_name, std::string_view phone_number);
+
+    /// Remove the entry in a row
+    void erase(Row);
+
+    /// Change the names of the entry in a row, which keeps its row
+    void rename(Row, std::string_view first_name, std::string_view last_name);
+
+    void setPhoneNumber(Row, std::string_view phone_number);
+
+    /// The number of entries
+    std::size_t size() const;
+
+    /// The names of the entry in a row. They are valid until an entry is next erased or renamed
+    std::string_view firstName(Row) const;
+    std::string_view lastName(Row) const;
+    Key key(Row) const;
+
+    /// The collation keys of the names (see collationKey in name_normalization.h),
+    /// worked out once for each distinct name rather than for each entry
+    std::string_view foldedFirstName(Row) const;
+    std::string_view foldedLastName(Row) const;
+
+    /// The phone number of the entry in a row, unpacked into phone_number, whose buffer is reused
+    void readPhoneNumber(Row, std::string& phone_number) const;
+    std::string phoneNumber(Row) const;
+
+    /// The digits of the phone number in a row (see phoneNumberDigits in name_normalization.h) are read
+    /// straight from the packed number by these, without unpacking it.
+    /// The comparisons return less than, equal to or more than 0, as std::string::compare does
+    int comparePhoneDigits(Row, Row) const;
+    int comparePhoneDigits(Row, std::string_view digits) const;
+    bool phoneDigitsStartWith(Row, std::string_view digits) const;
+    bool hasPhoneDigits(Row) const;
+
+    /// The number of bytes the table holds on the heap
+    std::size_t bytesUsed() const;
+
+private:
+    using NameId = std::uint32_t;
+
+    struct Name
+    {
+        const char* text;
+        std::uint32_t length;
+        // How many rows and other names (as their collation key) use this name. A name no longer used is freed
+        std::uint32_t uses;
+        // The name that is this name's collation key, which is often the name itself.
+        // A name only ever added as another's collation key hasn't had its own worked out
+        NameId folded;
+    };
+
+    /// Add a use of a name, adding the name if it is new, and make sure its collation key has been worked out
+    NameId intern(std::string_view);
+
+    /// Add a use of a name without working out its collation key
+    NameId addName(std::string_view);
+
+    /// Take away a use of a name, freeing it and its collation key if nothing else uses them
+    void release(NameId);
+
+    std::string_view text(NameId) const;
+
+    /// Copy the names still in use into new blocks once the freed ones take up more space than they do
+    void reclaimNameSpace();
+
+    /// Store a phone number at the end of phone_bytes and return where it starts
+    std::uint32_t storePhoneNumber(std::string_view);
+
+    /// Note that a row's phone number is no longer used, and copy the ones still used to a new buffer
+    /// once the unused ones take up more space than they do
+    void freePhoneNumber(Row);
+    void reclaimPhoneSpace();
+
+    // The columns. Row i is first_names[i], last_names[i] and phone_numbers[i],
+    // with a first name of no_name for a row not in use (see entry_table.cpp)
+    std::vector<NameId> first_names;
+    std::vector<NameId> last_names;
+    std::vector<std::uint32_t> phone_numbers;
+    std::vector<Row> free_rows;
+
+    std::vector<Name> names;
+    std::vector<NameId> free_names;
+    std::unordered_map<std::string_view,NameId> name_ids;
+    // The text of the names, in blocks that never move, so that name_ids and names can point into them
+    std::vector<std::unique_ptr<char[]>> name_blocks;
+    std::size_t used_in_last_block = 0;
+    std::size_t name_block_bytes = 0;
+    // The bytes taken by every name stored in the blocks, and those of them taken by names since freed
+    std::size_t stored_name_bytes = 0;
+    std::size_t free_name_bytes = 0;
+
+    // Each phone number is its length and whether it is packed (see entry_table.cpp), followed by its characters
+    std::vector<unsigned char> phone_bytes;
+    std::size_t free_phone_bytes = 0;
+};
@@ -0,0 +1,287 @@
+#include "include/name_normalization.h"
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+#if defined(__SSE2__)
+// A mask with 0xFF in every byte of the block that is whitespace
+inline __m128i whitespaceMask(__m128i block)
+{
+    __m128i is_space = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+    // \t, \n, \v, \f and \r are 9 to 13, so subtracting 9 leaves them (and only them) at 4 or less
+    __m128i shifted = _mm_sub_epi8(block, _mm_set1_epi8(9));
+    __m128i is_control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+    return _mm_or_si128(is_space, is_control);
+}
+#endif
+
+// U+00C0 to U+00FF with their accents taken off. '*' marks × and ÷, which are left as they are,
+// and a digit marks a letter that folds to two letters, kept in two_letter_folds
+const char latin_1_folds[] = "aaaaaa0ceeeeiiiidnooooo*ouuuuy12"
+                             "aaaaaa0ceeeeiiiidnooooo*ouuuuy1y";
+
+// U+0100 to U+017F (Latin Extended-A) with their accents taken off
+const char latin_extended_a_folds[] = "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiii33jjkkkllllllllll"
+                                      "nnnnnnnnnoooooo44rrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+
+const char* const two_letter_folds[] = {"ae", "th", "ss", "ij", "oe"};
+
+bool isAscii(std::string_view text)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for ( ; i + 16 <= text.size() ; i += 16){
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+        if (_mm_movemask_epi8(block) != 0){
+            return false;
+        }
+    }
+#endif
+    for ( ; i<text.size() ; i++){
+        if (static_cast<unsigned char>(text[i]) >= 0x80){
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads the UTF-8 character starting at text[i] into code_point and returns its length in bytes,
+// or 0 if it isn't a valid character (a stray continuation byte, a cut off sequence, an overlong form or a surrogate)
+std::size_t decodeUtf8(std::string_view text, std::size_t i, char32_t& code_point)
+{
+    unsigned char lead = static_cast<unsigned char>(text[i]);
+    std::size_t length;
+    char32_t minimum;
+    if (lead >= 0xC2 && lead <= 0xDF){
+        length = 2;
+        minimum = 0x80;
+        code_point = lead & 0x1F;
+    } else if (lead >= 0xE0 && lead <= 0xEF){
+        length = 3;
+        minimum = 0x800;
+        code_point = lead & 0x0F;
+    } else if (lead >= 0xF0 && lead <= 0xF4){
+        length = 4;
+        minimum = 0x10000;
+        code_point = lead & 0x07;
+    } else{
+        return 0;
+    }
+    if (i + length > text.size()){
+        return 0;
+    }
+    for (std::size_t k = 1 ; k<length ; k++){
+        unsigned char continuation = static_cast<unsigned char>(text[i + k]);
+        if ((continuation & 0xC0) != 0x80){
+            return 0;
+        }
+        code_point = (code_point << 6) | (continuation & 0x3F);
+    }
+    if (code_point < minimum || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF)){
+        return 0;
+    }
+    return length;
+}
+
+void appendUtf8(std::string& out, char32_t code_point)
+{
+    if (code_point < 0x800){
+        out.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+    } else{
+        out.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+    }
+    out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+}
+
+void appendLatinFold(std::string& out, char fold)
+{
+    if (fold >= '0' && fold <= '9'){
+        out += two_letter_folds[fold - '0'];
+    } else{
+        out.push_back(fold);
+    }
+}
+
+// Greek and Cyrillic letters in lower case and without their accents, or 0 for any other character
+char32_t foldGreekOrCyrillic(char32_t code_point)
+{
+    switch (code_point){
+        case 0x0386: case 0x03AC: return 0x03B1;
+        case 0x0388: case 0x03AD: return 0x03B5;
+        case 0x0389: case 0x03AE: return 0x03B7;
+        case 0x038A: case 0x03AA: case 0x03AF: case 0x03CA: case 0x0390: return 0x03B9;
+        case 0x038C: case 0x03CC: return 0x03BF;
+        case 0x038E: case 0x03AB: case 0x03CD: case 0x03CB: case 0x03B0: return 0x03C5;
+        case 0x038F: case 0x03CE: return 0x03C9;
+        // Final sigma
+        case 0x03C2: return 0x03C3;
+        // Ѐ, Ё, ѐ and ё are е with an accent
+        case 0x0400: case 0x0401: case 0x0450: case 0x0451: return 0x0435;
+        default: break;
+    }
+    if (code_point >= 0x0391 && code_point <= 0x03A9){
+        return code_point + 0x20;
+    }
+    if (code_point >= 0x03B1 && code_point <= 0x03C9){
+        return code_point;
+    }
+    if (code_point >= 0x0402 && code_point <= 0x040F){
+        return code_point + 0x50;
+    }
+    if (code_point >= 0x0410 && code_point <= 0x042F){
+        return code_point + 0x20;
+    }
+    if (code_point >= 0x0430 && code_point <= 0x045F){
+        return code_point;
+    }
+    return 0;
+}
+
+// Copies the text into out without its whitespace and returns where the copy ends
+char* copyWithoutWhitespace(const char* in, std::size_t length, char* out)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    // Most names have no whitespace at all, so whole blocks are copied in one go
+    // and only blocks that hold whitespace are looked at a byte at a time
+    for ( ; i + 16 <= length ; i += 16){
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        if (_mm_movemask_epi8(whitespaceMask(block)) == 0){
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), block);
+            out += 16;
+        } else{
+            for (std::size_t k = i ; k<i + 16 ; k++){
+                if (!isWhitespace(in[k])){
+                    *out++ = in[k];
+                }
+            }
+        }
+    }
+#endif
+    for ( ; i<length ; i++){
+        if (!isWhitespace(in[i])){
+            *out++ = in[i];
+        }
+    }
+    return out;
+}
+
+}
+
+bool isWhitespace(char c)
+{
+    return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+}
+
+bool isBlank(std::string_view text)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for ( ; i + 16 <= text.size() ; i += 16){
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+        if (_mm_movemask_epi8(whitespaceMask(block)) != 0xFFFF){
+            return false;
+        }
+    }
+#endif
+    for ( ; i<text.size() ; i++){
+        if (!isWhitespace(text[i])){
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string removeWhitespace(std::string_view text)
+{
+    std::string result(text.size(), '\0');
+    char* end = copyWithoutWhitespace(text.data(), text.size(), &result[0]);
+    result.resize(static_cast<std::size_t>(end - result.data()));
+    return result;
+}
+
+void removeWhitespaceInPlace(std::string& text)
+{
+    // The output never gets ahead of the input, so the text can be compacted over itself.
+    // A block is read into a register before it is stored, so the overlap is safe
+    char* end = copyWithoutWhitespace(text.data(), text.size(), &text[0]);
+    text.resize(static_cast<std::size_t>(end - text.data()));
+}
+
+std::string asciiToLower(std::string_view text)
+{
+    std::string result(text.size(), '\0');
+    const char* in = text.data();
+    char* out = &result[0];
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for ( ; i + 16 <= text.size() ; i += 16){
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        // Subtracting 'A' leaves the upper case letters (and only them) at 25 or less
+        __m128i shifted = _mm_sub_epi8(block, _mm_set1_epi8('A'));
+        __m128i is_upper = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(25)), shifted);
+        block = _mm_add_epi8(block, _mm_and_si128(is_upper, _mm_set1_epi8('a' - 'A')));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), block);
+    }
+#endif
+    for ( ; i<text.size() ; i++){
+        char c = in[i];
+        out[i] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+    }
+    return result;
+}
+
+std::string collationKey(std::string_view text)
+{
+    // Most names are plain ASCII, where only A-Z need to change
+    if (isAscii(text)){
+        return asciiToLower(text);
+    }
+    std::string key;
+    key.reserve(text.size());
+    std::size_t i = 0;
+    while (i < text.size()){
+        char c = text[i];
+        if (static_cast<unsigned char>(c) < 0x80){
+            key.push_back((c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c);
+            i++;
+            continue;
+        }
+        char32_t code_point;
+        std::size_t length = decodeUtf8(text, i, code_point);
+        if (length == 0){
+            key.push_back(c);
+            i++;
+            continue;
+        }
+        if (code_point >= 0x00C0 && code_point <= 0x00FF && latin_1_folds[code_point - 0x00C0] != '*'){
+            appendLatinFold(key, latin_1_folds[code_point - 0x00C0]);
+        } else if (code_point >= 0x0100 && code_point <= 0x017F){
+            appendLatinFold(key, latin_extended_a_folds[code_point - 0x0100]);
+        } else if (code_point >= 0x0300 && code_point <= 0x036F){
+            // A combining accent, as in a name typed in decomposed form, which is ignored like any other accent
+        } else if (char32_t folded = foldGreekOrCyrillic(code_point)){
+            appendUtf8(key, folded);
+        } else{
+            key.append(text.substr(i, length));
+        }
+        i += length;
+    }
+    return key;
+}
+
+std::string phoneNumberDigits(std::string_view phone_number)
+{
+    std::string digits;
+    digits.reserve(phone_number.size());
+    for (char c : phone_number){
+        if (c >= '0' && c <= '9'){
+            digits.push_back(c);
+        }
+    }
+    return digits;
+}
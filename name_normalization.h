@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+/// Helpers that put names into the form the address book stores and searches them in.
+/// They are used on every add, remove, alter and find, so they avoid regex and locales
+/// and work through 16 bytes at a time where SSE2 is available.
+
+/// Whitespace is anything std::isspace accepts in the "C" locale: space, \t, \n, \v, \f and \r
+bool isWhitespace(char);
+
+/// True if the text is empty or only holds whitespace
+bool isBlank(std::string_view);
+
+/// Returns a copy of the text with every whitespace character taken out
+std::string removeWhitespace(std::string_view);
+
+/// Takes every whitespace character out of the text in place
+void removeWhitespaceInPlace(std::string&);
+
+/// Returns a copy of the text with A-Z changed to a-z. Every other byte is left alone.
+std::string asciiToLower(std::string_view);
+
+/// Returns the key a name is sorted and searched by, so that names can be compared with a plain byte comparison
+/// instead of collating them on every comparison. It is worked out once, when an entry is indexed.
+/// The key is the name in UTF-8 with case and accents folded away, like the first level of the Unicode collation
+/// algorithm: "Émile", "EMILE" and "emile" share a key, as do "Straße" and "strasse".
+/// Latin letters fold to a-z, so accented names sort among the unaccented ones, and Greek and Cyrillic fold to lower case.
+/// Combining accents are dropped and every other character is kept as it is. Bytes that are not valid UTF-8 are kept too.
+/// The key of a name's prefix is always a prefix of the name's key, so prefix searches work on the keys.
+std::string collationKey(std::string_view);
+
+/// Returns just the digits of a phone number, so "+44 (0)1632 960-001" becomes "4401632960001".
+/// Phone numbers are indexed and searched in this form.
+std::string phoneNumberDigits(std::string_view);